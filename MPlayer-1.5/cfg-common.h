@@ -31,6 +31,7 @@
 #include "libmpdemux/demux_ts.h"
 #include "libmpdemux/demux_viv.h"
 #include "libmpdemux/demuxer.h"
+#include "libmpdemux/index_cache.h"
 #include "libmpdemux/mf.h"
 #include "sub/sub.h"
 #include "sub/unrar_exec.h"
@@ -47,6 +48,7 @@
 #include "config.h"
 #include "m_config.h"
 #include "m_option.h"
+#include "mp_mem.h"
 #include "mp_msg.h"
 #include "mpcommon.h"
 #ifdef CONFIG_POSTPROC
@@ -324,6 +326,14 @@ const m_option_t common_opts[] = {
 #else
     {"cache", "MPlayer was compiled without cache2 support.\n", CONF_TYPE_PRINT, CONF_NOCFG, 0, 0, NULL},
 #endif /* CONFIG_STREAM_CACHE */
+    {"lowmem", &mp_mem_lowmem, CONF_TYPE_FLAG, 0, 0, 1, NULL},
+    {"nolowmem", &mp_mem_lowmem, CONF_TYPE_FLAG, 0, 1, 0, NULL},
+    {"mmap", &stream_file_mmap, CONF_TYPE_FLAG, 0, 0, 1, NULL},
+    {"nommap", &stream_file_mmap, CONF_TYPE_FLAG, 0, 1, 0, NULL},
+#if HAVE_PTHREADS
+    {"readahead", &stream_readahead, CONF_TYPE_INT, CONF_RANGE, -1, 64, NULL},
+    {"readahead-size", &stream_readahead_size, CONF_TYPE_INT, CONF_RANGE, 4, 65536, NULL},
+#endif
     {"vcd", "-vcd N has been removed, use vcd://N instead.\n", CONF_TYPE_PRINT, CONF_NOCFG ,0,0, NULL},
     {"cuefile", "-cuefile has been removed, use cue://filename:N where N is the track number.\n", CONF_TYPE_PRINT, 0, 0, 0, NULL},
     {"cdrom-device", &cdrom_device, CONF_TYPE_STRING, 0, 0, 0, NULL},
@@ -416,6 +426,10 @@ const m_option_t common_opts[] = {
     {"forceidx", &index_mode, CONF_TYPE_FLAG, 0, -1, 2, NULL},
     {"saveidx", &index_file_save, CONF_TYPE_STRING, 0, 0, 0, NULL},
     {"loadidx", &index_file_load, CONF_TYPE_STRING, 0, 0, 0, NULL},
+    // AAC and Ogg: keep seek indexes in a per-file cache
+    {"index-cache", &index_cache, CONF_TYPE_FLAG, 0, 0, 1, NULL},
+    {"noindex-cache", &index_cache, CONF_TYPE_FLAG, 0, 1, 0, NULL},
+    {"index-cache-dir", &index_cache_dir, CONF_TYPE_STRING, 0, 0, 0, NULL},
 
     // select audio/video/subtitle stream
     {"aid", &audio_id, CONF_TYPE_INT, CONF_RANGE, -2, 8190, NULL},
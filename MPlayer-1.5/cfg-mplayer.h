@@ -35,6 +35,7 @@
 #include "libvo/vo_fbdev.h"
 #include "libvo/vo_zr.h"
 #include "mp_fifo.h"
+#include "probe.h"
 
 
 const m_option_t vd_conf[]={
@@ -91,6 +92,9 @@ const m_option_t mplayer_opts[]={
     {"master", "Option -master has been removed, use -af volume instead.\n", CONF_TYPE_PRINT, 0, 0, 0, NULL},
     // override audio buffer size (used only by -ao oss, anyway obsolete...)
     {"abs", &ao_data.buffersize, CONF_TYPE_INT, CONF_MIN, 0, 0, NULL},
+    {"audio-seek-buffer", &audio_seek_buffer, CONF_TYPE_FLOAT, CONF_RANGE, 0, 600, NULL},
+    {"demuxer-readahead", &demux_readahead, CONF_TYPE_FLOAT, CONF_RANGE, 0, 3600, NULL},
+    {"demuxer-readahead-size", &demux_readahead_size, CONF_TYPE_INT, CONF_RANGE, 16, 1048576, NULL},
 
     // -ao pcm options:
     {"aofile", "-aofile has been removed. Use -ao pcm:file=<filename> instead.\n", CONF_TYPE_PRINT, 0, 0, 0, NULL},
@@ -358,6 +362,8 @@ const m_option_t mplayer_opts[]={
 
     {"list-properties", &list_properties, CONF_TYPE_FLAG, CONF_GLOBAL, 0, 1, NULL},
     {"identify", &mp_msg_levels[MSGT_IDENTIFY], CONF_TYPE_FLAG, CONF_GLOBAL, 0, MSGL_V, NULL},
+    {"probe-batch", &probe_batch, CONF_TYPE_FLAG, CONF_GLOBAL, 0, 1, NULL},
+    {"probe-threads", &probe_threads, CONF_TYPE_INT, CONF_RANGE|CONF_GLOBAL, 1, 64, NULL},
     {"-help", help_text, CONF_TYPE_PRINT, CONF_NOCFG|CONF_GLOBAL, 0, 0, NULL},
     {"help", help_text, CONF_TYPE_PRINT, CONF_NOCFG|CONF_GLOBAL, 0, 0, NULL},
     {"h", help_text, CONF_TYPE_PRINT, CONF_NOCFG|CONF_GLOBAL, 0, 0, NULL},
@@ -570,6 +570,116 @@ static char *codec_strs = NULL;
 static unsigned codec_strs_len = 0;
 static int nr_vcodecs = 0;
 static int nr_acodecs = 0;
+static codecs_index_t video_index;
+static codecs_index_t audio_index;
+static unsigned int *index_mem[2];
+
+#define CODECS_INDEX_END 0xffffffff
+
+static unsigned codecs_hash(unsigned int fourcc, unsigned bits)
+{
+    return (fourcc * 2654435761U) >> (32 - bits);
+}
+
+static int codecs_index_slot(const codecs_index_t *idx, unsigned int fourcc)
+{
+    unsigned mask = (1U << idx->bits) - 1;
+    unsigned h = codecs_hash(fourcc, idx->bits);
+    while (idx->fourcc[h] != 0xffffffff && idx->fourcc[h] != fourcc)
+        h = (h + 1) & mask;
+    return h;
+}
+
+/**
+ * \brief build the fourcc index of a codec table
+ * \param mem set to the single allocation holding the index tables
+ * \return 0 if out of memory, 1 otherwise
+ */
+static int codecs_index_build(codecs_index_t *idx, unsigned int **mem,
+                              const codecs_t *c, int nr)
+{
+    unsigned int *fourcc, *list, *entries, *pos;
+    unsigned nr_fourcc = 0, nr_dummy = 0, nr_entries, size, bits = 4;
+    int i, j, k, h;
+
+    for (i = 0; i < nr; i++) {
+        if (c[i].flags & CODECS_FLAG_DUMMY)
+            nr_dummy++;
+        else
+            for (j = 0; j < CODECS_MAX_FOURCC && c[i].fourcc[j] != 0xffffffff; j++)
+                nr_fourcc++;
+    }
+    while ((1U << bits) < 2 * nr_fourcc)
+        bits++;
+    size = 1U << bits;
+    // dummy list and one list with terminator per fourcc at most
+    nr_entries = nr_dummy + 1 + nr_fourcc * (nr_dummy + 2);
+    *mem = malloc((3 * size + nr_entries) * sizeof(**mem));
+    if (!*mem)
+        return 0;
+    fourcc  = *mem;
+    list    = fourcc + size;
+    pos     = list + size;
+    entries = pos + size;
+    memset(fourcc, 0xff, size * sizeof(*fourcc));
+    memset(list, 0, size * sizeof(*list));
+    idx->bits    = bits;
+    idx->fourcc  = fourcc;
+    idx->list    = list;
+    idx->entries = entries;
+
+    // count the codecs of each fourcc, list[] holds the counts for now
+    for (i = 0; i < nr; i++) {
+        if (c[i].flags & CODECS_FLAG_DUMMY)
+            continue;
+        for (j = 0; j < CODECS_MAX_FOURCC && c[i].fourcc[j] != 0xffffffff; j++) {
+            for (k = 0; k < j && c[i].fourcc[k] != c[i].fourcc[j]; k++)
+                /* NOTHING */;
+            if (k < j)
+                continue;   // listed twice, the first slot wins
+            h = codecs_index_slot(idx, c[i].fourcc[j]);
+            fourcc[h] = c[i].fourcc[j];
+            list[h]++;
+        }
+    }
+    nr_entries = nr_dummy + 1;
+    for (h = 0; h < size; h++)
+        if (fourcc[h] != 0xffffffff) {
+            unsigned len = list[h] + nr_dummy;
+            list[h] = pos[h] = nr_entries;
+            entries[nr_entries + len] = CODECS_INDEX_END;
+            nr_entries += len + 1;
+        }
+    entries[nr_dummy] = CODECS_INDEX_END;
+
+    // fill the lists in table order, dummy codecs match any fourcc
+    nr_dummy = 0;
+    for (i = 0; i < nr; i++) {
+        if (c[i].flags & CODECS_FLAG_DUMMY) {
+            entries[nr_dummy++] = i << 8;
+            for (h = 0; h < size; h++)
+                if (fourcc[h] != 0xffffffff)
+                    entries[pos[h]++] = i << 8;
+            continue;
+        }
+        for (j = 0; j < CODECS_MAX_FOURCC && c[i].fourcc[j] != 0xffffffff; j++) {
+            h = codecs_index_slot(idx, c[i].fourcc[j]);
+            if (pos[h] > list[h] && entries[pos[h] - 1] >> 8 == i)
+                continue;
+            entries[pos[h]++] = i << 8 | j;
+        }
+    }
+    return 1;
+}
+
+static const unsigned int *codecs_index_lookup(const codecs_index_t *idx,
+                                               unsigned int fourcc)
+{
+    int h = codecs_index_slot(idx, fourcc);
+    if (idx->fourcc[h] == 0xffffffff)
+        return idx->entries;
+    return idx->entries + idx->list[h];
+}
 
 const char *codec_idx2str(unsigned idx)
 {
@@ -635,6 +745,8 @@ int parse_codec_cfg(const char *cfgfile)
         nr_acodecs = sizeof(builtin_audio_codecs)/sizeof(codecs_t);
         codec_strs = builtin_codec_strs;
         codec_strs_len = sizeof(builtin_codec_strs);
+        video_index = builtin_video_codecs_index;
+        audio_index = builtin_audio_codecs_index;
         return 1;
 #endif
     }
@@ -842,6 +954,11 @@ int parse_codec_cfg(const char *cfgfile)
     mp_msg(MSGT_CODECCFG,MSGL_INFO,MSGTR_AudioVideoCodecTotals, nr_acodecs, nr_vcodecs);
     if(video_codecs) video_codecs[nr_vcodecs].name_idx = 0;
     if(audio_codecs) audio_codecs[nr_acodecs].name_idx = 0;
+    if (!codecs_index_build(&video_index, &index_mem[0], video_codecs, nr_vcodecs) ||
+        !codecs_index_build(&audio_index, &index_mem[1], audio_codecs, nr_acodecs)) {
+        mp_msg(MSGT_CODECCFG,MSGL_FATAL,MSGTR_CantReallocCodecsp, strerror(errno));
+        goto err_out;
+    }
 out:
     free(line);
     line=NULL;
@@ -876,6 +993,12 @@ void codecs_uninit_free(void) {
     free(codec_strs);
     codec_strs=NULL;
     codec_strs_len = 0;
+    free(index_mem[0]);
+    index_mem[0] = NULL;
+    free(index_mem[1]);
+    index_mem[1] = NULL;
+    memset(&video_index, 0, sizeof(video_index));
+    memset(&audio_index, 0, sizeof(audio_index));
 }
 
 codecs_t *find_audio_codec(unsigned int fourcc, unsigned int *fourccmap,
@@ -895,6 +1018,8 @@ codecs_t* find_codec(unsigned int fourcc,unsigned int *fourccmap,
 {
     int i, j;
     codecs_t *c;
+    const codecs_index_t *idx;
+    const unsigned int *e;
 
 #if 0
     if (start) {
@@ -913,11 +1038,22 @@ codecs_t* find_codec(unsigned int fourcc,unsigned int *fourccmap,
         if (audioflag) {
             i = nr_acodecs;
             c = audio_codecs;
+            idx = &audio_index;
         } else {
             i = nr_vcodecs;
             c = video_codecs;
+            idx = &video_index;
         }
         if(!i) return NULL;
+        if (!force) {
+            for (e = codecs_index_lookup(idx, fourcc); *e != CODECS_INDEX_END; e++) {
+                if (start && c + (*e >> 8) <= start) continue;
+                if (fourccmap)
+                    *fourccmap = c[*e >> 8].fourccmap[*e & 0xff];
+                return c + (*e >> 8);
+            }
+            return NULL;
+        }
         for (/* NOTHING */; i--; c++) {
             if(start && c<=start) continue;
             for (j = 0; j < CODECS_MAX_FOURCC; j++) {
@@ -933,6 +1069,32 @@ codecs_t* find_codec(unsigned int fourcc,unsigned int *fourccmap,
     return NULL;
 }
 
+/**
+ * \brief get all codecs that handle a fourcc with a single index lookup
+ * \param codecs [out] up to max codecs in codecs.conf order
+ * \param fourccmap [out] fourcc the codec maps each of them to, may be NULL
+ * \return total number of matching codecs, may be larger than max
+ */
+int find_codecs(unsigned int fourcc, int audioflag, codecs_t **codecs,
+                unsigned int *fourccmap, int max)
+{
+    const codecs_index_t *idx = audioflag ? &audio_index : &video_index;
+    codecs_t *c = audioflag ? audio_codecs : video_codecs;
+    const unsigned int *e;
+    int n = 0;
+
+    if (!(audioflag ? nr_acodecs : nr_vcodecs))
+        return 0;
+    for (e = codecs_index_lookup(idx, fourcc); *e != CODECS_INDEX_END; e++, n++) {
+        if (n >= max)
+            continue;
+        codecs[n] = c + (*e >> 8);
+        if (fourccmap)
+            fourccmap[n] = codecs[n]->fourccmap[*e & 0xff];
+    }
+    return n;
+}
+
 void stringset_init(stringset_t *set) {
     *set = calloc(1, sizeof(char *));
 }
@@ -1117,13 +1279,17 @@ int main(int argc, char* argv[])
         codecs_t* cod[2];
         int nr[2];
 
+        const codecs_index_t *idx[2];
+
         nm[0] = "builtin_video_codecs";
         cod[0] = video_codecs;
         nr[0] = nr_vcodecs;
+        idx[0] = &video_index;
 
         nm[1] = "builtin_audio_codecs";
         cod[1] = audio_codecs;
         nr[1] = nr_acodecs;
+        idx[1] = &audio_index;
 
         printf("/* GENERATED FROM %s, DO NOT EDIT! */\n\n",argv[1]);
         printf("#include <stddef.h>\n");
@@ -1172,6 +1338,25 @@ int main(int argc, char* argv[])
             }
             printf("};\n\n");
         }
+        for (i=0; i<2; i++) {
+            const unsigned int *e = idx[i]->entries;
+            int size = 1 << idx[i]->bits;
+            int nr_entries = 0;
+            for (j = 0; j < size; j++)
+                if (idx[i]->fourcc[j] != 0xffffffff)
+                    nr_entries = idx[i]->list[j];
+            while (e[nr_entries++] != CODECS_INDEX_END)
+                /* NOTHING */;
+            printf("static const unsigned int %s_fourcc[] = ", nm[i]);
+            print_int_array(idx[i]->fourcc, size);
+            printf(";\n\nstatic const unsigned int %s_list[] = ", nm[i]);
+            print_int_array(idx[i]->list, size);
+            printf(";\n\nstatic const unsigned int %s_entries[] = ", nm[i]);
+            print_int_array(e, nr_entries);
+            printf(";\n\nconst codecs_index_t %s_index = {\n"
+                   "%u, %s_fourcc, %s_list, %s_entries\n};\n\n",
+                   nm[i], idx[i]->bits, nm[i], nm[i], nm[i]);
+        }
         printf("const char builtin_codec_strs[] = ");
         print_char_array(codec_strs, codec_strs_len);
         printf(";\n");
@@ -77,6 +77,18 @@ typedef struct codecs {
     short cpuflags;
 } codecs_t;
 
+/* Hash index from fourcc to the codecs that handle it. Each candidate
+   list holds the numbers of the matching codecs in codecs.conf order as
+   codec << 8 | fourcc slot and ends with 0xffffffff. The list at the
+   start of entries holds only the dummy codecs and is used for fourccs
+   that no codec names. */
+typedef struct codecs_index {
+    unsigned int bits;              // log2 of the number of slots
+    const unsigned int *fourcc;     // key of each slot, 0xffffffff if free
+    const unsigned int *list;       // candidate list of each slot in entries
+    const unsigned int *entries;
+} codecs_index_t;
+
 int parse_codec_cfg(const char *cfgfile);
 codecs_t* find_video_codec(unsigned int fourcc, unsigned int *fourccmap,
                            codecs_t *start, int force);
@@ -84,6 +96,8 @@ codecs_t* find_audio_codec(unsigned int fourcc, unsigned int *fourccmap,
                            codecs_t *start, int force);
 codecs_t* find_codec(unsigned int fourcc, unsigned int *fourccmap,
                      codecs_t *start, int audioflag, int force);
+int find_codecs(unsigned int fourcc, int audioflag, codecs_t **codecs,
+                unsigned int *fourccmap, int max);
 void list_codecs(int audioflag);
 void codecs_uninit_free(void);
 const char *codec_idx2str(unsigned idx);
@@ -30,6 +30,7 @@
 #include "libmpdemux/demuxer.h"
 #include "libmpdemux/stheader.h"
 #include "codec-cfg.h"
+#include "mp_mem.h"
 #include "mp_msg.h"
 #include "mplayer.h"
 #include "sub/sub.h"
@@ -450,6 +451,24 @@ static int mp_property_time_pos(m_option_t *prop, int action,
                                                 mpctx->audio_out));
 }
 
+/// Time read ahead of the playback position (RO)
+static int mp_property_buffered_duration(m_option_t *prop, int action,
+                                         void *arg, MPContext *mpctx)
+{
+    demux_stream_t *ds;
+    double pos, end;
+
+    if (!mpctx->demuxer || !(mpctx->sh_audio || mpctx->sh_video))
+        return M_PROPERTY_UNAVAILABLE;
+    ds  = mpctx->sh_audio ? mpctx->d_audio : mpctx->d_video;
+    end = ds_buffered_pts(ds);
+    pos = mpctx->sh_video ? mpctx->sh_video->pts :
+          playing_audio_pts(mpctx->sh_audio, mpctx->d_audio, mpctx->audio_out);
+    if (end == MP_NOPTS_VALUE || pos == MP_NOPTS_VALUE)
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_time_ro(prop, action, arg, FFMAX(end - pos, 0));
+}
+
 /// Current chapter (RW)
 static int mp_property_chapter(m_option_t *prop, int action, void *arg,
                                MPContext *mpctx)
@@ -640,6 +659,56 @@ static int mp_property_metadata(m_option_t *prop, int action, void *arg,
     return M_PROPERTY_NOT_IMPLEMENTED;
 }
 
+/// Accounted memory in kB, memory/<subsystem> or memory/peak for details (RO)
+static int mp_property_memory(m_option_t *prop, int action, void *arg,
+                              MPContext *mpctx)
+{
+    m_property_action_t *ka;
+    int tag;
+    static const m_option_t key_type =
+        { "memory", NULL, CONF_TYPE_INT, 0, 0, 0, NULL };
+
+    if (action != M_PROPERTY_KEY_ACTION)
+        return m_property_int_ro(prop, action, arg,
+                                 mp_mem_get(&mp_mem_used[MP_MEM_TAGS]) >> 10);
+    if (!arg)
+        return M_PROPERTY_ERROR;
+    ka = arg;
+    tag = mp_mem_tag_by_name(ka->key);
+    if (tag < 0 && strcmp(ka->key, "peak"))
+        return M_PROPERTY_UNKNOWN;
+    switch (ka->action) {
+    case M_PROPERTY_GET:
+        if (!ka->arg)
+            return M_PROPERTY_ERROR;
+        *(int *)ka->arg = mp_mem_get(tag < 0 ? &mp_mem_peak[MP_MEM_TAGS] : &mp_mem_used[tag]) >> 10;
+        return M_PROPERTY_OK;
+    case M_PROPERTY_GET_TYPE:
+        if (!ka->arg)
+            return M_PROPERTY_ERROR;
+        *(const m_option_t **)ka->arg = &key_type;
+        return M_PROPERTY_OK;
+    }
+    return M_PROPERTY_NOT_IMPLEMENTED;
+}
+
+/// Read latency histogram of the -readahead file reader (RO)
+static int mp_property_read_latency(m_option_t *prop, int action, void *arg,
+                                    MPContext *mpctx)
+{
+    struct stream_read_latency lat;
+    static char str[STREAM_LATENCY_BUCKETS * 11 + 64];
+    int i, n = 0;
+
+    if (!mpctx->stream ||
+        stream_control(mpctx->stream, STREAM_CTRL_GET_READ_LATENCY, &lat) != STREAM_OK)
+        return M_PROPERTY_UNAVAILABLE;
+    for (i = 0; i < STREAM_LATENCY_BUCKETS; i++)
+        n += sprintf(str + n, "%s%u", i ? "," : "", lat.count[i]);
+    sprintf(str + n, " stalls=%u depth=%d/%d", lat.stalls, lat.depth, lat.max_depth);
+    return m_property_string_ro(prop, action, arg, str);
+}
+
 static int mp_property_pause(m_option_t *prop, int action, void *arg,
                              MPContext *mpctx)
 {
@@ -2111,6 +2180,8 @@ static const m_option_t mp_properties[] = {
      M_OPT_RANGE, 0, 100, NULL },
     { "time_pos", mp_property_time_pos, CONF_TYPE_TIME,
      M_OPT_MIN, 0, 0, NULL },
+    { "buffered_duration", mp_property_buffered_duration, CONF_TYPE_TIME,
+     M_OPT_MIN, 0, 0, NULL },
     { "chapter", mp_property_chapter, CONF_TYPE_INT,
      M_OPT_MIN, 0, 0, NULL },
     { "titles", mp_property_titles, CONF_TYPE_INT,
@@ -2121,6 +2192,10 @@ static const m_option_t mp_properties[] = {
      CONF_RANGE, -2, 10, NULL },
     { "metadata", mp_property_metadata, CONF_TYPE_STRING_LIST,
      0, 0, 0, NULL },
+    { "memory", mp_property_memory, CONF_TYPE_INT,
+     0, 0, 0, NULL },
+    { "read_latency", mp_property_read_latency, CONF_TYPE_STRING,
+     0, 0, 0, NULL },
     { "pause", mp_property_pause, CONF_TYPE_FLAG,
      M_OPT_RANGE, 0, 1, NULL },
     { "capturing", mp_property_capture, CONF_TYPE_FLAG,
@@ -249,7 +249,7 @@ void
 do_cpuid(unsigned int ax, unsigned int *p)
 {
 #ifdef _MSC_VER
-    __cpuid(p, ax);
+    __cpuidex(p, ax, 0);
 #else
 // code from libavcodec:
     __asm__ volatile
@@ -258,7 +258,20 @@ do_cpuid(unsigned int ax, unsigned int *p)
          "xchg %%"REG_b", %%"REG_S
          : "=a" (p[0]), "=S" (p[1]),
            "=c" (p[2]), "=d" (p[3])
-         : "0" (ax));
+         : "0" (ax), "2" (0)); // subleaf 0 for the leaves that have them
+#endif
+}
+
+// return the OS enabled state components, XCR0
+static unsigned int get_xcr0(void)
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ volatile (".byte 0x0f, 0x01, 0xd0" // xgetbv
+                      : "=a" (eax), "=d" (edx) : "c" (0));
+    return eax;
 #endif
 }
 
@@ -308,6 +321,14 @@ void GetCpuCaps( CpuCaps *caps)
         caps->hasSSE4 = (regs2[2] & (1 << 19 )) >> 19; // 0x0080000
         caps->hasSSE42 = (regs2[2] & (1 << 20)) >> 20; // 0x0100000
         caps->hasAVX  = (regs2[2] & (1 << 28 )) >> 28; // 0x10000000
+        // the OS has to save the YMM registers too (OSXSAVE and XCR0)
+        if (caps->hasAVX && (!(regs2[2] & (1 << 27)) || (get_xcr0() & 6) != 6))
+            caps->hasAVX = 0;
+        if (caps->hasAVX && regs[0] >= 0x00000007) {
+            unsigned int regs3[4];
+            do_cpuid(0x00000007, regs3);
+            caps->hasAVX2 = (regs3[1] & (1 << 5 )) >> 5; // 0x0000020
+        }
         caps->hasMMX2 = caps->hasSSE; // SSE cpus supports mmxext too
         cl_size = ((regs2[1] >> 8) & 0xFF)*8;
         if(cl_size) caps->cl_size = cl_size;
@@ -454,6 +475,7 @@ void GetCpuCaps( CpuCaps *caps)
     caps->hasSSE42=0;
     caps->hasSSE4a=0;
     caps->hasAVX=0;
+    caps->hasAVX2=0;
     caps->isX86=0;
     caps->hasAltiVec = 0;
 #if HAVE_ALTIVEC
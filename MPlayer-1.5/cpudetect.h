@@ -40,6 +40,7 @@ typedef struct cpucaps_s {
     int hasSSE42;
     int hasSSE4a;
     int hasAVX;
+    int hasAVX2;
     int isX86;
     unsigned cl_size; /* size of cache line */
     int hasAltiVec;
@@ -22,9 +22,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include "osdep/strsep.h"
 #include "libmpcodecs/dec_audio.h"
+#include "mp_mem.h"
 #include "mp_msg.h"
 #include "af.h"
 
@@ -35,6 +37,7 @@ extern const af_info_t af_info_channels;
 extern const af_info_t af_info_format;
 extern const af_info_t af_info_resample;
 extern const af_info_t af_info_volume;
+extern const af_info_t af_info_volpack;
 extern const af_info_t af_info_equalizer;
 extern const af_info_t af_info_gate;
 extern const af_info_t af_info_comp;
@@ -42,7 +45,9 @@ extern const af_info_t af_info_pan;
 extern const af_info_t af_info_surround;
 extern const af_info_t af_info_sub;
 extern const af_info_t af_info_export;
+extern const af_info_t af_info_meter;
 extern const af_info_t af_info_volnorm;
+extern const af_info_t af_info_loudnorm;
 extern const af_info_t af_info_extrastereo;
 extern const af_info_t af_info_lavcac3enc;
 extern const af_info_t af_info_lavcresample;
@@ -63,6 +68,7 @@ static const af_info_t * const filter_list[] = {
    &af_info_format,
    &af_info_resample,
    &af_info_volume,
+   &af_info_volpack,
    &af_info_equalizer,
    &af_info_gate,
    &af_info_comp,
@@ -71,8 +77,10 @@ static const af_info_t * const filter_list[] = {
    &af_info_sub,
 #if HAVE_SYS_MMAN_H
    &af_info_export,
+   &af_info_meter,
 #endif
    &af_info_volnorm,
+   &af_info_loudnorm,
    &af_info_extrastereo,
 #ifdef CONFIG_FFMPEG
    &af_info_lavcac3enc,
@@ -158,6 +166,7 @@ static af_instance_t* af_create(af_stream_t* s, const char* name_with_cmd)
   }
 
   mp_msg(MSGT_AFILTER, MSGL_V, "[libaf] Adding filter %s \n",name);
+  new->arena = &s->arena;
 
   // Initialize the new filter
   if(AF_OK == new->info->open(new) &&
@@ -226,6 +235,40 @@ static af_instance_t* af_append(af_stream_t* s, af_instance_t* af, const char* n
   return new;
 }
 
+/* Replace chain buffer i with an aligned one of len bytes. Filters
+   further down the chain may still point into the old one when a play
+   stopped early or the chain changed, they are marked as borrowed and
+   only point into the new one on their next play. */
+static int af_arena_grow(af_arena_t* a, int i, int len)
+{
+  void* mem = malloc(len + AF_ARENA_ALIGN - 1);
+  if(!mem){
+    mp_msg(MSGT_AFILTER, MSGL_FATAL, "[libaf] Could not allocate memory \n");
+    return AF_ERROR;
+  }
+  mp_msg(MSGT_AFILTER, MSGL_V, "[libaf] Reallocating chain buffer %d, "
+	 "old len = %i, new len = %i\n",i,a->size[i],len);
+  mp_mem_account(MP_MEM_LIBAF, len - a->size[i]);
+  free(a->mem[i]);
+  a->mem[i]  = mem;
+  a->buf[i]  = (void*)(((uintptr_t)mem + AF_ARENA_ALIGN - 1) &
+		       ~(uintptr_t)(AF_ARENA_ALIGN - 1));
+  a->size[i] = len;
+  return AF_OK;
+}
+
+// Largest length multiplier from the input to any point of the chain
+static double af_peak_multiplier(af_stream_t* s)
+{
+  af_instance_t* af;
+  double mul = 1, peak = 1;
+  for(af = s->first; af; af = af->next){
+    mul *= af->mul;
+    peak = FFMAX(peak, mul);
+  }
+  return peak;
+}
+
 // Uninit and remove the filter "af"
 void af_remove(af_stream_t* s, af_instance_t* af)
 {
@@ -247,6 +290,11 @@ void af_remove(af_stream_t* s, af_instance_t* af)
   else
     s->last=af->prev;
 
+  // The chain buffers are not owned by the filter, and a borrowed
+  // pointer may already point into a buffer the arena has replaced
+  if(af->data && af->borrowed)
+    af->data->audio = NULL;
+
   // Uninitialize af and free memory
   af->uninit(af);
   free(af);
@@ -301,6 +349,7 @@ int af_reinit(af_stream_t* s, af_instance_t* af)
 	  // Create format filter
 	  if(NULL == (new = af_prepend(s,af,"format")))
 	    return AF_ERROR;
+	  new->auto_format = 1;
 	  // Set output bits per sample
 	  in.format |= af_bits2fmt(in.bps*8);
 	  if(AF_OK != (rv = new->control(new,AF_CONTROL_FORMAT_FMT,&in.format)))
@@ -353,6 +402,10 @@ void af_uninit(af_stream_t* s)
 {
   while(s->first)
     af_remove(s,s->first);
+  mp_mem_account(MP_MEM_LIBAF, -(s->arena.size[0] + s->arena.size[1]));
+  free(s->arena.mem[0]);
+  free(s->arena.mem[1]);
+  memset(&s->arena,0,sizeof(s->arena));
 }
 
 /**
@@ -379,12 +432,15 @@ static int fixup_output_format(af_stream_t* s)
     // Check output format fix if not OK
     if(s->output.format != AF_FORMAT_UNKNOWN &&
 		s->last->data->format != s->output.format){
-      if(strcmp(s->last->info->name,"format"))
-	af = af_append(s,s->last,"format");
-      else
+      s->output.format |= af_bits2fmt(s->output.bps*8);
+      // volpack converts itself if it supports the format
+      if(!strcmp(s->last->info->name,"format") ||
+         (!strcmp(s->last->info->name,"volpack") &&
+          AF_OK == s->last->control(s->last,AF_CONTROL_FORMAT_FMT,&(s->output.format))))
 	af = s->last;
+      else if((af = af_append(s,s->last,"format")))
+	af->auto_format = 1;
       // Init the new filter
-      s->output.format |= af_bits2fmt(s->output.bps*8);
       if(!af || (AF_OK != af->control(af,AF_CONTROL_FORMAT_FMT,&(s->output.format))))
 	return AF_ERROR;
       if(AF_OK != af_reinit(s,af))
@@ -407,6 +463,285 @@ static int fixup_output_format(af_stream_t* s)
     return AF_OK;
 }
 
+/* Chain planner. af_reinit() converts the format right in front of each
+   filter that does not take what it gets, which can convert back and
+   forth or convert after an upmix or a resample to a higher rate. The
+   planner knows the formats each filter processes as they are
+   (AF_CONTROL_FORMAT_CAPS) and the samples per second at each point
+   of the chain, and moves the format filters to where the total cost
+   is lowest. */
+
+#define PLAN_MAX_FMT	8
+#define PLAN_CONV_COST	1.0	// Cost per sample of a format conversion
+
+typedef struct af_plan_node_s{
+  af_instance_t* af;	// Filter, NULL for the output of the chain
+  af_caps_t caps;	// Input formats, only one if not answered
+  int out_fmt;		// Output format, 0 if it is the input format
+  int convert;		// Converts to out_fmt itself (user format filter)
+  double samples;	// Samples per second at the input
+  // Cheapest way to get to this point in each format
+  double arrive[PLAN_MAX_FMT];	// Before a conversion in front of af
+  double ready[PLAN_MAX_FMT];	// After the conversion
+  int from[PLAN_MAX_FMT];	// Format converted from, for ready
+  int via[PLAN_MAX_FMT];	// Input format of the previous filter, for arrive
+}af_plan_node_t;
+
+static double plan_samples(af_data_t* d)
+{
+  return (double)d->nch * d->rate;
+}
+
+// Cost per second of filter n processing format, < 0 if not possible
+static double plan_filter_cost(const af_plan_node_t* n, int format)
+{
+  int i;
+  if(n->convert)
+    return format == n->out_fmt ? 0 : PLAN_CONV_COST * n->samples;
+  if(!n->caps.nfmt)
+    return n->caps.cost[0] * af_fmt2bits(format) / 8 * n->samples;
+  for(i = 0; i < n->caps.nfmt; i++)
+    if(n->caps.format[i] == format)
+      return n->caps.cost[i] * n->samples;
+  return -1;
+}
+
+static int plan_fmt_index(int* fmt, int* nfmt, int format)
+{
+  int i;
+  for(i = 0; i < *nfmt; i++)
+    if(fmt[i] == format)
+      return i;
+  if(*nfmt == PLAN_MAX_FMT)
+    return -1;
+  fmt[*nfmt] = format;
+  return (*nfmt)++;
+}
+
+/* Describe the current chain without the automatic format filters in
+   node[0..n-1] and node[n] (the output), returns n or -1 on error.
+   *cost is the cost of the chain as it is. */
+static int plan_nodes(af_stream_t* s, af_plan_node_t** nodes, double* cost)
+{
+  af_plan_node_t* node;
+  af_instance_t* af;
+  int n = 0;
+
+  for(af = s->first; af; af = af->next)
+    n++;
+  node = calloc(n + 1, sizeof(*node));
+  if(!node)
+    return -1;
+  *cost = 0;
+  n = 0;
+  for(af = s->first; af; af = af->next){
+    af_data_t* in = af->prev ? af->prev->data : &s->input;
+    af_plan_node_t* nd = &node[n];
+    if(af->auto_format){
+      *cost += PLAN_CONV_COST * plan_samples(in);
+      continue;
+    }
+    nd->af      = af;
+    nd->samples = plan_samples(in);
+    if(!strcmp(af->info->name,"format")){
+      nd->convert = 1;
+      nd->out_fmt = af->data->format;
+    }
+    else if(AF_OK != af->control(af,AF_CONTROL_FORMAT_CAPS,&nd->caps)){
+      // Takes only what it gets now
+      nd->caps.nfmt      = 1;
+      nd->caps.format[0] = in->format;
+      nd->caps.cost[0]   = 0;
+      nd->out_fmt        = af->data->format;
+    }
+    *cost += FFMAX(plan_filter_cost(nd, in->format), 0);
+    n++;
+  }
+  node[n].samples = plan_samples(s->last->data);
+  *nodes = node;
+  return n;
+}
+
+// Print the chain and its cost per input sample
+static void plan_print(af_stream_t* s, double cost, double unplanned)
+{
+  af_instance_t* af;
+  double norm = plan_samples(&s->input);
+
+  if(!mp_msg_test(MSGT_AFILTER, MSGL_V))
+    return;
+  mp_msg(MSGT_AFILTER, MSGL_V, "[libaf] Chain plan, estimated cost %.2f "
+	 "(unplanned %.2f) per input sample:\n[libaf]   %s %dch %dHz\n",
+	 norm ? cost / norm : 0, norm ? unplanned / norm : 0,
+	 af_fmt2str_short(s->input.format), s->input.nch, s->input.rate);
+  for(af = s->first; af; af = af->next)
+    mp_msg(MSGT_AFILTER, MSGL_V, "[libaf]   -> %s%s: %s %dch %dHz\n",
+	   af->info->name, af->auto_format ? " (auto)" : "",
+	   af_fmt2str_short(af->data->format), af->data->nch, af->data->rate);
+}
+
+/**
+ * Find the cheapest placement of the format conversions and rebuild
+ * the chain with it if it is cheaper than the current one.
+ * \return AF_ERROR if the chain could not be rebuilt, AF_OK otherwise.
+ */
+static int af_plan(af_stream_t* s)
+{
+  af_plan_node_t* node;
+  af_instance_t* af;
+  int fmt[PLAN_MAX_FMT], nfmt = 0;
+  int n, i, k, f, g, o, out;
+  double unplanned, cost;
+
+  if((AF_INIT_TYPE_MASK & s->cfg.force) == AF_INIT_FORCE ||
+     (AF_INIT_FORMAT_MASK & s->cfg.force) == AF_INIT_FLOAT)
+    return AF_OK;
+  n = plan_nodes(s, &node, &unplanned);
+  if(n < 0)
+    return AF_OK;
+
+  // Candidate formats between filters
+  plan_fmt_index(fmt, &nfmt, s->input.format);
+  plan_fmt_index(fmt, &nfmt, AF_FORMAT_S16_NE);
+  plan_fmt_index(fmt, &nfmt, AF_FORMAT_FLOAT_NE);
+  plan_fmt_index(fmt, &nfmt, AF_FORMAT_S32_NE);
+  for(k = 0; k < n; k++){
+    for(i = 0; i < node[k].caps.nfmt; i++)
+      plan_fmt_index(fmt, &nfmt, node[k].caps.format[i]);
+    if(node[k].out_fmt)
+      plan_fmt_index(fmt, &nfmt, node[k].out_fmt);
+  }
+  if((out = plan_fmt_index(fmt, &nfmt, s->output.format)) < 0){
+    free(node);
+    return AF_OK;
+  }
+
+  for(k = 0; k <= n; k++)
+    for(f = 0; f < nfmt; f++)
+      node[k].arrive[f] = node[k].ready[f] = HUGE_VAL;
+  node[0].arrive[0] = 0;
+  for(k = 0; k <= n; k++){
+    // Optional conversion in front of filter k
+    for(g = 0; g < nfmt; g++)
+      for(f = 0; f < nfmt; f++){
+	double c = node[k].arrive[f] +
+	  (f == g ? 0 : PLAN_CONV_COST * node[k].samples);
+	if(c < node[k].ready[g]){
+	  node[k].ready[g] = c;
+	  node[k].from[g]  = f;
+	}
+      }
+    if(k == n)
+      break;
+    // Filter k
+    for(g = 0; g < nfmt; g++){
+      double c = plan_filter_cost(&node[k], fmt[g]);
+      if(c < 0 || node[k].ready[g] == HUGE_VAL)
+	continue;
+      c += node[k].ready[g];
+      o = node[k].out_fmt ? plan_fmt_index(fmt, &nfmt, node[k].out_fmt) : g;
+      if(o < 0){
+	// Too many formats to plan, keep the chain as it is
+	free(node);
+	return AF_OK;
+      }
+      if(c < node[k+1].arrive[o]){
+	node[k+1].arrive[o] = c;
+	node[k+1].via[o]    = g;
+      }
+    }
+  }
+  cost = node[n].ready[out];
+
+  if(cost < unplanned * (1 - 1e-6)){
+    // Conversion target in front of each filter, 0 for none
+    int* conv = calloc(n + 1, sizeof(int));
+    if(!conv){
+      free(node);
+      return AF_OK;
+    }
+    for(g = out, k = n; k >= 0; k--){
+      f = node[k].from[g];
+      if(f != g)
+	conv[k] = fmt[g];
+      if(k)
+	g = node[k].via[f];
+    }
+    for(af = s->first; af; ){
+      af_instance_t* next = af->next;
+      if(af->auto_format)
+	af_remove(s,af);
+      af = next;
+    }
+    for(k = 0; k < n; k++){
+      if(!conv[k])
+	continue;
+      af = af_prepend(s,node[k].af,"format");
+      if(!af || AF_OK != af->control(af,AF_CONTROL_FORMAT_FMT,&conv[k])){
+	free(conv);
+	free(node);
+	return AF_ERROR;
+      }
+      af->auto_format = 1;
+    }
+    free(conv);
+    free(node);
+    if(AF_OK != af_reinit(s,s->first) || AF_OK != fixup_output_format(s))
+      return AF_ERROR;
+    // Measure what was built, filters may still have refused a format
+    if(plan_nodes(s, &node, &cost) < 0)
+      return AF_OK;
+  }
+  free(node);
+  plan_print(s, cost, unplanned);
+  return AF_OK;
+}
+
+/**
+ * Replace a volume filter followed by the final float conversion with
+ * volpack, which does both in one pass over the data. Not done when
+ * float processing is forced, af_volume then reports the peak level.
+ * \return the volpack instance or NULL if the chain was not changed.
+ */
+static af_instance_t* fuse_output(af_stream_t* s)
+{
+    af_instance_t* fmt = s->last;
+    af_instance_t* vol = fmt ? fmt->prev : NULL;
+    af_instance_t* af;
+    float level[AF_NCH];
+    int soft = 0;
+
+    // the dummy filter af_init adds to an empty chain is in the way
+    while(vol && !strcmp(vol->info->name,"dummy"))
+      vol = vol->prev;
+
+    if((AF_INIT_TYPE_MASK & s->cfg.force) == AF_INIT_FORCE ||
+       (AF_INIT_FORMAT_MASK & s->cfg.force) == AF_INIT_FLOAT)
+      return NULL;
+    if(!vol || strcmp(fmt->info->name,"format") ||
+       strcmp(vol->info->name,"volume") ||
+       vol->data->format != AF_FORMAT_FLOAT_NE)
+      return NULL;
+
+    af = af_append(s,fmt,"volpack");
+    if(!af)
+      return NULL;
+    if(AF_OK != af->control(af,AF_CONTROL_FORMAT_FMT,&fmt->data->format) ||
+       AF_OK != vol->control(vol,AF_CONTROL_VOLUME_GAIN | AF_CONTROL_GET,level)){
+      af_remove(s,af);
+      return NULL;
+    }
+    vol->control(vol,AF_CONTROL_VOLUME_SOFTCLIP | AF_CONTROL_GET,&soft);
+    af->control(af,AF_CONTROL_VOLUME_GAIN | AF_CONTROL_SET,level);
+    af->control(af,AF_CONTROL_VOLUME_SOFTCLIP | AF_CONTROL_SET,&soft);
+    while(vol->next != af)
+      af_remove(s,vol->next);
+    af_remove(s,vol);
+    if(AF_OK != af_reinit(s,s->first))
+      return NULL;
+    return af;
+}
+
 /**
  * Automatic downmix to stereo in case the codec does not implement it.
  */
@@ -532,7 +867,15 @@ int af_init(af_stream_t* s)
       af_uninit(s);
       return -1;
     }
+    if (AF_OK != af_plan(s)) {
+      mp_msg(MSGT_AFILTER, MSGL_ERR, "[libaf] Unable to rebuild the filter chain "
+	     "with the planned format conversions.\n");
+      af_uninit(s);
+      return -1;
+    }
+    fuse_output(s);
   }
+  s->arena.mul = af_peak_multiplier(s);
   return 0;
 }
 
@@ -542,7 +885,7 @@ int af_init(af_stream_t* s)
    If the filter couldn't be added the return value is NULL. */
 af_instance_t* af_add(af_stream_t* s, char* name){
   af_instance_t* new;
-  int first_is_format;
+  int first_is_format, is_volume;
   // Sanity check
   if(!s || !s->first || !name)
     return NULL;
@@ -554,10 +897,13 @@ af_instance_t* af_add(af_stream_t* s, char* name){
     new = af_prepend(s, s->first, name);
   if(!new)
     return NULL;
+  // af_reinit() may detach and free the new filter
+  is_volume = !strcmp(new->info->name, "volume");
 
   // Reinitalize the filter list
   if(AF_OK != af_reinit(s, s->first) ||
-     AF_OK != fixup_output_format(s)){
+     AF_OK != fixup_output_format(s) ||
+     AF_OK != af_plan(s)){
     // remove auto-inserted filters
     af_instance_t *to_remove = first_is_format ? s->first->next : s->first;
     while (to_remove != new)
@@ -571,6 +917,13 @@ af_instance_t* af_add(af_stream_t* s, char* name){
     fixup_output_format(s);
     return NULL;
   }
+  // a new volume filter may have been merged into volpack
+  if (is_volume) {
+    af_instance_t *fused = fuse_output(s);
+    if (fused)
+      new = fused;
+  }
+  s->arena.mul = af_peak_multiplier(s);
   return new;
 }
 
@@ -578,6 +931,11 @@ af_instance_t* af_add(af_stream_t* s, char* name){
 af_data_t* af_play(af_stream_t* s, af_data_t* data)
 {
   af_instance_t* af=s->first;
+  int i, len = af_lencalc(s->arena.mul,data);
+  // Size the chain buffers for the whole chain up front
+  for(i = 0; i < 2; i++)
+    if(s->arena.size[i] < len && AF_OK != af_arena_grow(&s->arena,i,len))
+      return NULL;
   // Iterate through all filters
   do{
     if (data->len <= 0) break;
@@ -631,6 +989,18 @@ int af_resize_local_buffer(af_instance_t* af, af_data_t* data)
 {
   // Calculate new length
   register int len = af_lencalc(af->mul,data);
+  if(af->arena){
+    // Use the chain buffer the input is not in
+    af_arena_t* a = af->arena;
+    int i = (char*)data->audio >= (char*)a->buf[0] &&
+	    (char*)data->audio <  (char*)a->buf[0] + a->size[0];
+    if(a->size[i] < len && AF_OK != af_arena_grow(a,i,len))
+      return AF_ERROR;
+    af->data->audio = a->buf[i];
+    af->data->len   = a->size[i];
+    af->borrowed    = 1;
+    return AF_OK;
+  }
   mp_msg(MSGT_AFILTER, MSGL_V, "[libaf] Reallocating memory in module %s, "
 	 "old len = %i, new len = %i\n",af->info->name,af->data->len,len);
   // If there is a buffer free it
@@ -658,6 +1028,17 @@ af_instance_t *af_control_any_rev (af_stream_t* s, int cmd, void* arg) {
   return NULL;
 }
 
+int af_control_all(af_stream_t* s, int cmd, void* arg) {
+  int n = 0;
+  af_instance_t* filt = s->first;
+  while (filt) {
+    if (filt->control(filt, cmd, arg) == AF_OK)
+      n++;
+    filt = filt->next;
+  }
+  return n;
+}
+
 void af_help (void) {
   int i = 0;
   mp_msg(MSGT_AFILTER, MSGL_INFO, "Available audio filters:\n");
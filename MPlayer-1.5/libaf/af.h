@@ -62,6 +62,20 @@ typedef struct af_info_s
   int (*open)(struct af_instance_s* vf);
 } af_info_t;
 
+// Alignment of the chain buffers
+#define AF_ARENA_ALIGN 64
+
+/* Output buffers shared by the filters of a chain. A filter that does
+   not work in place writes into the buffer its input is not in, so the
+   data goes back and forth between two buffers. */
+typedef struct af_arena_s
+{
+  void* mem[2];		// Allocations
+  void* buf[2];		// Aligned to AF_ARENA_ALIGN
+  int size[2];
+  double mul;		// Largest length multiplier at any point of the chain
+}af_arena_t;
+
 // Linked list of audio filters
 typedef struct af_instance_s
 {
@@ -77,6 +91,9 @@ typedef struct af_instance_s
 		 * corresponding output */
   double mul; /* length multiplier: how much does this instance change
 		 the length of the buffer. */
+  int auto_format; // format filter inserted by libaf, may be moved
+  af_arena_t* arena; // chain buffers used by RESIZE_LOCAL_BUFFER
+  int borrowed; // data->audio points into the chain buffers, not owned
 }af_instance_t;
 
 // Initialization flags
@@ -115,6 +132,8 @@ typedef struct af_stream
   af_data_t output;
   // Configuration for this stream
   af_cfg_t cfg;
+  // Output buffers of the filters
+  af_arena_t arena;
 }af_stream_t;
 
 /*********************************************
@@ -211,6 +230,15 @@ af_data_t* af_play(af_stream_t* s, af_data_t* data);
  */
 af_instance_t *af_control_any_rev (af_stream_t* s, int cmd, void* arg);
 
+/**
+ * \brief send control to all filters, for information that any number
+ *        of filters may use.
+ * \param cmd filter control command
+ * \param arg argument for filter command
+ * \return number of filters that accepted the command with AF_OK
+ */
+int af_control_all(af_stream_t* s, int cmd, void* arg);
+
 /**
  * \brief calculate average ratio of filter output lenth to input length
  * \return the ratio
@@ -296,6 +324,14 @@ int af_to_ms(int n, int* in, float* out, int rate);
  */
 int af_test_output(struct af_instance_s* af, af_data_t* out);
 
+/**
+ * \brief add a format to the capabilities of a filter
+ * \param caps capabilities given with AF_CONTROL_FORMAT_CAPS
+ * \param format format the filter can process as it is
+ * \param cost relative processing cost per sample in this format
+ */
+void af_caps_add(af_caps_t* caps, int format, float cost);
+
 /**
  * \brief soft clipping function using sin()
  * \param a input value
@@ -319,10 +355,12 @@ void af_fix_parameters(af_data_t *data);
 
 /** Memory reallocation macro: if a local buffer is used (i.e. if the
    filter doesn't operate on the incoming buffer this macro must be
-   called to ensure the buffer is big enough.
+   called to ensure the buffer is big enough. In a chain it points
+   a->data->audio to the chain buffer that d is not in, so it must be
+   called on every play.
  * \ingroup af_filter
  */
 #define RESIZE_LOCAL_BUFFER(a,d)\
-((a->data->len < af_lencalc(a->mul,d))?af_resize_local_buffer(a,d):AF_OK)
+((a->arena || a->data->len < af_lencalc(a->mul,d))?af_resize_local_buffer(a,d):AF_OK)
 
 #endif /* MPLAYER_AF_H */
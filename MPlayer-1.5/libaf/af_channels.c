@@ -170,6 +170,10 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
     af->data->bps    = ((af_data_t*)arg)->bps;
     af->mul          = (double)af->data->nch / ((af_data_t*)arg)->nch;
     return check_routes(s,((af_data_t*)arg)->nch,af->data->nch);
+  case AF_CONTROL_FORMAT_CAPS:
+    // Any format, copied
+    ((af_caps_t*)arg)->cost[0] = 0.25;
+    return AF_OK;
   case AF_CONTROL_COMMAND_LINE:{
     int nch = 0;
     int n = 0;
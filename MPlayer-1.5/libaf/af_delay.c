@@ -68,6 +68,10 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
 
     return control(af,AF_CONTROL_DELAY_LEN | AF_CONTROL_SET,s->d);
   }
+  case AF_CONTROL_FORMAT_CAPS:
+    // Any format, in place
+    ((af_caps_t*)arg)->cost[0] = 0.1;
+    return AF_OK;
   case AF_CONTROL_COMMAND_LINE:{
     int n = 1;
     int i = 0;
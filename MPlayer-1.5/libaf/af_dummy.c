@@ -35,6 +35,9 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
     mp_msg(MSGT_AFILTER, MSGL_V, "[dummy] Was reinitialized: %iHz/%ich/%s\n",
 	af->data->rate,af->data->nch,af_fmt2str_short(af->data->format));
     return AF_OK;
+  case AF_CONTROL_FORMAT_CAPS:
+    // Any format at no cost
+    return AF_OK;
   }
   return AF_UNKNOWN;
 }
@@ -29,6 +29,7 @@
 
 #include "config.h"
 #include "af.h"
+#include "kernels.h"
 #include "mp_msg.h"
 #include "mpbswap.h"
 #include "libvo/fastmemcpy.h"
@@ -494,34 +495,7 @@ static void float2int(const float* in, void* out, int len, int bps)
       ((int8_t *)out)[i] = av_clip_int8(lrintf(128.0f * in[i]));
     break;
   case(2):
-#if HAVE_NEON && !ARCH_AARCH64
-    {
-    const float *in_end = in + len;
-    while (in < in_end - 7) {
-      __asm__(
-          "vld1.32 {q0,q1}, [%0]!\n\t"
-          "vcvt.s32.f32 q0, q0, #31\n\t"
-          "vqrshrn.s32  d0, q0, #15\n\t"
-          "vcvt.s32.f32 q1, q1, #31\n\t"
-          "vqrshrn.s32  d1, q1, #15\n\t"
-          "vst1.16 {q0}, [%1]!\n\t"
-      : "+r"(in), "+r"(out)
-      :: "q0", "q1", "memory");
-    }
-    while (in < in_end) {
-      __asm__(
-          "vld1.32 {d0[0]}, [%0]!\n\t"
-          "vcvt.s32.f32 d0, d0, #31\n\t"
-          "vqrshrn.s32  d0, q0, #15\n\t"
-          "vst1.16 {d0[0]}, [%1]!\n\t"
-      : "+r"(in), "+r"(out)
-      :: "d0", "memory");
-    }
-    }
-#else
-    for(i=0;i<len;i++)
-      ((int16_t*)out)[i] = av_clip_int16(lrintf(32768.0f * in[i]));
-#endif
+    af_kernels.float_to_s16(out, in, len);
     break;
   case(3):
     for(i=0;i<len;i++){
@@ -554,8 +528,7 @@ static void int2float(const void* in, float* out, int len, int bps)
       out[i]=(1.0f/128.0f)*((int8_t*)in)[i];
     break;
   case(2):
-    for(i=0;i<len;i++)
-      out[i]=(1.0f/32768.0f)*((int16_t*)in)[i];
+    af_kernels.s16_to_float(out, in, len);
     break;
   case(3):
     for(i=0;i<len;i++)
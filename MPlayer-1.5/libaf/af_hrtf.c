@@ -35,6 +35,9 @@
 /* HRTF filter coefficients and adjustable parameters */
 #include "af_hrtf.h"
 
+/* Inputs of the convolution engine */
+enum { IN_LF, IN_RF, IN_LR, IN_RR, IN_CF, IN_CR, IN_BA_L, IN_BA_R, IN_NUM };
+
 typedef struct af_hrtf_s {
     /* Lengths */
     int dlbuflen, hrflen, basslen;
@@ -70,28 +73,13 @@ typedef struct af_hrtf_s {
     /* Cyclic position on the ring buffer */
     int cyc_pos;
     int print_flag;
+    /* The mixer filter matrix and the bass compensation run as one
+       block convolution of the current ring buffer samples, which are
+       collected in sig, into the L, R ear signals in res */
+    af_fftconv_t *conv;
+    float *sig[IN_NUM], *res[2];
 } af_hrtf_t;
 
-/* Convolution on a ring buffer
- *    nx:	length of the ring buffer
- *    nk:	length of the convolution kernel
- *    sx:	ring buffer
- *    sk:	convolution kernel
- *    offset:	offset on the ring buffer, can be
- */
-static float conv(const int nx, const int nk, const float *sx, const float *sk,
-		  const int offset)
-{
-    /* k = reminder of offset / nx */
-    int k = offset >= 0 ? offset % nx : nx + (offset % nx);
-
-    if(nk + k <= nx)
-	return af_filter_fir(nk, sx + k, sk);
-    else
-	return af_filter_fir(nk + k - nx, sx, sk + nx - k) +
-	    af_filter_fir(nx - k, sx + k, sk);
-}
-
 /* Detect when the impulse response starts (significantly) */
 static int pulse_detect(const float *sx)
 {
@@ -287,6 +275,43 @@ static inline void update_ch(af_hrtf_t *s, short *in, const int k)
     }
 }
 
+/* Set up the mixer filter matrix for the current decode mode */
+static int setup_conv(af_hrtf_t *s)
+{
+    const float rear = s->matrix_mode ? M1_76DB : 1;
+    const int hlen = s->hrflen, blen = s->basslen;
+    int ear, err = 0;
+
+    af_fftconv_free(s->conv);
+    /* Pulse offsets are below 128 - hrflen */
+    s->conv = af_fftconv_init(CONVBLOCKLEN, IN_NUM, 2,
+			      FFMAX(128, s->basslen));
+    if(!s->conv)
+	return -1;
+
+    for(ear = 0; ear < 2; ear++) {
+	/* Same and opposite side channels of this ear */
+	const int af_in = ear ? IN_RF : IN_LF, of_in = ear ? IN_LF : IN_RF;
+	const int ar_in = ear ? IN_RR : IN_LR, or_in = ear ? IN_LR : IN_RR;
+	const int ab_in = ear ? IN_BA_R : IN_BA_L, ob_in = ear ? IN_BA_L : IN_BA_R;
+
+	err |= af_fftconv_add(s->conv, af_in, ear, s->af_ir, hlen, s->af_o, 1);
+	err |= af_fftconv_add(s->conv, of_in, ear, s->of_ir, hlen, s->of_o, 1);
+	if(s->decode_mode != HRTF_MIX_STEREO) {
+	    err |= af_fftconv_add(s->conv, ar_in, ear, s->ar_ir, hlen, s->ar_o, rear);
+	    err |= af_fftconv_add(s->conv, or_in, ear, s->or_ir, hlen, s->or_o, rear);
+	    err |= af_fftconv_add(s->conv, IN_CF, ear, s->cf_ir, hlen, s->cf_o, 1);
+	    if(s->matrix_mode)
+		err |= af_fftconv_add(s->conv, IN_CR, ear, s->cr_ir, hlen,
+				      s->cr_o, M1_76DB);
+	}
+	/* Bass compensation, see play() */
+	err |= af_fftconv_add(s->conv, ab_in, ear, s->ba_ir, blen, 0, 1 - BASSCROSS);
+	err |= af_fftconv_add(s->conv, ob_in, ear, s->ba_ir, blen, 0, BASSCROSS);
+    }
+    return err;
+}
+
 /* Initialization and runtime control */
 static int control(struct af_instance_s *af, int cmd, void* arg)
 {
@@ -322,6 +347,10 @@ static int control(struct af_instance_s *af, int cmd, void* arg)
 	// after testing input set the real output format
 	af->data->nch = 2;
 	s->print_flag = 1;
+	if(setup_conv(s) != 0) {
+	    mp_msg(MSGT_AFILTER, MSGL_ERR, "[hrtf] Memory allocation error.\n");
+	    return AF_ERROR;
+	}
 	return test_output_res;
     case AF_CONTROL_COMMAND_LINE:
 	sscanf((char*)arg, "%c", &mode);
@@ -369,6 +398,8 @@ static void uninit(struct af_instance_s *af)
 	free(s->fwrbuf_r);
 	free(s->fwrbuf_lr);
 	free(s->fwrbuf_rr);
+	free(s->sig[0]);
+	af_fftconv_free(s->conv);
 	free(af->setup);
     }
     if(af->data)
@@ -392,9 +423,7 @@ static af_data_t* play(struct af_instance_s *af, af_data_t *data)
     af_hrtf_t *s = af->setup;
     short *in = data->audio; // Input audio data
     short *out = NULL; // Output audio data
-    short *end = in + data->len / sizeof(short); // Loop end
-    float common, left, right, diff, left_b, right_b;
-    const int dblen = s->dlbuflen, hlen = s->hrflen, blen = s->basslen;
+    int frames = data->len / sizeof(short) / data->nch;
 
     if(AF_OK != RESIZE_LOCAL_BUFFER(af, data))
 	return NULL;
@@ -450,123 +479,98 @@ static af_data_t* play(struct af_instance_s *af, af_data_t *data)
      * or: C = center, A = same side, O = opposite, F = front, R = rear
      */
 
-    while(in < end) {
-	const int k = s->cyc_pos;
-
-	update_ch(s, in, k);
-
-	/* Simulate a 7.5 ms -20 dB echo of the center channel in the
-	   front channels (like reflection from a room wall) - a kind of
-	   psycho-acoustically "cheating" to focus the center front
-	   channel, which is normally hard to be perceived as front */
-	s->lf[k] += CFECHOAMPL * s->cf[(k + CFECHODELAY) % s->dlbuflen];
-	s->rf[k] += CFECHOAMPL * s->cf[(k + CFECHODELAY) % s->dlbuflen];
-
-	switch (s->decode_mode) {
-	case HRTF_MIX_51:
-	case HRTF_MIX_MATRIX2CH:
-	   /* Mixer filter matrix */
-	   common = conv(dblen, hlen, s->cf, s->cf_ir, k + s->cf_o);
-	   if(s->matrix_mode) {
-	      /* In matrix decoding mode, the rear channel gain must be
-		 renormalized, as there is an additional channel. */
-	      matrix_decode(in, k, 2, 3, 0, s->dlbuflen,
-			    s->lr_fwr, s->rr_fwr,
-			    s->lrprr_fwr, s->lrmrr_fwr,
-			    &(s->adapt_lr_gain), &(s->adapt_rr_gain),
-			    &(s->adapt_lrprr_gain), &(s->adapt_lrmrr_gain),
-			    s->lr, s->rr, NULL, NULL, s->cr);
-	      common +=
-		 conv(dblen, hlen, s->cr, s->cr_ir, k + s->cr_o) *
-		 M1_76DB;
-	      left    =
-		 ( conv(dblen, hlen, s->lf, s->af_ir, k + s->af_o) +
-		   conv(dblen, hlen, s->rf, s->of_ir, k + s->of_o) +
-		   (conv(dblen, hlen, s->lr, s->ar_ir, k + s->ar_o) +
-		    conv(dblen, hlen, s->rr, s->or_ir, k + s->or_o)) *
-		   M1_76DB + common);
-	      right   =
-		 ( conv(dblen, hlen, s->rf, s->af_ir, k + s->af_o) +
-		   conv(dblen, hlen, s->lf, s->of_ir, k + s->of_o) +
-		   (conv(dblen, hlen, s->rr, s->ar_ir, k + s->ar_o) +
-		    conv(dblen, hlen, s->lr, s->or_ir, k + s->or_o)) *
-		   M1_76DB + common);
-	   } else {
-	      left    =
-		 ( conv(dblen, hlen, s->lf, s->af_ir, k + s->af_o) +
-		   conv(dblen, hlen, s->rf, s->of_ir, k + s->of_o) +
-		   conv(dblen, hlen, s->lr, s->ar_ir, k + s->ar_o) +
-		   conv(dblen, hlen, s->rr, s->or_ir, k + s->or_o) +
-		   common);
-	      right   =
-		 ( conv(dblen, hlen, s->rf, s->af_ir, k + s->af_o) +
-		   conv(dblen, hlen, s->lf, s->of_ir, k + s->of_o) +
-		   conv(dblen, hlen, s->rr, s->ar_ir, k + s->ar_o) +
-		   conv(dblen, hlen, s->lr, s->or_ir, k + s->or_o) +
-		   common);
-	   }
-	   break;
-	case HRTF_MIX_STEREO:
-	   left    =
-	      ( conv(dblen, hlen, s->lf, s->af_ir, k + s->af_o) +
-		conv(dblen, hlen, s->rf, s->of_ir, k + s->of_o));
-	   right   =
-	      ( conv(dblen, hlen, s->rf, s->af_ir, k + s->af_o) +
-		conv(dblen, hlen, s->lf, s->of_ir, k + s->of_o));
-	   break;
-	default:
-	    /* make gcc happy */
-	    left = 0.0;
-	    right = 0.0;
-	    break;
+    while(frames > 0) {
+	const int n = FFMIN(frames, CONVBLOCKLEN);
+	short *blk = in;
+	int j;
+
+	for(j = 0; j < n; j++) {
+	    const int k = s->cyc_pos;
+
+	    update_ch(s, in, k);
+
+	    /* Simulate a 7.5 ms -20 dB echo of the center channel in the
+	       front channels (like reflection from a room wall) - a kind of
+	       psycho-acoustically "cheating" to focus the center front
+	       channel, which is normally hard to be perceived as front */
+	    s->lf[k] += CFECHOAMPL * s->cf[(k + CFECHODELAY) % s->dlbuflen];
+	    s->rf[k] += CFECHOAMPL * s->cf[(k + CFECHODELAY) % s->dlbuflen];
+
+	    if(s->matrix_mode && s->decode_mode != HRTF_MIX_STEREO)
+		/* In matrix decoding mode, the rear channel gain must be
+		   renormalized, as there is an additional channel (done by
+		   the filter gains, see setup_conv()). */
+		matrix_decode(in, k, 2, 3, 0, s->dlbuflen,
+			      s->lr_fwr, s->rr_fwr,
+			      s->lrprr_fwr, s->lrmrr_fwr,
+			      &(s->adapt_lr_gain), &(s->adapt_rr_gain),
+			      &(s->adapt_lrprr_gain), &(s->adapt_lrmrr_gain),
+			      s->lr, s->rr, NULL, NULL, s->cr);
+
+	    /* The ring buffer samples at the current position are final
+	       now, older ones are only read by the convolution history. */
+	    s->sig[IN_LF][j]   = s->lf[k];
+	    s->sig[IN_RF][j]   = s->rf[k];
+	    s->sig[IN_LR][j]   = s->lr[k];
+	    s->sig[IN_RR][j]   = s->rr[k];
+	    s->sig[IN_CF][j]   = s->cf[k];
+	    s->sig[IN_CR][j]   = s->cr[k];
+	    s->sig[IN_BA_L][j] = s->ba_l[k];
+	    s->sig[IN_BA_R][j] = s->ba_r[k];
+
+	    /* Next sample... */
+	    in = &in[data->nch];
+	    (s->cyc_pos)--;
+	    if(s->cyc_pos < 0)
+		s->cyc_pos += s->dlbuflen;
 	}
 
-	/* Bass compensation for the lower frequency cut of the HRTF.  A
-	   cross talk of the left and right channel is introduced to
-	   match the directional characteristics of higher frequencies.
-	   The bass will not have any real 3D perception, but that is
-	   OK (note at 180 Hz, the wavelength is about 2 m, and any
-	   spatial perception is impossible). */
-	left_b  = conv(dblen, blen, s->ba_l, s->ba_ir, k);
-	right_b = conv(dblen, blen, s->ba_r, s->ba_ir, k);
-	left  += (1 - BASSCROSS) * left_b  + BASSCROSS * right_b;
-	right += (1 - BASSCROSS) * right_b + BASSCROSS * left_b;
-	/* Also mix the LFE channel (if available) */
-	if(data->nch >= 6) {
-	    left  += in[5] * M3_01DB;
-	    right += in[5] * M3_01DB;
-	}
+	/* Mixer filter matrix and bass compensation for the lower
+	   frequency cut of the HRTF.  A cross talk of the left and right
+	   channel is introduced in the bass to match the directional
+	   characteristics of higher frequencies.  The bass will not have
+	   any real 3D perception, but that is OK (note at 180 Hz, the
+	   wavelength is about 2 m, and any spatial perception is
+	   impossible). */
+	af_fftconv_process(s->conv, (const float * const *)s->sig, s->res, n);
+
+	for(j = 0; j < n; j++) {
+	    float left = s->res[0][j], right = s->res[1][j], diff;
+
+	    /* Also mix the LFE channel (if available) */
+	    if(data->nch >= 6) {
+		left  += blk[5] * M3_01DB;
+		right += blk[5] * M3_01DB;
+	    }
 
-	/* Amplitude renormalization. */
-	left  *= AMPLNORM;
-	right *= AMPLNORM;
+	    /* Amplitude renormalization. */
+	    left  *= AMPLNORM;
+	    right *= AMPLNORM;
+
+	    switch (s->decode_mode) {
+	    case HRTF_MIX_51:
+	    case HRTF_MIX_STEREO:
+	       /* "Cheating": linear stereo expansion to amplify the 3D
+		  perception.  Note: Too much will destroy the acoustic space
+		  and may even result in headaches. */
+	       diff = STEXPAND2 * (left - right);
+	       out[0] = av_clip_int16(left  + diff);
+	       out[1] = av_clip_int16(right - diff);
+	       break;
+	    case HRTF_MIX_MATRIX2CH:
+	       /* Do attempt any stereo expansion with matrix encoded
+		  sources.  The L, R channels are already stereo expanded
+		  by the steering, any further stereo expansion will sound
+		  very unnatural. */
+	       out[0] = av_clip_int16(left);
+	       out[1] = av_clip_int16(right);
+	       break;
+	    }
 
-	switch (s->decode_mode) {
-	case HRTF_MIX_51:
-	case HRTF_MIX_STEREO:
-	   /* "Cheating": linear stereo expansion to amplify the 3D
-	      perception.  Note: Too much will destroy the acoustic space
-	      and may even result in headaches. */
-	   diff = STEXPAND2 * (left - right);
-	   out[0] = av_clip_int16(left  + diff);
-	   out[1] = av_clip_int16(right - diff);
-	   break;
-	case HRTF_MIX_MATRIX2CH:
-	   /* Do attempt any stereo expansion with matrix encoded
-	      sources.  The L, R channels are already stereo expanded
-	      by the steering, any further stereo expansion will sound
-	      very unnatural. */
-	   out[0] = av_clip_int16(left);
-	   out[1] = av_clip_int16(right);
-	   break;
+	    blk = &blk[data->nch];
+	    out = &out[af->data->nch];
 	}
-
-	/* Next sample... */
-	in = &in[data->nch];
-	out = &out[af->data->nch];
-	(s->cyc_pos)--;
-	if(s->cyc_pos < 0)
-	    s->cyc_pos += dblen;
+	frames -= n;
     }
 
     /* Set output data */
@@ -579,6 +583,8 @@ static af_data_t* play(struct af_instance_s *af, af_data_t *data)
 
 static int allocate(af_hrtf_t *s)
 {
+    int i;
+
     if ((s->lf = malloc(s->dlbuflen * sizeof(float))) == NULL) return -1;
     if ((s->rf = malloc(s->dlbuflen * sizeof(float))) == NULL) return -1;
     if ((s->lr = malloc(s->dlbuflen * sizeof(float))) == NULL) return -1;
@@ -595,6 +601,12 @@ static int allocate(af_hrtf_t *s)
 	 malloc(s->dlbuflen * sizeof(float))) == NULL) return -1;
     if ((s->fwrbuf_rr =
 	 malloc(s->dlbuflen * sizeof(float))) == NULL) return -1;
+    if ((s->sig[0] =
+	 malloc((IN_NUM + 2) * CONVBLOCKLEN * sizeof(float))) == NULL) return -1;
+    for (i = 1; i < IN_NUM; i++)
+	s->sig[i] = s->sig[0] + i * CONVBLOCKLEN;
+    s->res[0] = s->sig[0] + IN_NUM * CONVBLOCKLEN;
+    s->res[1] = s->res[0] + CONVBLOCKLEN;
     return 0;
 }
 
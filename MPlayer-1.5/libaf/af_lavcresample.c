@@ -25,6 +25,7 @@
 
 #include "config.h"
 #include "af.h"
+#include "subopt-helper.h"
 #include "libavutil/rational.h"
 #include "libswresample/swresample.h"
 #include "libavutil/channel_layout.h"
@@ -35,15 +36,13 @@
 // Data for specific instances of this filter
 typedef struct af_resample_s{
     struct SwrContext *swrctx;
-    uint8_t *in[1];
-    uint8_t *tmp[1];
-    int in_alloc;
-    int tmp_alloc;
 
     int filter_length;
     int linear;
     int phase_shift;
     double cutoff;
+    int filter_type;
+    double kaiser_beta;
 
     int ctx_out_rate;
     int ctx_in_rate;
@@ -51,8 +50,23 @@ typedef struct af_resample_s{
     int ctx_phase_shift;
     int ctx_linear;
     double ctx_cutoff;
+    int ctx_filter_type;
+    double ctx_kaiser_beta;
+    int ctx_format;
+    int ctx_nch;
 }af_resample_t;
 
+// Formats that are resampled as they are, anything else is converted
+static enum AVSampleFormat sample_fmt(int format)
+{
+  switch (format) {
+  case AF_FORMAT_S16_NE:   return AV_SAMPLE_FMT_S16;
+  case AF_FORMAT_S32_NE:   return AV_SAMPLE_FMT_S32;
+  case AF_FORMAT_FLOAT_NE: return AV_SAMPLE_FMT_FLT;
+  }
+  return AV_SAMPLE_FMT_NONE;
+}
+
 
 // Initialization and runtime control
 static int control(struct af_instance_s* af, int cmd, void* arg)
@@ -68,13 +82,23 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
 
     af->data->nch    = data->nch;
     if (af->data->nch > AF_NCH) af->data->nch = AF_NCH;
-    af->data->format = AF_FORMAT_S16_NE;
-    af->data->bps    = 2;
+    if (sample_fmt(data->format) != AV_SAMPLE_FMT_NONE)
+        af->data->format = data->format;
+    else if (data->format & AF_FORMAT_F)
+        af->data->format = AF_FORMAT_FLOAT_NE;
+    else if (data->bps > 2)
+        af->data->format = AF_FORMAT_S32_NE;
+    else
+        af->data->format = AF_FORMAT_S16_NE;
+    af->data->bps    = af_fmt2bits(af->data->format) / 8;
     af->mul = (double)af->data->rate / data->rate;
-    af->delay = af->data->nch * s->filter_length / FFMIN(af->mul, 1); // *bps*.5
+    af->delay = af->data->nch * af->data->bps * s->filter_length / 2 / FFMIN(af->mul, 1);
 
     if (s->ctx_out_rate != af->data->rate || s->ctx_in_rate != data->rate || s->ctx_filter_size != s->filter_length ||
-        s->ctx_phase_shift != s->phase_shift || s->ctx_linear != s->linear || s->ctx_cutoff != s->cutoff) {
+        s->ctx_phase_shift != s->phase_shift || s->ctx_linear != s->linear || s->ctx_cutoff != s->cutoff ||
+        s->ctx_filter_type != s->filter_type || s->ctx_kaiser_beta != s->kaiser_beta ||
+        s->ctx_format != af->data->format || s->ctx_nch != af->data->nch) {
+        enum AVSampleFormat fmt = sample_fmt(af->data->format);
         swr_free(&s->swrctx);
         if((s->swrctx=swr_alloc()) == NULL) return AF_ERROR;
         av_opt_set_int(s->swrctx, "out_sample_rate", af->data->rate, 0);
@@ -83,8 +107,10 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
         av_opt_set_int(s->swrctx, "phase_shift", s->phase_shift, 0);
         av_opt_set_int(s->swrctx, "linear_interp", s->linear, 0);
         av_opt_set_double(s->swrctx, "cutoff", s->cutoff, 0);
-        av_opt_set_sample_fmt(s->swrctx, "in_sample_fmt", AV_SAMPLE_FMT_S16, 0);
-        av_opt_set_sample_fmt(s->swrctx, "out_sample_fmt", AV_SAMPLE_FMT_S16, 0);
+        av_opt_set_int(s->swrctx, "filter_type", s->filter_type, 0);
+        av_opt_set_double(s->swrctx, "kaiser_beta", s->kaiser_beta, 0);
+        av_opt_set_sample_fmt(s->swrctx, "in_sample_fmt", fmt, 0);
+        av_opt_set_sample_fmt(s->swrctx, "out_sample_fmt", fmt, 0);
         av_opt_set_int(s->swrctx, "in_channel_count", af->data->nch, 0);
         av_opt_set_int(s->swrctx, "out_channel_count", af->data->nch, 0);
         if(swr_init(s->swrctx) < 0) return AF_ERROR;
@@ -94,6 +120,10 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
         s->ctx_phase_shift = s->phase_shift;
         s->ctx_linear      = s->linear;
         s->ctx_cutoff      = s->cutoff;
+        s->ctx_filter_type = s->filter_type;
+        s->ctx_kaiser_beta = s->kaiser_beta;
+        s->ctx_format      = af->data->format;
+        s->ctx_nch         = af->data->nch;
     }
 
     // hack to make af_test_output ignore the samplerate change
@@ -102,10 +132,35 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
     test_output_res = af_test_output(af, (af_data_t*)arg);
     af->data->rate = out_rate;
     return test_output_res;
+  case AF_CONTROL_FORMAT_CAPS:
+    af_caps_add(arg, AF_FORMAT_S16_NE, 1);
+    af_caps_add(arg, AF_FORMAT_FLOAT_NE, 1);
+    af_caps_add(arg, AF_FORMAT_S32_NE, 1.5);
+    return AF_OK;
   case AF_CONTROL_COMMAND_LINE:{
     s->cutoff= 0.0;
-    sscanf((char*)arg,"%d:%d:%d:%d:%lf", &af->data->rate, &s->filter_length, &s->linear, &s->phase_shift, &s->cutoff);
+    if (strchr((char*)arg, '=')) {
+      float cutoff = 0, beta = s->kaiser_beta;
+      const opt_t subopts[] = {
+        {"srate",  OPT_ARG_INT,   &af->data->rate,   int_pos},
+        {"length", OPT_ARG_INT,   &s->filter_length, int_pos},
+        {"linear", OPT_ARG_BOOL,  &s->linear,        NULL},
+        {"count",  OPT_ARG_INT,   &s->phase_shift,   int_non_neg},
+        {"cutoff", OPT_ARG_FLOAT, &cutoff,           NULL},
+        {"type",   OPT_ARG_INT,   &s->filter_type,   NULL},
+        {"beta",   OPT_ARG_FLOAT, &beta,             NULL},
+        {NULL}
+      };
+      if (subopt_parse(arg, subopts) != 0)
+        return AF_ERROR;
+      s->cutoff      = cutoff;
+      s->kaiser_beta = beta;
+    } else
+      sscanf((char*)arg,"%d:%d:%d:%d:%lf:%d:%lf", &af->data->rate, &s->filter_length, &s->linear, &s->phase_shift, &s->cutoff,
+             &s->filter_type, &s->kaiser_beta);
     if(s->cutoff <= 0.0) s->cutoff= FFMAX(1.0 - 6.5/(s->filter_length+8), 0.80);
+    s->filter_type = av_clip(s->filter_type, SWR_FILTER_TYPE_CUBIC, SWR_FILTER_TYPE_KAISER);
+    s->kaiser_beta = av_clipd(s->kaiser_beta, 2, 16);
     return AF_OK;
   }
   case AF_CONTROL_RESAMPLE_RATE | AF_CONTROL_SET:
@@ -124,8 +179,6 @@ static void uninit(struct af_instance_s* af)
     if(af->setup){
         af_resample_t *s = af->setup;
         swr_free(&s->swrctx);
-        av_free(s->in[0]);
-        av_free(s->tmp[0]);
         free(s);
     }
 }
@@ -134,36 +187,21 @@ static void uninit(struct af_instance_s* af)
 static af_data_t* play(struct af_instance_s* af, af_data_t* data)
 {
   af_resample_t *s = af->setup;
+  int frame = af->data->bps * af->data->nch;
+  const uint8_t *in = data->audio;
   int ret;
-  int8_t *in = (int8_t*)data->audio;
-  int8_t *out;
-  int chans   = data->nch;
-  int in_len  = data->len;
-  int out_len = in_len * af->mul + 10;
 
   if(AF_OK != RESIZE_LOCAL_BUFFER(af,data))
       return NULL;
 
-  av_fast_malloc(&s->tmp[0], &s->tmp_alloc, FFALIGN(out_len,32));
-  if(s->tmp[0] == NULL) return NULL;
-
-  out= (int8_t*)af->data->audio;
-
-  out_len= FFMIN(out_len, af->data->len);
-
-  av_fast_malloc(&s->in[0], &s->in_alloc, FFALIGN(in_len,32));
-  if(s->in[0] == NULL) return NULL;
-
-  memcpy(s->in[0], in, in_len);
-
-  ret = swr_convert(s->swrctx, &s->tmp[0], out_len/chans/2, (const uint8_t **) &s->in[0], in_len/chans/2);
+  // Resample straight from the previous filter into the local buffer,
+  // whatever does not fit stays buffered in the context.
+  ret = swr_convert(s->swrctx, (uint8_t **)&af->data->audio, af->data->len / frame,
+                    &in, data->len / frame);
   if (ret < 0) return NULL;
-  out_len= ret*chans*2;
-
-  memcpy(out, s->tmp[0], out_len);
 
   data->audio = af->data->audio;
-  data->len   = out_len;
+  data->len   = ret * frame;
   data->rate  = af->data->rate;
   return data;
 }
@@ -178,6 +216,8 @@ static int af_open(af_instance_t* af){
   s->filter_length= 16;
   s->cutoff= FFMAX(1.0 - 6.5/(s->filter_length+8), 0.80);
   s->phase_shift= 10;
+  s->filter_type= SWR_FILTER_TYPE_KAISER;
+  s->kaiser_beta= 9;
 //  s->setup = RSMP_INT | FREQ_SLOPPY;
   af->setup=s;
   return AF_OK;
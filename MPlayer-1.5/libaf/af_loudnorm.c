@@ -0,0 +1,562 @@
+/*
+ * This audio filter measures the integrated loudness and the true peak
+ * of a track as specified by ITU-R BS.1770 and EBU R128 and normalizes
+ * the track with a single static gain once the measurement is complete.
+ *
+ * The measurement is stored in the index cache, keyed by the content of
+ * the file, and is built up over as many playbacks as needed: only
+ * blocks that were not measured before are added, so seeking does not
+ * spoil it. From the playback after it is complete on, the filter only
+ * applies the gain.
+ *
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "config.h"
+#include "libavutil/common.h"
+#include "libavutil/avstring.h"
+#include "mp_msg.h"
+#include "subopt-helper.h"
+#include "help_mp.h"
+#include "libmpdemux/index_cache.h"
+#include "af.h"
+#include "kernels.h"
+
+#define CACHE_VERSION 1
+#define DEF_TARGET  -18.0 // Default integrated loudness [LUFS]
+#define DEF_TP_MAX  -1.0  // Default highest true peak [dBTP]
+#define MAX_GAIN    20.0  // Largest gain applied [dB]
+#define ABS_GATE    -70.0 // Absolute gate [LUFS]
+#define REL_GATE    -10.0 // Relative gate [LU]
+#define HIST_BINS   750   // 0.1 LU bins from the absolute gate to +5 LUFS
+#define MAX_BLOCKS  (24 * 3600 * 10) // Gating blocks of a 24 hour track
+#define COMPLETE    0.95  // Share of the blocks that must be measured
+#define TP_TAPS     12    // Taps per phase of the true peak interpolator
+
+/* Interpolation filter for 4 times oversampling from BS.1770-4 Annex 2,
+   one row of taps per phase */
+static const float tp_coefs[4 * TP_TAPS] = {
+   0.0017089843750, 0.0109863281250,-0.0196533203125, 0.0332031250000,
+  -0.0594482421875, 0.1373291015625, 0.9721679687500,-0.1022949218750,
+   0.0476074218750,-0.0266113281250, 0.0148925781250,-0.0083007812500,
+  -0.0291748046875, 0.0292968750000,-0.0517578125000, 0.0891113281250,
+  -0.1665039062500, 0.4650878906250, 0.7797851562500,-0.2003173828125,
+   0.1015625000000,-0.0582275390625, 0.0330810546875,-0.0189208984375,
+  -0.0189208984375, 0.0330810546875,-0.0582275390625, 0.1015625000000,
+  -0.2003173828125, 0.7797851562500, 0.4650878906250,-0.1665039062500,
+   0.0891113281250,-0.0517578125000, 0.0292968750000,-0.0291748046875,
+  -0.0083007812500, 0.0148925781250,-0.0266113281250, 0.0476074218750,
+  -0.1022949218750, 0.9721679687500, 0.1373291015625,-0.0594482421875,
+   0.0332031250000,-0.0196533203125, 0.0109863281250, 0.0017089843750,
+};
+
+// Measurement as stored in the cache, followed by the block bitmap
+typedef struct loudnorm_cache_s
+{
+  uint32_t version;
+  uint32_t nch;
+  uint32_t blocks;		// Bits in the bitmap
+  uint32_t covered;		// Blocks measured
+  float	   peak;		// Highest true peak, linear
+  uint32_t hist[HIST_BINS];	// Gating blocks per 0.1 LU above ABS_GATE
+} loudnorm_cache_t;
+
+// Data for specific instances of this filter
+typedef struct af_loudnorm_s
+{
+  float target;		// Integrated loudness to normalize to [LUFS]
+  float tp_max;		// Highest true peak after the gain [dBTP]
+  // Cache entry
+  char	key[INDEX_CACHE_KEY_LEN];
+  char	tag[16];
+  double length;	// Track length [s], 0 if unknown
+  int	dirty;		// Blocks were measured since the entry was loaded
+  // Result
+  int	done;		// The gain is known, nothing is measured
+  float gain;		// Linear gain applied
+  // Measurement
+  int	nch;
+  float peak;
+  uint32_t hist[HIST_BINS];
+  uint8_t* map;		// Bitmap of the gating blocks measured
+  int	map_bits;
+  int	covered;
+  // K-weighting
+  double b[2][3], a[2][3];	// Shelving and high pass biquad
+  double z[AF_NCH][4];		// Filter state per channel
+  float	weight[AF_NCH];		// Channel weights
+  // True peak
+  float	tp_hist[AF_NCH][TP_TAPS - 1];
+  float* x;		// One channel of the current buffer, after the history
+  float* sq;		// Weighted square sum of the channels per frame
+  int	cap;		// Frames x and sq can hold
+  // 100 ms sub blocks, aligned to multiples of 100 ms of the pts
+  int64_t frames;	// Frames seen since the filter was configured
+  double anchor_pts;	// pts of frame anchor_frame
+  double anchor_frame;
+  int	have_clock;
+  int	skip;		// Not at normal speed, the pts do not advance by rate
+  int64_t run_start;	// First frame of the current run of sub blocks
+  int64_t run_grid;	// pts * 10 of run_start
+  int64_t sub_end;	// End of the current sub block, -1 to start a run
+  int	nsub;		// Sub blocks completed in this run
+  double acc;		// Square sum of the current sub block
+  double ring[4];	// Mean squares of the last sub blocks
+} af_loudnorm_t;
+
+static double energy_to_lufs(double e)
+{
+  return -0.691 + 10 * log10(e);
+}
+
+static double bin_energy(int i)
+{
+  return pow(10, (ABS_GATE + (i + 0.5) / 10 + 0.691) / 10);
+}
+
+// Gated integrated loudness of the histogram, -HUGE_VAL if all is silent
+static double integrated(const uint32_t* hist)
+{
+  double e = 0, rel;
+  uint64_t n = 0;
+  int i;
+
+  for (i = 0; i < HIST_BINS; i++)
+    if (hist[i]) {
+      e += hist[i] * bin_energy(i);
+      n += hist[i];
+    }
+  if (!n)
+    return -HUGE_VAL;
+  rel = energy_to_lufs(e / n) + REL_GATE;
+  e = 0;
+  n = 0;
+  for (i = FFMAX(0, (int)ceil((rel - ABS_GATE) * 10 - 0.5)); i < HIST_BINS; i++) {
+    e += hist[i] * bin_energy(i);
+    n += hist[i];
+  }
+  return energy_to_lufs(e / n);
+}
+
+static int is_complete(af_loudnorm_t* s)
+{
+  int expected = (int)(s->length * 10) - 3;
+  return expected > 0 && s->covered >= COMPLETE * expected;
+}
+
+// Compute the gain from a complete measurement and stop measuring
+static void finish(af_loudnorm_t* s)
+{
+  double lufs = integrated(s->hist);
+  double tp   = 20 * log10(FFMAX(s->peak, 1e-10));
+  double gain = 0;
+
+  if (lufs > -HUGE_VAL)
+    gain = FFMIN(FFMIN(s->target - lufs, s->tp_max - tp), MAX_GAIN);
+  s->gain = pow(10, gain / 20);
+  s->done = 1;
+  mp_msg(MSGT_AFILTER, MSGL_V, "[loudnorm] %.1f LUFS, true peak %.1f dBTP, "
+         "applying %+.1f dB\n", lufs, tp, gain);
+}
+
+static void reset_measurement(af_loudnorm_t* s)
+{
+  memset(s->hist, 0, sizeof(s->hist));
+  free(s->map);
+  s->map      = NULL;
+  s->map_bits = 0;
+  s->covered  = 0;
+  s->peak     = 0;
+  s->dirty    = 0;
+  s->done     = 0;
+  s->gain     = 1;
+}
+
+static void load(af_loudnorm_t* s)
+{
+  loudnorm_cache_t* c;
+  int len;
+
+  c = index_cache_load(s->key, s->tag, &len);
+  if (!c)
+    return;
+  if (len < sizeof(*c) || c->version != CACHE_VERSION || c->nch != s->nch ||
+      c->blocks > MAX_BLOCKS || c->covered > c->blocks ||
+      len - sizeof(*c) < (c->blocks + 7) / 8)
+    goto out;
+  if (c->blocks) {
+    s->map = malloc((c->blocks + 7) / 8);
+    if (!s->map)
+      goto out;
+    memcpy(s->map, c + 1, (c->blocks + 7) / 8);
+  }
+  s->map_bits = c->blocks;
+  s->covered  = c->covered;
+  s->peak     = c->peak;
+  memcpy(s->hist, c->hist, sizeof(s->hist));
+  if (is_complete(s))
+    finish(s);
+out:
+  free(c);
+}
+
+static void save(af_loudnorm_t* s)
+{
+  loudnorm_cache_t* c;
+  int bytes = (s->map_bits + 7) / 8;
+
+  if (!s->key[0] || !s->dirty)
+    return;
+  c = malloc(sizeof(*c) + bytes);
+  if (!c)
+    return;
+  c->version = CACHE_VERSION;
+  c->nch     = s->nch;
+  c->blocks  = s->map_bits;
+  c->covered = s->covered;
+  c->peak    = s->peak;
+  memcpy(c->hist, s->hist, sizeof(c->hist));
+  if (bytes)
+    memcpy(c + 1, s->map, bytes);
+  index_cache_save(s->key, s->tag, c, sizeof(*c) + bytes);
+  free(c);
+  s->dirty = 0;
+}
+
+// Coefficients of the K-weighting filter, from BS.1770 for any rate
+static void init_kweight(af_loudnorm_t* s, int rate, int nch)
+{
+  double k  = tan(M_PI * 1681.974450955533 / rate);
+  double q  = 0.7071752369554196;
+  double vh = pow(10, 3.999843853973347 / 20);
+  double vb = pow(vh, 0.4996667741545416);
+  double a0 = 1 + k / q + k * k;
+  int i;
+
+  s->b[0][0] = (vh + vb * k / q + k * k) / a0;
+  s->b[0][1] = 2 * (k * k - vh) / a0;
+  s->b[0][2] = (vh - vb * k / q + k * k) / a0;
+  s->a[0][1] = 2 * (k * k - 1) / a0;
+  s->a[0][2] = (1 - k / q + k * k) / a0;
+
+  k  = tan(M_PI * 38.13547087602444 / rate);
+  q  = 0.5003270373238773;
+  a0 = 1 + k / q + k * k;
+  s->b[1][0] = 1;
+  s->b[1][1] = -2;
+  s->b[1][2] = 1;
+  s->a[1][1] = 2 * (k * k - 1) / a0;
+  s->a[1][2] = (1 - k / q + k * k) / a0;
+
+  /* Channel order is L R Ls Rs C LFE Rls Rrs, the surround channels
+     count 1.41 times and the LFE is left out */
+  for (i = 0; i < AF_NCH; i++)
+    s->weight[i] = 1;
+  if (nch >= 4)
+    s->weight[2] = s->weight[3] = 1.41;
+  if (nch >= 6)
+    s->weight[5] = 0;
+  if (nch >= 8)
+    s->weight[6] = s->weight[7] = 1.41;
+  memset(s->z, 0, sizeof(s->z));
+}
+
+/* Run one channel through the K-weighting filter and add its weighted
+   squares to sq. The recursion is serial, it is done in double precision
+   for the low corner frequency of the high pass. */
+static void kweight(af_loudnorm_t* s, double* z, const float* x, float* sq,
+                    int len, float w, int first)
+{
+  double b00 = s->b[0][0], b01 = s->b[0][1], b02 = s->b[0][2];
+  double a01 = s->a[0][1], a02 = s->a[0][2];
+  double a11 = s->a[1][1], a12 = s->a[1][2];
+  double z0 = z[0], z1 = z[1], z2 = z[2], z3 = z[3];
+  int i;
+
+  for (i = 0; i < len; i++) {
+    double y = b00 * x[i] + z0;
+    double v;
+    z0 = b01 * x[i] - a01 * y + z1;
+    z1 = b02 * x[i] - a02 * y;
+    v  = y + z2;
+    z2 = -2 * y - a11 * v + z3;
+    z3 = y - a12 * v;
+    sq[i] = (first ? 0 : sq[i]) + w * (float)(v * v);
+  }
+  z[0] = z0; z[1] = z1; z[2] = z2; z[3] = z3;
+}
+
+// Record gating block id with mean square z unless it was measured before
+static void add_block(af_loudnorm_t* s, int64_t id, double z)
+{
+  double l;
+
+  if (id < 0 || id >= MAX_BLOCKS)
+    return;
+  if (id >= s->map_bits) {
+    int bits = FFMIN(FFMAX(2 * s->map_bits, id + 1 + 36000), MAX_BLOCKS);
+    uint8_t* map = realloc(s->map, (bits + 7) / 8);
+    if (!map)
+      return;
+    memset(map + (s->map_bits + 7) / 8, 0, (bits + 7) / 8 - (s->map_bits + 7) / 8);
+    s->map      = map;
+    s->map_bits = bits;
+  }
+  if (s->map[id >> 3] & (1 << (id & 7)))
+    return;
+  s->map[id >> 3] |= 1 << (id & 7);
+  s->covered++;
+  s->dirty = 1;
+  if (z <= 0 || (l = energy_to_lufs(z)) < ABS_GATE)
+    return;
+  s->hist[FFMIN((int)((l - ABS_GATE) * 10), HIST_BINS - 1)]++;
+}
+
+// Split the weighted squares into sub blocks and those into gating blocks
+static void gate(af_loudnorm_t* s, const float* sq, int len, int rate)
+{
+  int i = 0;
+
+  while (i < len) {
+    int64_t f = s->frames + i;
+    int n;
+    if (s->sub_end < 0) {
+      // Start a run at the next multiple of 100 ms
+      double pts = s->anchor_pts + (f - s->anchor_frame) / rate;
+      s->run_grid  = ceil(pts * 10 - 1e-3);
+      s->run_start = f + FFMAX(0, lrint((s->run_grid / 10.0 - pts) * rate));
+      s->nsub      = 0;
+      s->acc       = 0;
+      s->sub_end   = s->run_start + (rate + 9) / 10;
+    }
+    if (f < s->run_start) {
+      i += FFMIN(len - i, s->run_start - f);
+      continue;
+    }
+    n = FFMIN(len - i, s->sub_end - f);
+    for (; n > 0; n--)
+      s->acc += sq[i++];
+    if (s->frames + i == s->sub_end) {
+      int64_t start = s->run_start + (s->nsub * (int64_t)rate + 9) / 10;
+      s->ring[s->nsub & 3] = s->acc / (s->sub_end - start);
+      s->acc = 0;
+      if (++s->nsub >= 4)
+        add_block(s, s->run_grid + s->nsub - 4,
+                  (s->ring[0] + s->ring[1] + s->ring[2] + s->ring[3]) / 4);
+      s->sub_end = s->run_start + ((s->nsub + 1) * (int64_t)rate + 9) / 10;
+    }
+  }
+}
+
+static void measure(af_instance_t* af, const float* in, int len)
+{
+  af_loudnorm_t* s = af->setup;
+  int nch = af->data->nch;
+  int i, ch, first = 1;
+
+  if (len > s->cap) {
+    float* x  = realloc(s->x, (len + TP_TAPS - 1) * sizeof(float));
+    float* sq = x ? realloc(s->sq, len * sizeof(float)) : NULL;
+    if (x)
+      s->x = x;
+    if (!sq)
+      return;
+    s->sq  = sq;
+    s->cap = len;
+  }
+  for (ch = 0; ch < nch; ch++) {
+    float* x = s->x + TP_TAPS - 1;
+    memcpy(s->x, s->tp_hist[ch], sizeof(s->tp_hist[ch]));
+    for (i = 0; i < len; i++)
+      x[i] = in[i * nch + ch];
+    s->peak = FFMAX(s->peak, af_kernels.peak_4x(x, tp_coefs, len));
+    memcpy(s->tp_hist[ch], s->x + len, sizeof(s->tp_hist[ch]));
+    if (s->weight[ch]) {
+      kweight(s, s->z[ch], x, s->sq, len, s->weight[ch], first);
+      first = 0;
+    }
+  }
+  if (s->skip)
+    s->sub_end = -1;
+  else
+    gate(s, s->sq, len, af->data->rate);
+  s->frames += len;
+}
+
+/* Initialization and runtime control
+   af audio filter instance
+   cmd control command
+   arg argument
+*/
+static int control(struct af_instance_s* af, int cmd, void* arg)
+{
+  af_loudnorm_t* s = af->setup;
+  switch (cmd){
+  case AF_CONTROL_REINIT:{
+    af_data_t* in = arg;
+
+    af->data->rate   = in->rate;
+    af->data->nch    = in->nch;
+    af->data->format = AF_FORMAT_FLOAT_NE;
+    af->data->bps    = 4;
+
+    if (s->nch != af->data->nch) {
+      reset_measurement(s);
+      s->nch = af->data->nch;
+    }
+    init_kweight(s, af->data->rate, af->data->nch);
+    memset(s->tp_hist, 0, sizeof(s->tp_hist));
+    s->frames       = 0;
+    s->anchor_pts   = 0;
+    s->anchor_frame = 0;
+    s->have_clock   = 0;
+    s->sub_end      = -1;
+    return af_test_output(af, in);
+  }
+  case AF_CONTROL_FORMAT_CAPS:
+    af_caps_add(arg, AF_FORMAT_FLOAT_NE, 1);
+    return AF_OK;
+  case AF_CONTROL_COMMAND_LINE:{
+    const opt_t subopts[] = {
+      {"target", OPT_ARG_FLOAT, &s->target, NULL},
+      {"tp",     OPT_ARG_FLOAT, &s->tp_max, NULL},
+      {NULL}
+    };
+    if (subopt_parse(arg, subopts) != 0)
+      return AF_ERROR;
+    return AF_OK;
+  }
+  case AF_CONTROL_CONTENT | AF_CONTROL_SET:{
+    af_content_t* c = arg;
+    char tag[sizeof(s->tag)];
+
+    snprintf(tag, sizeof(tag), "r128-%d", c->track);
+    if (!strcmp(s->key, c->key) && !strcmp(s->tag, tag))
+      return AF_OK;
+    save(s);
+    reset_measurement(s);
+    av_strlcpy(s->key, c->key, sizeof(s->key));
+    av_strlcpy(s->tag, tag, sizeof(s->tag));
+    s->length = c->length;
+    load(s);
+    return AF_OK;
+  }
+  case AF_CONTROL_PLAYBACK_CLOCK | AF_CONTROL_SET:{
+    af_clock_t* clk = arg;
+    af_instance_t* p;
+    double delay = 0, frame;
+    // Audio that entered the chain but is still held by earlier filters
+    for (p = af; p->prev; p = p->prev);
+    for (; p != af; p = p->next) {
+      delay += p->delay;
+      delay *= p->mul;
+    }
+    frame = s->frames + delay / (af->data->bps * af->data->nch);
+    // A seek, restart at the next sub block
+    if (!s->have_clock ? s->frames > 0 :
+        fabs(s->anchor_pts + (frame - s->anchor_frame) / af->data->rate -
+             clk->in_pts) > 0.05)
+      s->sub_end = -1;
+    s->anchor_pts   = clk->in_pts;
+    s->anchor_frame = frame;
+    s->have_clock   = 1;
+    s->skip         = clk->speed != 0 && clk->speed != 1;
+    return AF_OK;
+  }
+  }
+  return AF_UNKNOWN;
+}
+
+/* Free allocated memory and clean up other stuff too.
+   af audio filter instance
+*/
+static void uninit(struct af_instance_s* af)
+{
+  free(af->data);
+  af->data = NULL;
+
+  if (af->setup) {
+    af_loudnorm_t* s = af->setup;
+    if (!s->done && s->covered) {
+      double lufs = integrated(s->hist);
+      mp_msg(MSGT_AFILTER, MSGL_INFO, "[loudnorm] %s: %.1f LUFS, "
+             "true peak %.1f dBTP over %.1f s\n",
+             is_complete(s) ? "Analysis complete" : "Analyzed so far", lufs,
+             20 * log10(FFMAX(s->peak, 1e-10)), s->covered / 10.0);
+    }
+    save(s);
+    free(s->map);
+    free(s->x);
+    free(s->sq);
+    free(af->setup);
+    af->setup = NULL;
+  }
+}
+
+/* Filter data through filter
+   af audio filter instance
+   data audio data
+*/
+static af_data_t* play(struct af_instance_s* af, af_data_t* data)
+{
+  af_loudnorm_t* s = af->setup;
+  int len = data->len / data->bps;
+
+  if (!s->done)
+    measure(af, data->audio, len / data->nch);
+  else if (s->gain != 1)
+    af_kernels.scale_clip_float(data->audio, len, s->gain);
+  return data;
+}
+
+/* Allocate memory and set function pointers
+   af audio filter instance
+   returns AF_OK or AF_ERROR
+*/
+static int af_open(af_instance_t* af)
+{
+  af_loudnorm_t* s;
+  af->control = control;
+  af->uninit  = uninit;
+  af->play    = play;
+  af->mul     = 1;
+  af->data    = calloc(1, sizeof(af_data_t));
+  af->setup   = s = calloc(1, sizeof(af_loudnorm_t));
+  if ((af->data == NULL) || (af->setup == NULL))
+    return AF_ERROR;
+
+  s->target = DEF_TARGET;
+  s->tp_max = DEF_TP_MAX;
+  s->gain   = 1;
+  return AF_OK;
+}
+
+// Description of this filter
+const af_info_t af_info_loudnorm = {
+    "EBU R128 loudness normalization",
+    "loudnorm",
+    "",
+    "",
+    AF_FLAGS_REENTRANT,
+    af_open
+};
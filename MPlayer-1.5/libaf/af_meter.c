@@ -0,0 +1,474 @@
+/*
+ * This audio filter publishes per channel peak and RMS levels and an
+ * optional coarse spectrum of every block of incoming audio in a memory
+ * mapped file, for level meters and visualizers in other processes.
+ * See af_meter.h for the layout of the file.
+ *
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "config.h"
+#include "libavutil/common.h"
+#include "libavutil/mem.h"
+#include "libavutil/tx.h"
+#include "mp_msg.h"
+#include "path.h"
+#include "subopt-helper.h"
+#include "help_mp.h"
+#include "af.h"
+#include "af_meter.h"
+
+#define SHARED_FILE "mplayer-af_meter" /* default file name
+					  (relative to ~/.mplayer/ */
+#define DEF_BLOCK 1024	// Default frames per record
+#define DEF_SLOTS 64	// Default records in the ring
+#define MAX_FFT   4096	// Longest transform used for the spectrum
+#define MAX_BANDS 128
+#define MIN_FREQ  20.0	// Lower edge of the first band [Hz]
+
+// Order the stores to the shared area as seen by other processes
+#define meter_barrier() __sync_synchronize()
+
+// Data for specific instances of this filter
+typedef struct af_meter_s
+{
+  char* filename;	// File to publish to
+  int	block;		// Frames per record
+  int	bands;		// Spectrum bands
+  int	slots;		// Records in the ring
+  int	fd;		// File descriptor of the shared file
+  uint8_t* area;	// Mapped file
+  size_t mapsize;	// Bytes mapped
+  size_t filesize;	// Size of the file, which never shrinks
+  int	record_size;	// Bytes per record
+  uint64_t head;	// Records written
+  // Running sums of the current block
+  float peak[AF_NCH];
+  float sq[AF_NCH];
+  int	fill;		// Frames in the current block
+  int64_t frames;	// Frames seen since the filter was configured
+  // Timestamps
+  double anchor_pts;	// pts of frame anchor_frame
+  double anchor_frame;
+  // Spectrum
+  int	nfft;		// Transform length
+  float* mono;		// Ring of the last nfft frames mixed to mono
+  float* win;		// Hann window
+  float* tmp;		// Windowed input of the transform
+  AVComplexFloat* bins;
+  int*	edge;		// First bin of each band, bands + 1 entries
+  AVTXContext* fft;
+  av_tx_fn fft_fn;
+} af_meter_t;
+
+static int64_t monotonic_time(void)
+{
+#if HAVE_CLOCK_GETTIME
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+static void free_spectrum(af_meter_t* s)
+{
+  av_tx_uninit(&s->fft);
+  av_freep(&s->mono);
+  av_freep(&s->win);
+  av_freep(&s->tmp);
+  av_freep(&s->bins);
+  av_freep(&s->edge);
+  s->nfft = 0;
+}
+
+/* The spectrum is taken from the last nfft frames of every block, nfft
+   being the largest power of two not longer than the block. */
+static int init_spectrum(af_meter_t* s, int rate)
+{
+  float scale = 1.0;
+  double lo, hi;
+  int i;
+
+  free_spectrum(s);
+  if (!s->bands)
+    return AF_OK;
+  for (s->nfft = 64; 2 * s->nfft <= FFMIN(s->block, MAX_FFT); s->nfft *= 2);
+
+  if (av_tx_init(&s->fft, &s->fft_fn, AV_TX_FLOAT_RDFT, 0, s->nfft, &scale, 0) < 0)
+    return AF_ERROR;
+  s->mono = av_calloc(s->nfft, sizeof(*s->mono));
+  s->win  = av_malloc_array(s->nfft, sizeof(*s->win));
+  s->tmp  = av_malloc_array(s->nfft, sizeof(*s->tmp));
+  s->bins = av_malloc_array(s->nfft / 2 + 1, sizeof(*s->bins));
+  s->edge = av_malloc_array(s->bands + 1, sizeof(*s->edge));
+  if (!s->mono || !s->win || !s->tmp || !s->bins || !s->edge)
+    return AF_ERROR;
+
+  // Scaled so that a full scale sine gives a magnitude of 1
+  for (i = 0; i < s->nfft; i++)
+    s->win[i] = (1.0 - cos(2 * M_PI * i / s->nfft)) * 2.0 / s->nfft;
+
+  // Logarithmic bands, each at least one bin wide
+  lo = FFMAX(MIN_FREQ, (double)rate / s->nfft);
+  hi = rate / 2.0;
+  for (i = 0; i <= s->bands; i++) {
+    double f = lo * pow(hi / lo, (double)i / s->bands);
+    s->edge[i] = lrint(f * s->nfft / rate);
+    if (i && s->edge[i] <= s->edge[i - 1])
+      s->edge[i] = s->edge[i - 1] + 1;
+  }
+  s->edge[s->bands] = FFMAX(s->edge[s->bands], s->nfft / 2 + 1);
+  return AF_OK;
+}
+
+static void close_area(af_meter_t* s)
+{
+  if (s->area)
+    munmap(s->area, s->mapsize);
+  s->area = NULL;
+  if (s->fd >= 0)
+    close(s->fd);
+  s->fd = -1;
+}
+
+// Map the file and write a header for the current configuration
+static int open_area(af_instance_t* af)
+{
+  af_meter_t* s = af->setup;
+  af_meter_header_t* h;
+  size_t size;
+
+  s->record_size = sizeof(af_meter_record_t) +
+                   (2 * af->data->nch + s->bands) * sizeof(float);
+  s->record_size = (s->record_size + 7) & ~7;
+  size = AF_METER_HEADER_SIZE + (size_t)s->slots * s->record_size;
+
+  if (s->fd < 0) {
+    s->fd = open(s->filename, O_RDWR | O_CREAT | O_TRUNC, 0640);
+    if (s->fd < 0) {
+      mp_msg(MSGT_AFILTER, MSGL_ERR, "[meter] Could not open/create file: %s\n",
+             s->filename);
+      return AF_ERROR;
+    }
+    s->filesize = 0;
+    mp_msg(MSGT_AFILTER, MSGL_INFO, "[meter] Publishing levels to file: %s\n",
+           s->filename);
+  }
+  // Readers may still map the old size, so never make the file shorter
+  if (size > s->filesize) {
+    if (ftruncate(s->fd, size) < 0) {
+      mp_msg(MSGT_AFILTER, MSGL_ERR, "[meter] Could not resize file: %s\n",
+             s->filename);
+      return AF_ERROR;
+    }
+    s->filesize = size;
+  }
+  if (s->area && size != s->mapsize) {
+    munmap(s->area, s->mapsize);
+    s->area = NULL;
+  }
+  if (!s->area) {
+    s->area = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+    if (s->area == MAP_FAILED) {
+      s->area = NULL;
+      mp_msg(MSGT_AFILTER, MSGL_ERR, "[meter] Could not mmap file: %s\n",
+             s->filename);
+      return AF_ERROR;
+    }
+    s->mapsize = size;
+  }
+
+  h = (af_meter_header_t*)s->area;
+  h->seq++;
+  meter_barrier();
+  // Records in the old layout must not be mistaken for new ones
+  if (h->record_size != s->record_size || h->slots != s->slots)
+    memset(s->area + AF_METER_HEADER_SIZE, 0, size - AF_METER_HEADER_SIZE);
+  h->magic       = AF_METER_MAGIC;
+  h->version     = AF_METER_VERSION;
+  h->nch         = af->data->nch;
+  h->bands       = s->bands;
+  h->rate        = af->data->rate;
+  h->block       = s->block;
+  h->slots       = s->slots;
+  h->record_size = s->record_size;
+  h->head        = s->head;
+  meter_barrier();
+  h->seq++;
+  return AF_OK;
+}
+
+static void publish_clock(af_meter_t* s, af_clock_t* clk)
+{
+  af_meter_header_t* h = (af_meter_header_t*)s->area;
+
+  h->seq++;
+  meter_barrier();
+  h->play_pts   = clk->play_pts;
+  h->play_speed = clk->speed;
+  h->play_time  = monotonic_time();
+  meter_barrier();
+  h->seq++;
+}
+
+// Write the record of the block that has just been completed
+static void publish(af_instance_t* af)
+{
+  af_meter_t* s = af->setup;
+  af_meter_header_t* h = (af_meter_header_t*)s->area;
+  af_meter_record_t* r = (af_meter_record_t*)(s->area + AF_METER_HEADER_SIZE +
+                          (s->head % s->slots) * s->record_size);
+  int nch = af->data->nch;
+  int64_t first = s->frames - s->block;
+  int i, b;
+
+  if (s->bands) {
+    // The mono ring starts with the oldest frame at the write position
+    int pos = s->block & (s->nfft - 1);
+    for (i = 0; i < s->nfft; i++)
+      s->tmp[i] = s->mono[(pos + i) & (s->nfft - 1)] * s->win[i];
+    s->fft_fn(s->fft, s->bins, s->tmp, sizeof(float));
+  }
+
+  r->seq++;
+  meter_barrier();
+  r->index = s->head;
+  r->pts   = s->anchor_pts + (first - s->anchor_frame) / af->data->rate;
+  for (i = 0; i < nch; i++) {
+    r->level[i]       = s->peak[i];
+    r->level[nch + i] = sqrtf(s->sq[i] / s->block);
+    s->peak[i] = s->sq[i] = 0;
+  }
+  for (b = 0; b < s->bands; b++) {
+    float m = 0;
+    for (i = s->edge[b]; i < s->edge[b + 1]; i++)
+      m = FFMAX(m, s->bins[i].re * s->bins[i].re + s->bins[i].im * s->bins[i].im);
+    r->level[2 * nch + b] = sqrtf(m);
+  }
+  meter_barrier();
+  r->seq++;
+
+  s->head++;
+  h->seq++;
+  meter_barrier();
+  h->head = s->head;
+  meter_barrier();
+  h->seq++;
+}
+
+/* Initialization and runtime control
+   af audio filter instance
+   cmd control command
+   arg argument
+*/
+static int control(struct af_instance_s* af, int cmd, void* arg)
+{
+  af_meter_t* s = af->setup;
+  switch (cmd){
+  case AF_CONTROL_REINIT:{
+    af_data_t* in = arg;
+    int i;
+
+    af->data->rate   = in->rate;
+    af->data->nch    = in->nch;
+    if (in->format == AF_FORMAT_FLOAT_NE) {
+      af->data->format = AF_FORMAT_FLOAT_NE;
+      af->data->bps    = 4;
+    } else {
+      af->data->format = AF_FORMAT_S16_NE;
+      af->data->bps    = 2;
+    }
+
+    for (i = 0; i < AF_NCH; i++)
+      s->peak[i] = s->sq[i] = 0;
+    s->fill   = 0;
+    s->frames = 0;
+    s->anchor_pts   = 0;
+    s->anchor_frame = 0;
+    if (init_spectrum(s, af->data->rate) != AF_OK ||
+        open_area(af) != AF_OK) {
+      mp_msg(MSGT_AFILTER, MSGL_ERR, "[meter] Initialization failed\n");
+      return AF_ERROR;
+    }
+    return af_test_output(af, in);
+  }
+  case AF_CONTROL_FORMAT_CAPS:
+    af_caps_add(arg, AF_FORMAT_FLOAT_NE, 0.5);
+    af_caps_add(arg, AF_FORMAT_S16_NE, 0.5);
+    return AF_OK;
+  case AF_CONTROL_COMMAND_LINE:{
+    char* file = NULL;
+    const opt_t subopts[] = {
+      {"file",  OPT_ARG_MSTRZ, &file,      NULL},
+      {"block", OPT_ARG_INT,   &s->block,  int_pos},
+      {"bands", OPT_ARG_INT,   &s->bands,  int_non_neg},
+      {"slots", OPT_ARG_INT,   &s->slots,  int_pos},
+      {NULL}
+    };
+    if (subopt_parse(arg, subopts) != 0)
+      return AF_ERROR;
+    if (file) {
+      free(s->filename);
+      s->filename = file;
+    }
+    if (s->bands > MAX_BANDS) {
+      mp_msg(MSGT_AFILTER, MSGL_ERR, "[meter] "
+             MSGTR_ErrorParsingCommandLine ": " MSGTR_AF_ValueOutOfRange
+             ": bands <= %d\n", MAX_BANDS);
+      return AF_ERROR;
+    }
+    if (s->bands && s->block < 64) {
+      mp_msg(MSGT_AFILTER, MSGL_ERR, "[meter] "
+             MSGTR_ErrorParsingCommandLine ": " MSGTR_AF_ValueOutOfRange
+             ": block >= 64 with bands\n");
+      return AF_ERROR;
+    }
+    return AF_OK;
+  }
+  case AF_CONTROL_PLAYBACK_CLOCK | AF_CONTROL_SET:{
+    af_clock_t* clk = arg;
+    af_instance_t* p;
+    double delay = 0;
+    if (!s->area)
+      return AF_OK;
+    // Audio that entered the chain but is still held by earlier filters
+    for (p = af; p->prev; p = p->prev);
+    for (; p != af; p = p->next) {
+      delay += p->delay;
+      delay *= p->mul;
+    }
+    s->anchor_pts   = clk->in_pts;
+    s->anchor_frame = s->frames + delay / (af->data->bps * af->data->nch);
+    publish_clock(s, clk);
+    return AF_OK;
+  }
+  }
+  return AF_UNKNOWN;
+}
+
+/* Free allocated memory and clean up other stuff too.
+   af audio filter instance
+*/
+static void uninit(struct af_instance_s* af)
+{
+  free(af->data);
+  af->data = NULL;
+
+  if (af->setup) {
+    af_meter_t* s = af->setup;
+    free_spectrum(s);
+    close_area(s);
+    free(s->filename);
+    free(af->setup);
+    af->setup = NULL;
+  }
+}
+
+static av_always_inline void accumulate(af_instance_t* af, const void* audio,
+                                        int len, int is_float)
+{
+  af_meter_t* s = af->setup;
+  int nch = af->data->nch;
+  int i, ch;
+
+  for (i = 0; i < len; i += nch) {
+    float sum = 0;
+    for (ch = 0; ch < nch; ch++) {
+      float v = is_float ? ((const float*)audio)[i + ch] :
+                           ((const int16_t*)audio)[i + ch] * (1.0f / 32768);
+      s->peak[ch] = FFMAX(s->peak[ch], fabsf(v));
+      s->sq[ch]  += v * v;
+      sum        += v;
+    }
+    if (s->bands)
+      s->mono[s->fill & (s->nfft - 1)] = sum / nch;
+    s->frames++;
+    if (++s->fill == s->block) {
+      publish(af);
+      s->fill = 0;
+    }
+  }
+}
+
+/* Filter data through filter
+   af audio filter instance
+   data audio data
+*/
+static af_data_t* play(struct af_instance_s* af, af_data_t* data)
+{
+  int len = data->len / data->bps;
+
+  if (!((af_meter_t*)af->setup)->area)
+    return data;
+  if (data->format == AF_FORMAT_FLOAT_NE)
+    accumulate(af, data->audio, len, 1);
+  else
+    accumulate(af, data->audio, len, 0);
+
+  // We don't modify data, just look at it
+  return data;
+}
+
+/* Allocate memory and set function pointers
+   af audio filter instance
+   returns AF_OK or AF_ERROR
+*/
+static int af_open(af_instance_t* af)
+{
+  af_meter_t* s;
+  af->control = control;
+  af->uninit  = uninit;
+  af->play    = play;
+  af->mul     = 1;
+  af->data    = calloc(1, sizeof(af_data_t));
+  af->setup   = s = calloc(1, sizeof(af_meter_t));
+  if ((af->data == NULL) || (af->setup == NULL))
+    return AF_ERROR;
+
+  s->filename = get_path(SHARED_FILE);
+  s->block    = DEF_BLOCK;
+  s->slots    = DEF_SLOTS;
+  s->fd       = -1;
+  return AF_OK;
+}
+
+// Description of this filter
+const af_info_t af_info_meter = {
+    "Level and spectrum export filter",
+    "meter",
+    "",
+    "",
+    AF_FLAGS_REENTRANT,
+    af_open
+};
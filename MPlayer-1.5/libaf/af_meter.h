@@ -0,0 +1,82 @@
+/*
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPLAYER_AF_METER_H
+#define MPLAYER_AF_METER_H
+
+#include <stdint.h>
+
+/* Layout of the file published by af_meter. It is kept free of MPlayer
+   types so that other programs can include it.
+
+   The file starts with a header of AF_METER_HEADER_SIZE bytes followed
+   by a ring of slots records of record_size bytes each. Record n is
+   stored in slot n % slots. All values are in host byte order.
+
+   There is one writer and any number of readers, which never block the
+   writer. The header and every record are protected by a sequence
+   counter that is odd while the writer changes the data. A reader
+   copies the data out and retries if the counter was odd or changed
+   meanwhile:
+
+     do {
+       s1 = rec->seq;  read barrier;
+       copy the record;
+       read barrier;   s2 = rec->seq;
+     } while ((s1 & 1) || s1 != s2);
+
+   A record whose index is not the one expected has been overwritten
+   and is lost. nch, bands, rate, block, slots and record_size may
+   change when the filter chain is reinitialized, so they should be
+   read together with head. The file never shrinks. */
+
+#define AF_METER_MAGIC       0x4d4c504d	// "MPLM"
+#define AF_METER_VERSION     1
+#define AF_METER_HEADER_SIZE 128
+
+typedef struct af_meter_header_s
+{
+  uint32_t magic;
+  uint32_t version;
+  volatile uint32_t seq;	// Sequence counter of the fields below
+  uint32_t nch;			// Channels in each record
+  uint32_t bands;		// Spectrum bands in each record, 0 if none
+  uint32_t rate;		// Sample rate [Hz]
+  uint32_t block;		// Frames summarized by one record
+  uint32_t slots;		// Records in the ring
+  uint32_t record_size;		// Bytes per record
+  uint32_t reserved;
+  uint64_t head;		// Records written so far
+  double play_pts;		// Position played at play_time [s]
+  double play_speed;		// Playback speed, 0 while paused
+  int64_t play_time;		// CLOCK_MONOTONIC [us] when play_pts was taken
+} af_meter_header_t;
+
+typedef struct af_meter_record_s
+{
+  volatile uint32_t seq;	// Sequence counter of this record
+  uint32_t reserved;
+  uint64_t index;		// Number of this record
+  double pts;			// Position of the first frame [s]
+  /* Followed by nch peak and nch RMS levels (linear, 1.0 is full scale)
+     and bands spectrum magnitudes (linear, a full scale sine is 1.0).
+     The bands are logarithmically spaced from 20 Hz to rate / 2. */
+  float level[];
+} af_meter_record_t;
+
+#endif /* MPLAYER_AF_METER_H */
@@ -270,6 +270,14 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
     af->mul = (double)s->up / s->dn;
     return rv;
   }
+  case AF_CONTROL_FORMAT_CAPS:{
+    af_resample_t* s   = af->setup;
+    if((s->setup & RSMP_MASK) != RSMP_FLOAT)
+      af_caps_add(arg, AF_FORMAT_S16_NE, 1);
+    if((s->setup & RSMP_MASK) != RSMP_LIN)
+      af_caps_add(arg, AF_FORMAT_FLOAT_NE, 1);
+    return AF_OK;
+  }
   case AF_CONTROL_COMMAND_LINE:{
     af_resample_t* s   = af->setup;
     int rate=0;
@@ -36,6 +36,7 @@
 #include <limits.h>
 
 #include "af.h"
+#include "kernels.h"
 #include "libavutil/common.h"
 #include "mp_msg.h"
 #include "subopt-helper.h"
@@ -135,12 +136,8 @@ static int best_overlap_offset_float(af_scaletempo_t* s)
 
   search_start = (float*)s->buf_queue + s->num_channels;
   for (off=0; off<s->frames_search; off++) {
-    float corr = 0;
-    float* ps = search_start;
-    ppc = s->buf_pre_corr;
-    for (i=s->num_channels; i<s->samples_overlap; i++) {
-      corr += *ppc++ * *ps++;
-    }
+    float corr = af_kernels.dot_float(s->buf_pre_corr, search_start,
+                                      s->samples_overlap - s->num_channels);
     if (corr > best_corr) {
       best_corr = corr;
       best_off  = off;
@@ -460,6 +457,10 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
   case AF_CONTROL_SCALETEMPO_AMOUNT | AF_CONTROL_GET:
     *(float*)arg = s->scale;
     return AF_OK;
+  case AF_CONTROL_FORMAT_CAPS:
+    af_caps_add(arg, AF_FORMAT_FLOAT_NE, 1);
+    af_caps_add(arg, AF_FORMAT_S16_NE, 1);
+    return AF_OK;
   case AF_CONTROL_COMMAND_LINE:{
     strarg_t speed = { 0 };
     opt_t subopts[] = {
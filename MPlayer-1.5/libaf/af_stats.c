@@ -33,9 +33,12 @@ struct af_stats {
     long long n_samples;
     double tsquare;
     int max;
-    long long histogram[65536];
+    long long histogram[MAX_DB];
 };
 
+// histogram bin of every sample value
+static uint8_t db_index[65536];
+
 static inline int logdb(double v)
 {
     if (v > 1)
@@ -57,8 +60,14 @@ static int stats_init(af_instance_t *af, struct af_stats *s, af_data_t *data)
     s->n_samples = 0;
     s->tsquare   = 0;
     s->max       = 0;
-    for (i = 0; i < 65536; i++)
+    for (i = 0; i < MAX_DB; i++)
         s->histogram[i] = 0;
+    if (!db_index[32768]) { // silence is in the last bin once this is set up
+        for (i = 0; i < 65536; i++) {
+            float v = (i - 32768) / 32768.0;
+            db_index[i] = logdb(v * v);
+        }
+    }
     return af_test_output(af, data);
 }
 
@@ -66,8 +75,7 @@ static void stats_print(struct af_stats *s)
 {
     int i;
     long long sum;
-    float v;
-    long long h[MAX_DB];
+    long long *h = s->histogram;
 
     s->tsquare /= 32768 * 32768;
     mp_msg(MSGT_AFILTER, MSGL_INFO, "stats: n_samples: %lld\n", s->n_samples);
@@ -77,12 +85,6 @@ static void stats_print(struct af_stats *s)
            logdb(s->tsquare / s->n_samples));
     mp_msg(MSGT_AFILTER, MSGL_INFO, "stats: max_volume: -%d dB\n",
            logdb(s->max / (32768.0 * 32768.0)));
-    for (i = 0; i < MAX_DB; i++)
-        h[i] = 0;
-    for (i = 0; i < 65536; i++) {
-        v = (i - 32768) / 32768.0;
-        h[logdb(v * v)] += s->histogram[i];
-    }
     for (i = 0; i < MAX_DB; i++)
         if (h[i] != 0)
             break;
@@ -130,7 +132,7 @@ static af_data_t *play(struct af_instance_s *af, af_data_t *data)
         v = *a;
         v2 = v * v;
         s->tsquare += v2;
-        s->histogram[v + 32768]++;
+        s->histogram[db_index[v + 32768]]++;
         if (v2 > s->max)
             s->max = v2;
     }
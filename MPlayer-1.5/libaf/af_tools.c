@@ -98,6 +98,15 @@ int af_test_output(struct af_instance_s* af, af_data_t* out)
   return AF_OK;
 }
 
+/* Helper function for answering AF_CONTROL_FORMAT_CAPS */
+void af_caps_add(af_caps_t* caps, int format, float cost)
+{
+  if(caps->nfmt < AF_CAPS_MAX){
+    caps->format[caps->nfmt] = format;
+    caps->cost[caps->nfmt++] = cost;
+  }
+}
+
 /* Soft clipping, the sound of a dream, thanks to Jon Wattes
    post to Musicdsp.org */
 float af_softclip(float a)
@@ -99,6 +99,10 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
       af->data->bps    = 4;
     }
     return af_test_output(af,(af_data_t*)arg);
+  case AF_CONTROL_FORMAT_CAPS:
+    af_caps_add(arg, AF_FORMAT_FLOAT_NE, 0.5);
+    af_caps_add(arg, AF_FORMAT_S16_NE, 0.5);
+    return AF_OK;
   case AF_CONTROL_COMMAND_LINE:{
     int   i = 0;
     float target = DEFAULT_TARGET;
@@ -0,0 +1,344 @@
+/*
+ * Fused output stage: volume, clipping, dither and sample packing
+ *
+ * Does the work of a volume filter followed by the final float to
+ * integer format conversion in a single pass over the data. It is
+ * inserted automatically in place of such a volume -> format pair at
+ * the end of the chain and answers the same AF_CONTROL_VOLUME_* calls
+ * as af_volume, so the software mixer keeps working unchanged.
+ *
+ * Volume changes are ramped over a few milliseconds instead of being
+ * applied as a step, which avoids clicks when the volume is changed
+ * during playback.
+ *
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <inttypes.h>
+#include <math.h>
+#include <limits.h>
+
+#include "config.h"
+#include "libavutil/common.h"
+#include "mp_msg.h"
+#include "af.h"
+#include "kernels.h"
+
+// Length of a volume ramp [ms]
+#define VOLPACK_RAMP_MS 10
+
+// Data for specific instances of this filter
+typedef struct af_volpack_s
+{
+  float level[AF_NCH];		// Target gain for each channel
+  float gain[AF_NCH];		// Current gain, differs from level during a ramp
+  float step[AF_NCH];		// Gain increment per sample frame during a ramp
+  int ramp;			// Sample frames left in the current ramp
+  int soft;			// Enable/disable soft clipping
+  int dither;			// Add TPDF dither for 8 and 16 bit output
+  int started;			// Set once data was played, ramps only after that
+  uint32_t seed;		// Dither noise generator state
+  // Pack len samples with constant gain
+  void (*pack)(const float* in, void* out, int len, const float* gain, int nch);
+}af_volpack_t;
+
+static int supported_format(int format)
+{
+  return format == AF_FORMAT_S8     || format == AF_FORMAT_S16_NE ||
+         format == AF_FORMAT_S32_NE || format == AF_FORMAT_FLOAT_NE;
+}
+
+static av_always_inline float clip_sample(float x, int soft)
+{
+  /* Soft clipping, the sound of a dream, thanks to Jon Wattes
+     post to Musicdsp.org */
+  if (soft)
+    return af_softclip(x);
+  return av_clipf(x, -1.0, 1.0);
+}
+
+// Same rounding as the float to int conversion in af_format
+static av_always_inline void store_sample(void* out, int i, float x, int bps)
+{
+  switch (bps) {
+  case 1:
+    ((int8_t*)out)[i] = av_clip_int8(lrintf(128.0f * x));
+    break;
+  case 2:
+    ((int16_t*)out)[i] = av_clip_int16(lrintf(32768.0f * x));
+    break;
+  case 4:
+    if (x <= -1.0f)
+      ((int32_t*)out)[i] = INT_MIN;
+    else if (x >= 1.0f)
+      ((int32_t*)out)[i] = INT_MAX;
+    else
+      ((int32_t*)out)[i] = lrintf(x * 2147483648.0f);
+    break;
+  }
+}
+
+static av_always_inline void pack_C(const float* in, void* out, int len,
+                                    const float* gain, int nch, int soft, int bps)
+{
+  int i, ch;
+  for (i = 0; i < len; i += nch)
+    for (ch = 0; ch < nch; ch++) {
+      float x = clip_sample(in[i + ch] * gain[ch], soft);
+      if (bps == 4 && out == in)
+        ((float*)out)[i + ch] = x;
+      else
+        store_sample(out, i + ch, x, bps);
+    }
+}
+
+/* The gain vector of the kernels repeats every four samples, so these
+   only handle channel counts that divide four or equal gains on all
+   channels. */
+static void pack_gain4(float* g, const float* gain, int nch)
+{
+  int i;
+  for (i = 0; i < 4; i++)
+    g[i] = gain[i % nch];
+}
+
+static void pack_float(const float* in, void* out, int len, const float* gain, int nch)
+{
+  float g[4];
+  pack_gain4(g, gain, nch);
+  af_kernels.gain_clip_float(out, in, len, g);
+}
+
+static void pack_s32(const float* in, void* out, int len, const float* gain, int nch)
+{
+  pack_C(in, out, len, gain, nch, 0, 4);
+}
+
+static void pack_s16(const float* in, void* out, int len, const float* gain, int nch)
+{
+  float g[4];
+  pack_gain4(g, gain, nch);
+  af_kernels.gain_clip_s16(out, in, len, g);
+}
+
+static void pack_s8(const float* in, void* out, int len, const float* gain, int nch)
+{
+  pack_C(in, out, len, gain, nch, 0, 1);
+}
+
+// Generic path: ramps, soft clipping and dither, one sample frame at a time
+static void pack_generic(af_volpack_t* s, const float* in, void* out,
+                         int frames, int nch, int bps)
+{
+  float scale = bps == 1 ? 128.0f : 32768.0f;
+  int dither = s->dither && bps <= 2;
+  int i, ch;
+  for (i = 0; i < frames; i++) {
+    if (s->ramp) {
+      for (ch = 0; ch < nch; ch++)
+        s->gain[ch] += s->step[ch];
+      if (!--s->ramp)
+        memcpy(s->gain, s->level, sizeof(s->gain));
+    }
+    for (ch = 0; ch < nch; ch++) {
+      int n   = i * nch + ch;
+      float x = clip_sample(in[n] * s->gain[ch], s->soft);
+      if (dither) {
+        // triangular noise of +-1 LSB from two uniform values
+        int r1, r2;
+        s->seed = s->seed * 1664525 + 1013904223;
+        r1 = s->seed >> 16;
+        s->seed = s->seed * 1664525 + 1013904223;
+        r2 = s->seed >> 16;
+        x += (r1 - r2) * (1.0f / 65536) / scale;
+      }
+      if (bps == 4 && out == in)
+        ((float*)out)[n] = x;
+      else
+        store_sample(out, n, x, bps);
+    }
+  }
+}
+
+// Initialization and runtime control
+static int control(struct af_instance_s* af, int cmd, void* arg)
+{
+  af_volpack_t* s = af->setup;
+
+  switch(cmd){
+  case AF_CONTROL_REINIT:{
+    af_data_t* data = arg;
+    char buf[256];
+    // Sanity check
+    if(!arg) return AF_ERROR;
+
+    af->data->rate = data->rate;
+    af->data->nch  = data->nch;
+    af->mul        = (double)af->data->bps / 4;
+    memcpy(s->gain, s->level, sizeof(s->gain));
+    s->ramp        = 0;
+    s->started     = 0;
+
+    switch(af->data->format){
+    case AF_FORMAT_S8:       s->pack = pack_s8;    break;
+    case AF_FORMAT_S16_NE:   s->pack = pack_s16;   break;
+    case AF_FORMAT_S32_NE:   s->pack = pack_s32;   break;
+    default:                 s->pack = pack_float; break;
+    }
+    mp_msg(MSGT_AFILTER, MSGL_V, "[volpack] Volume and conversion to %s in one pass\n",
+           af_fmt2str(af->data->format, buf, sizeof(buf)));
+    if(data->format != AF_FORMAT_FLOAT_NE){
+      data->format = AF_FORMAT_FLOAT_NE;
+      data->bps    = 4;
+      return AF_FALSE;
+    }
+    return AF_OK;
+  }
+  case AF_CONTROL_COMMAND_LINE:{
+    float v = 0.0;
+    float vol[AF_NCH];
+    int   i;
+    sscanf((char*)arg, "%f:%i:%i", &v, &s->soft, &s->dither);
+    for(i = 0; i < AF_NCH; i++) vol[i] = v;
+    return control(af, AF_CONTROL_VOLUME_LEVEL | AF_CONTROL_SET, vol);
+  }
+  case AF_CONTROL_FORMAT_FMT | AF_CONTROL_SET:
+    if(!supported_format(*(int*)arg))
+      return AF_ERROR;
+    af->data->format = *(int*)arg;
+    af->data->bps    = af_fmt2bits(af->data->format) / 8;
+    return AF_OK;
+  case AF_CONTROL_VOLUME_SOFTCLIP | AF_CONTROL_SET:
+    s->soft = *(int*)arg;
+    return AF_OK;
+  case AF_CONTROL_VOLUME_SOFTCLIP | AF_CONTROL_GET:
+    *(int*)arg = s->soft;
+    return AF_OK;
+  case AF_CONTROL_VOLUME_GAIN | AF_CONTROL_SET:
+  case AF_CONTROL_VOLUME_LEVEL | AF_CONTROL_SET:{
+    int ch, frames = af->data->rate * VOLPACK_RAMP_MS / 1000;
+    if(cmd == (AF_CONTROL_VOLUME_GAIN | AF_CONTROL_SET))
+      memcpy(s->level, arg, sizeof(s->level));
+    else if(AF_OK != af_from_dB(AF_NCH, (float*)arg, s->level, 20.0, -200.0, 60.0))
+      return AF_ERROR;
+    // Before any data is played the level is just the starting point
+    if(!s->started || frames <= 0){
+      memcpy(s->gain, s->level, sizeof(s->gain));
+      s->ramp = 0;
+      return AF_OK;
+    }
+    for(ch = 0; ch < AF_NCH; ch++)
+      s->step[ch] = (s->level[ch] - s->gain[ch]) / frames;
+    s->ramp = frames;
+    return AF_OK;
+  }
+  case AF_CONTROL_VOLUME_LEVEL | AF_CONTROL_GET:
+    return af_to_dB(AF_NCH, s->level, (float*)arg, 20.0);
+  case AF_CONTROL_VOLUME_GAIN | AF_CONTROL_GET:
+    memcpy(arg, s->level, sizeof(s->level));
+    return AF_OK;
+  }
+  return AF_UNKNOWN;
+}
+
+// Deallocate memory
+static void uninit(struct af_instance_s* af)
+{
+  if(af->data)
+    free(af->data->audio);
+  free(af->data);
+  free(af->setup);
+}
+
+// Filter data through filter
+static af_data_t* play(struct af_instance_s* af, af_data_t* data)
+{
+  af_data_t*    c   = data;			// Current working data
+  af_data_t*    l   = af->data;		// Local data
+  af_volpack_t* s   = af->setup;		// Setup for this instance
+  int           nch = c->nch;
+  int           len = c->len / 4;		// Number of samples
+  int           bps = l->bps;
+  float*        in  = c->audio;
+  void*         out = in;
+  int           ch, same_vol = 1;
+
+  // Float output is done in place, the others need a buffer
+  if(l->format != AF_FORMAT_FLOAT_NE){
+    if(AF_OK != RESIZE_LOCAL_BUFFER(af, data))
+      return NULL;
+    out = l->audio;
+  }
+
+  s->started = 1;
+  // Ramps, soft clipping and dither are handled per sample frame
+  if(s->ramp){
+    int frames = FFMIN(s->ramp, len / nch);
+    pack_generic(s, in, out, frames, nch, bps);
+    in  += frames * nch;
+    out  = (char*)out + frames * nch * bps;
+    len -= frames * nch;
+  }
+  for(ch = 1; ch < nch; ch++)
+    same_vol &= s->gain[ch] == s->gain[0];
+  if(s->soft || (s->dither && bps <= 2) || (!same_vol && 4 % nch))
+    pack_generic(s, in, out, len / nch, nch, bps);
+  else
+    s->pack(in, out, len, s->gain, same_vol ? 1 : nch);
+
+  if(l->format != AF_FORMAT_FLOAT_NE)
+    c->audio = l->audio;
+  c->len    = c->len / 4 * bps;
+  c->bps    = bps;
+  c->format = l->format;
+  return c;
+}
+
+// Allocate memory and set function pointers
+static int af_open(af_instance_t* af){
+  af_volpack_t* s;
+  int i;
+  af->control = control;
+  af->uninit  = uninit;
+  af->play    = play;
+  af->mul     = 1;
+  af->data    = calloc(1, sizeof(af_data_t));
+  af->setup   = s = calloc(1, sizeof(af_volpack_t));
+  if(af->data == NULL || af->setup == NULL)
+    return AF_ERROR;
+  // Float output until told otherwise, initial volume 0dB
+  af->data->format = AF_FORMAT_FLOAT_NE;
+  af->data->bps    = 4;
+  for(i = 0; i < AF_NCH; i++)
+    s->level[i] = s->gain[i] = 1.0;
+  s->seed = 1;
+  return AF_OK;
+}
+
+// Description of this filter
+const af_info_t af_info_volpack = {
+    "Volume control with fused output conversion",
+    "volpack",
+    "",
+    "",
+    AF_FLAGS_NOT_REENTRANT,
+    af_open
+};
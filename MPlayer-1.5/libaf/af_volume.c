@@ -39,6 +39,7 @@
 #include "libavutil/common.h"
 #include "mp_msg.h"
 #include "af.h"
+#include "kernels.h"
 
 // Data for specific instances of this filter
 typedef struct af_volume_s
@@ -71,6 +72,11 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
       af->data->bps    = 4;
     }
     return af_test_output(af,(af_data_t*)arg);
+  case AF_CONTROL_FORMAT_CAPS:
+    af_caps_add(arg, AF_FORMAT_FLOAT_NE, 0.25);
+    if(s->fast)
+      af_caps_add(arg, AF_FORMAT_S16_NE, 0.25);
+    return AF_OK;
   case AF_CONTROL_COMMAND_LINE:{
     float v=0.0;
     float vol[AF_NCH];
@@ -93,6 +99,9 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
     return af_from_dB(AF_NCH,(float*)arg,s->level,20.0,-200.0,60.0);
   case AF_CONTROL_VOLUME_LEVEL | AF_CONTROL_GET:
     return af_to_dB(AF_NCH,s->level,(float*)arg,20.0);
+  case AF_CONTROL_VOLUME_GAIN | AF_CONTROL_GET:
+    memcpy(arg,s->level,sizeof(s->level));
+    return AF_OK;
   case AF_CONTROL_PRE_DESTROY:
     if(!s->fast){
 	float m = s->max;
@@ -125,27 +134,6 @@ static av_always_inline void s16_inner_loop(int16_t *data, int len, int offset,
 static av_always_inline void float_inner_loop(float *data, int len, int offset, int step, float level, int softclip)
 {
   int i;
-#if HAVE_NEON && !ARCH_AARCH64
-  if (offset == 0 && step == 1 && !softclip && len >= 8)
-  {
-    __asm__(
-      "vmov.32 d2[0], %2\n\t"
-      "vdup.32 q8, %3\n\t"
-      "vneg.f32 q9, q8\n\t"
-"0:\n\t"
-      "vld1.32 {q0}, [%0]\n\t"
-      "vmul.f32 q0, q0, d2[0]\n\t"
-      "cmp %0, %1\n\t"
-      "vmin.f32 q0, q0, q8\n\t"
-      "vmax.f32 q0, q0, q9\n\t"
-      "vst1.32 {q0}, [%0]!\n\t"
-      "blo 0b\n\t"
-    : "+&r"(data)
-    : "r"(data + len - 7), "r"(level), "r"(0x3f800000)
-    : "cc", "q0", "d2", "q8", "q9", "memory");
-    len &= 3;
-  }
-#endif
   for (i = offset; i < len; i += step)
   {
     register float x = data[i];
@@ -195,7 +183,7 @@ static af_data_t* play(struct af_instance_s* af, af_data_t* data)
     if (same_vol && s->soft)
       float_inner_loop(a, len, 0, 1, s->level[0], 1);
     else if (same_vol)
-      float_inner_loop(a, len, 0, 1, s->level[0], 0);
+      af_kernels.scale_clip_float(a, len, s->level[0]);
     else for (ch = 0; ch < nch; ch++)
       float_inner_loop(a, len, ch, nch, s->level[ch], s->soft);
   }
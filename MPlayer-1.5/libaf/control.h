@@ -72,6 +72,19 @@ typedef struct af_control_ext_s{
   int	ch;	// Chanel number
 }af_control_ext_t;
 
+/*********************************************
+// Formats a filter processes as they are, without changing the format.
+// Filled in by AF_CONTROL_FORMAT_CAPS and used to plan the conversions
+// in the filter chain.
+*/
+#define AF_CAPS_MAX 4
+typedef struct af_caps_s{
+  int	nfmt;			// Number of formats, 0 = any format
+  int	format[AF_CAPS_MAX];	// Formats
+  float	cost[AF_CAPS_MAX];	/* Relative cost per sample, per byte for
+				   any format (in cost[0]) */
+}af_caps_t;
+
 /*********************************************
 // Control parameters
 */
@@ -111,6 +124,11 @@ typedef struct af_control_ext_s{
    argument */
 #define AF_CONTROL_COMMAND_LINE		0x00000300 | AF_CONTROL_OPTIONAL
 
+/* Formats the filter can process as they are, the argument is an
+   af_caps_t to fill in. Filters that do not answer get the format they
+   ask for in AF_CONTROL_REINIT. */
+#define AF_CONTROL_FORMAT_CAPS		0x00000400 | AF_CONTROL_OPTIONAL
+
 
 // FILTER SPECIFIC CALLS
 
@@ -162,6 +180,9 @@ typedef struct af_control_ext_s{
 // Set volume level, arg is a float* with the volume for all the channels
 #define AF_CONTROL_VOLUME_LEVEL		0x00000D00 | AF_CONTROL_FILTER_SPECIFIC
 
+// Linear gain instead of dB, used to move the exact level between filters
+#define AF_CONTROL_VOLUME_GAIN		0x00000E00 | AF_CONTROL_FILTER_SPECIFIC
+
 // Compressor/expander
 
 // Turn compressor/expander on and off
@@ -245,4 +266,25 @@ typedef struct af_control_ext_s{
 #define AF_CONTROL_PLAYBACK_SPEED	0x00003500 | AF_CONTROL_FILTER_SPECIFIC
 #define AF_CONTROL_SCALETEMPO_AMOUNT	0x00003600 | AF_CONTROL_FILTER_SPECIFIC
 
+/* Playback position, set by the player before it decodes more audio.
+   Used by filters that timestamp what they publish, arg is af_clock_t* */
+typedef struct af_clock_s
+{
+  double in_pts;	// pts of the end of the audio that entered the chain
+  double play_pts;	// pts of the audio that is being played
+  float speed;		// playback speed, 0 while paused
+} af_clock_t;
+#define AF_CONTROL_PLAYBACK_CLOCK	0x00003700 | AF_CONTROL_FILTER_SPECIFIC
+
+/* Identity of the file being played, set by the player after the chain
+   was built. Used by filters that cache results per track, arg is
+   af_content_t* */
+typedef struct af_content_s
+{
+  const char* key;	// content key from index_cache_content_key()
+  int track;		// audio stream id
+  double length;	// length [s], 0 if unknown
+} af_content_t;
+#define AF_CONTROL_CONTENT		0x00003800 | AF_CONTROL_FILTER_SPECIFIC
+
 #endif /* MPLAYER_CONTROL_H */
@@ -0,0 +1,266 @@
+/*
+ * uniformly partitioned overlap-save FFT convolution
+ *
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Each input keeps a window of the previous and the current block and
+   a frequency domain delay line with the spectra of the last blocks.
+   Partition 0 of a filter is applied to the spectrum of the current,
+   possibly incomplete, block on every call, the other partitions only
+   see complete blocks, so their sum is computed once per block. This
+   gives the output without waiting for a block to fill up. */
+
+#include <string.h>
+
+#include "config.h"
+#include "libavutil/common.h"
+#include "libavutil/mem.h"
+#include "libavutil/tx.h"
+#include "mp_msg.h"
+#include "dsp.h"
+#include "kernels.h"
+
+struct af_fftconv_s {
+  int block;			// Partition and block length
+  int nbin;			// Complex bins of a 2*block real FFT
+  int stride;			// Distance of the spectra in fdl and kern
+  int parts;			// Number of partitions
+  int nin, nout;
+  AVTXContext *fft, *ifft;
+  av_tx_fn fft_fn, ifft_fn;
+  FLOAT_TYPE** win;		// Per input: previous and current block
+  AVComplexFloat** fdl;		// Per input: parts spectra, ring indexed by pos
+  FLOAT_TYPE** taps;		// Per pair: filter in the time domain or NULL
+  AVComplexFloat** kern;	// Per pair: parts spectra of the filter
+  AVComplexFloat** tail;	// Per output: sum of partitions 1..parts-1
+  int* used;			// Per input: has a filter to any output
+  AVComplexFloat* acc;
+  FLOAT_TYPE* tmp;
+  int fill;			// Samples in the current block
+  int pos;			// fdl slot of the current block
+  int dirty;			// Filter spectra need to be recalculated
+};
+
+af_fftconv_t* af_fftconv_init(int block, int nin, int nout, int len)
+{
+  af_fftconv_t* c;
+  float scale;
+  int i;
+
+  if (block < 2 || (block & (block - 1)) || nin < 1 || nout < 1 || len < 1)
+    return NULL;
+  c = av_mallocz(sizeof(*c));
+  if (!c)
+    return NULL;
+  c->block = block;
+  c->nbin  = block + 1;
+  // av_tx wants aligned buffers, so every spectrum in a ring has to
+  // start on the alignment av_malloc gives the first one
+  c->stride = FFALIGN(c->nbin, 8);
+  c->parts = (len + block - 1) / block;
+  c->nin   = nin;
+  c->nout  = nout;
+  c->dirty = 1;
+
+  scale = 1.0;
+  if (av_tx_init(&c->fft, &c->fft_fn, AV_TX_FLOAT_RDFT, 0, 2 * block, &scale, 0) < 0)
+    goto fail;
+  scale = 1.0 / (2 * block);
+  if (av_tx_init(&c->ifft, &c->ifft_fn, AV_TX_FLOAT_RDFT, 1, 2 * block, &scale, 0) < 0)
+    goto fail;
+
+  c->win  = av_calloc(nin, sizeof(*c->win));
+  c->fdl  = av_calloc(nin, sizeof(*c->fdl));
+  c->taps = av_calloc(nin * nout, sizeof(*c->taps));
+  c->kern = av_calloc(nin * nout, sizeof(*c->kern));
+  c->tail = av_calloc(nout, sizeof(*c->tail));
+  c->used = av_calloc(nin, sizeof(*c->used));
+  c->acc  = av_malloc_array(c->nbin, sizeof(*c->acc));
+  c->tmp  = av_malloc_array(2 * block, sizeof(*c->tmp));
+  if (!c->win || !c->fdl || !c->taps || !c->kern || !c->tail || !c->used || !c->acc || !c->tmp)
+    goto fail;
+  for (i = 0; i < nin; i++) {
+    c->win[i] = av_calloc(2 * block, sizeof(**c->win));
+    c->fdl[i] = av_calloc(c->parts * c->stride, sizeof(**c->fdl));
+    if (!c->win[i] || !c->fdl[i])
+      goto fail;
+  }
+  for (i = 0; i < nout; i++)
+    if (!(c->tail[i] = av_calloc(c->nbin, sizeof(**c->tail))))
+      goto fail;
+
+  return c;
+
+fail:
+  mp_msg(MSGT_AFILTER, MSGL_ERR, "[libaf] Unable to set up FFT convolution\n");
+  af_fftconv_free(c);
+  return NULL;
+}
+
+int af_fftconv_add(af_fftconv_t* c, int in, int out, const FLOAT_TYPE* w,
+                   int n, int delay, FLOAT_TYPE gain)
+{
+  FLOAT_TYPE** taps;
+  int i;
+
+  if (in < 0 || in >= c->nin || out < 0 || out >= c->nout ||
+      n < 0 || delay < 0 || n + delay > c->parts * c->block)
+    return -1;
+  taps = &c->taps[in * c->nout + out];
+  if (!*taps && !(*taps = av_calloc(c->parts * c->block, sizeof(**taps))))
+    return -1;
+  for (i = 0; i < n; i++)
+    (*taps)[delay + i] += gain * w[i];
+  c->dirty = 1;
+  return 0;
+}
+
+// Transform the filters, one spectrum per partition
+static int prepare(af_fftconv_t* c)
+{
+  int i, p, B = c->block;
+
+  for (i = 0; i < c->nin * c->nout; i++) {
+    if (!c->taps[i])
+      continue;
+    c->used[i / c->nout] = 1;
+    if (!c->kern[i] &&
+        !(c->kern[i] = av_calloc(c->parts * c->stride, sizeof(**c->kern))))
+      return -1;
+    for (p = 0; p < c->parts; p++) {
+      memcpy(c->tmp, c->taps[i] + p * B, B * sizeof(*c->tmp));
+      memset(c->tmp + B, 0, B * sizeof(*c->tmp));
+      c->fft_fn(c->fft, c->kern[i] + p * c->stride, c->tmp, sizeof(float));
+    }
+  }
+  c->dirty = 0;
+  return 0;
+}
+
+// Sum of the older partitions, only changes when a block is complete
+static void update_tail(af_fftconv_t* c)
+{
+  int i, o, p;
+
+  for (o = 0; o < c->nout; o++) {
+    memset(c->tail[o], 0, c->nbin * sizeof(*c->tail[o]));
+    for (i = 0; i < c->nin; i++) {
+      const AVComplexFloat* h = c->kern[i * c->nout + o];
+      if (!c->taps[i * c->nout + o])
+        continue;
+      for (p = 1; p < c->parts; p++) {
+        int slot = (c->pos - p + c->parts) % c->parts;
+        af_kernels.cmac(c->tail[o], c->fdl[i] + slot * c->stride,
+                        h + p * c->stride, c->nbin);
+      }
+    }
+  }
+}
+
+void af_fftconv_process(af_fftconv_t* c, const FLOAT_TYPE* const* in,
+                        FLOAT_TYPE* const* out, int n)
+{
+  int B = c->block, done = 0, i, o;
+
+  if (c->dirty) {
+    if (prepare(c) < 0) {
+      for (o = 0; o < c->nout; o++)
+        memset(out[o], 0, n * sizeof(*out[o]));
+      return;
+    }
+    update_tail(c);
+  }
+
+  while (done < n) {
+    int k = FFMIN(n - done, B - c->fill);
+
+    // Spectrum of the previous and the current block, unfilled part is 0
+    for (i = 0; i < c->nin; i++) {
+      if (!c->used[i])
+        continue;
+      memcpy(c->win[i] + B + c->fill, in[i] + done, k * sizeof(*c->tmp));
+      memcpy(c->tmp, c->win[i], 2 * B * sizeof(*c->tmp));
+      c->fft_fn(c->fft, c->fdl[i] + c->pos * c->stride, c->tmp, sizeof(float));
+    }
+    c->fill += k;
+
+    for (o = 0; o < c->nout; o++) {
+      memcpy(c->acc, c->tail[o], c->nbin * sizeof(*c->acc));
+      for (i = 0; i < c->nin; i++)
+        if (c->taps[i * c->nout + o])
+          af_kernels.cmac(c->acc, c->fdl[i] + c->pos * c->stride,
+                          c->kern[i * c->nout + o], c->nbin);
+      c->ifft_fn(c->ifft, c->tmp, c->acc, sizeof(AVComplexFloat));
+      memcpy(out[o] + done, c->tmp + B + c->fill - k, k * sizeof(*c->tmp));
+    }
+    done += k;
+
+    if (c->fill == B) {
+      for (i = 0; i < c->nin; i++) {
+        memcpy(c->win[i], c->win[i] + B, B * sizeof(*c->tmp));
+        memset(c->win[i] + B, 0, B * sizeof(*c->tmp));
+      }
+      c->fill = 0;
+      c->pos  = (c->pos + 1) % c->parts;
+      update_tail(c);
+    }
+  }
+}
+
+void af_fftconv_reset(af_fftconv_t* c)
+{
+  int i;
+
+  for (i = 0; i < c->nin; i++) {
+    memset(c->win[i], 0, 2 * c->block * sizeof(*c->win[i]));
+    memset(c->fdl[i], 0, c->parts * c->stride * sizeof(*c->fdl[i]));
+  }
+  for (i = 0; i < c->nout; i++)
+    memset(c->tail[i], 0, c->nbin * sizeof(*c->tail[i]));
+  c->fill = 0;
+  c->pos  = 0;
+}
+
+void af_fftconv_free(af_fftconv_t* c)
+{
+  int i;
+
+  if (!c)
+    return;
+  av_tx_uninit(&c->fft);
+  av_tx_uninit(&c->ifft);
+  for (i = 0; c->win && i < c->nin; i++)
+    av_free(c->win[i]);
+  for (i = 0; c->fdl && i < c->nin; i++)
+    av_free(c->fdl[i]);
+  for (i = 0; c->taps && i < c->nin * c->nout; i++)
+    av_free(c->taps[i]);
+  for (i = 0; c->kern && i < c->nin * c->nout; i++)
+    av_free(c->kern[i]);
+  for (i = 0; c->tail && i < c->nout; i++)
+    av_free(c->tail[i]);
+  av_free(c->win);
+  av_free(c->fdl);
+  av_free(c->taps);
+  av_free(c->kern);
+  av_free(c->tail);
+  av_free(c->used);
+  av_free(c->acc);
+  av_free(c->tmp);
+  av_free(c);
+}
@@ -0,0 +1,55 @@
+/*
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Uniformly partitioned overlap-save FFT convolution of several input
+   signals with a matrix of FIR filters. Each output is the sum of the
+   inputs convolved with the filters added for that input/output pair.
+   Filters are split into partitions of one block each, so the cost per
+   sample grows with log(block) + taps/block instead of taps. There is
+   no extra latency, any number of samples can be processed per call.
+*/
+
+#ifndef MPLAYER_FFTCONV_H
+#define MPLAYER_FFTCONV_H
+
+#include "dsp.h"
+
+typedef struct af_fftconv_s af_fftconv_t;
+
+/* Create a convolver with nin inputs, nout outputs and filters of up
+   to len taps (including any delay), block must be a power of 2.
+   Returns NULL on failure. */
+af_fftconv_t* af_fftconv_init(int block, int nin, int nout, int len);
+
+/* Add gain * w, delayed by delay samples, to the filter from input in
+   to output out. n + delay must not exceed the length given to init.
+   Returns 0 on success and -1 on error. */
+int af_fftconv_add(af_fftconv_t* c, int in, int out, const FLOAT_TYPE* w,
+                   int n, int delay, FLOAT_TYPE gain);
+
+/* Filter n samples of each input signal in[0..nin-1] into the output
+   signals out[0..nout-1]. */
+void af_fftconv_process(af_fftconv_t* c, const FLOAT_TYPE* const* in,
+                        FLOAT_TYPE* const* out, int n);
+
+// Clear the input history
+void af_fftconv_reset(af_fftconv_t* c);
+
+void af_fftconv_free(af_fftconv_t* c);
+
+#endif /* MPLAYER_FFTCONV_H */
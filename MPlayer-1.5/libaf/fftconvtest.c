@@ -0,0 +1,119 @@
+/*
+ * accuracy test for fftconv.[ch], compares it with direct convolution
+ *
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libavutil/common.h"
+#include "cpudetect.h"
+#include "fftconv.h"
+#include "kernels.h"
+
+#define NIN  3
+#define NOUT 2
+#define LEN  3000
+
+static unsigned int seed = 1;
+
+// reproducible noise in [-1, 1)
+static float noise(void)
+{
+  seed = seed * 1664525 + 1013904223;
+  return (int)(seed >> 8) / (float)(1 << 23) - 1;
+}
+
+/* Filter LEN samples of noise with taps of each length and delay through
+   fftconv, feeding it chunks of varying size, and return the largest
+   difference to the direct convolution in double precision. */
+static double test(int block, int taps, int delay)
+{
+  static float in[NIN][LEN], out[NOUT][LEN], w[NIN][NOUT][LEN];
+  const float* inp[NIN];
+  float* outp[NOUT];
+  double err = 0;
+  af_fftconv_t* c = af_fftconv_init(block, NIN, NOUT, taps + delay);
+  int i, o, n, k, done;
+
+  if (!c)
+    return INFINITY;
+  for (i = 0; i < NIN; i++)
+    for (n = 0; n < LEN; n++)
+      in[i][n] = noise();
+  // one pair stays empty, one gets two filters added up
+  for (i = 0; i < NIN; i++)
+    for (o = 0; o < NOUT; o++) {
+      for (n = 0; n < taps; n++)
+        w[i][o][n] = (i == 2 && o == 0) ? 0 : noise() / taps;
+      if (i == 2 && o == 0)
+        continue;
+      if (af_fftconv_add(c, i, o, w[i][o], taps, delay, 0.5) < 0 ||
+          af_fftconv_add(c, i, o, w[i][o], taps, delay, 0.5) < 0) {
+        af_fftconv_free(c);
+        return INFINITY;
+      }
+    }
+
+  for (done = 0, k = 1; done < LEN; done += n, k = k * 7 % 101) {
+    n = FFMIN(k * block / 13 + 1, LEN - done);
+    for (i = 0; i < NIN; i++)
+      inp[i] = in[i] + done;
+    for (o = 0; o < NOUT; o++)
+      outp[o] = out[o] + done;
+    af_fftconv_process(c, inp, outp, n);
+  }
+  af_fftconv_free(c);
+
+  for (o = 0; o < NOUT; o++)
+    for (n = 0; n < LEN; n++) {
+      double y = 0;
+      for (i = 0; i < NIN; i++)
+        for (k = 0; k < taps && k + delay <= n; k++)
+          y += (double)w[i][o][k] * in[i][n - delay - k];
+      err = FFMAX(err, fabs(y - out[o][n]));
+    }
+  return err;
+}
+
+int main(void)
+{
+  static const int cases[][3] = {
+    // block, taps, delay
+    {   4,    1,   0 },
+    {   4,   13,   3 },
+    {  16,   16,   0 },
+    {  16,  100,  17 },
+    {  64,  129,   0 },
+    { 256,  128,  40 },
+    { 256, 1000, 500 },
+  };
+  int i, bad = 0;
+
+  GetCpuCaps(&gCpuCaps);
+  af_kernels_init();
+  for (i = 0; i < FF_ARRAY_ELEMS(cases); i++) {
+    double err = test(cases[i][0], cases[i][1], cases[i][2]);
+    int ok = err < 1e-5;
+    printf("block %4d taps %4d delay %3d: max error %g%s\n",
+           cases[i][0], cases[i][1], cases[i][2], err, ok ? "" : " FAILED");
+    bad |= !ok;
+  }
+  return bad;
+}
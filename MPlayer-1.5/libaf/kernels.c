@@ -0,0 +1,570 @@
+/*
+ * CPU dispatched inner loops of the audio filters
+ *
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <inttypes.h>
+#include <math.h>
+
+#include "config.h"
+#include "libavutil/common.h"
+#include "cpudetect.h"
+#include "mp_msg.h"
+#include "kernels.h"
+
+/* The SIMD versions handle the bulk of the data and leave the tail to
+   the C version. They give the same results as the C version, except
+   for dot_float and the sum of min_max_sumsq, which sum in a different
+   order. */
+
+static void float_to_s16_C(int16_t* out, const float* in, int len)
+{
+#if HAVE_NEON && !ARCH_AARCH64
+  const float *in_end = in + len;
+  while (in < in_end - 7) {
+    __asm__(
+        "vld1.32 {q0,q1}, [%0]!\n\t"
+        "vcvt.s32.f32 q0, q0, #31\n\t"
+        "vqrshrn.s32  d0, q0, #15\n\t"
+        "vcvt.s32.f32 q1, q1, #31\n\t"
+        "vqrshrn.s32  d1, q1, #15\n\t"
+        "vst1.16 {q0}, [%1]!\n\t"
+    : "+r"(in), "+r"(out)
+    :: "q0", "q1", "memory");
+  }
+  while (in < in_end) {
+    __asm__(
+        "vld1.32 {d0[0]}, [%0]!\n\t"
+        "vcvt.s32.f32 d0, d0, #31\n\t"
+        "vqrshrn.s32  d0, q0, #15\n\t"
+        "vst1.16 {d0[0]}, [%1]!\n\t"
+    : "+r"(in), "+r"(out)
+    :: "d0", "memory");
+  }
+#else
+  int i;
+  for (i = 0; i < len; i++)
+    out[i] = av_clip_int16(lrintf(32768.0f * in[i]));
+#endif
+}
+
+static void s16_to_float_C(float* out, const int16_t* in, int len)
+{
+  int i;
+  for (i = 0; i < len; i++)
+    out[i] = (1.0f / 32768.0f) * in[i];
+}
+
+static void scale_clip_float_C(float* a, int len, float level)
+{
+  int i;
+#if HAVE_NEON && !ARCH_AARCH64
+  if (len >= 8)
+  {
+    __asm__(
+      "vmov.32 d2[0], %2\n\t"
+      "vdup.32 q8, %3\n\t"
+      "vneg.f32 q9, q8\n\t"
+"0:\n\t"
+      "vld1.32 {q0}, [%0]\n\t"
+      "vmul.f32 q0, q0, d2[0]\n\t"
+      "cmp %0, %1\n\t"
+      "vmin.f32 q0, q0, q8\n\t"
+      "vmax.f32 q0, q0, q9\n\t"
+      "vst1.32 {q0}, [%0]!\n\t"
+      "blo 0b\n\t"
+    : "+&r"(a)
+    : "r"(a + len - 7), "r"(level), "r"(0x3f800000)
+    : "cc", "q0", "d2", "q8", "q9", "memory");
+    len &= 3;
+  }
+#endif
+  for (i = 0; i < len; i++)
+    a[i] = av_clipf(a[i] * level, -1.0, 1.0);
+}
+
+static float dot_float_C(const float* a, const float* b, int len)
+{
+  float sum = 0;
+  int i;
+  for (i = 0; i < len; i++)
+    sum += a[i] * b[i];
+  return sum;
+}
+
+static void cmac_C(AVComplexFloat* acc, const AVComplexFloat* x,
+                   const AVComplexFloat* h, int len)
+{
+  int i;
+  for (i = 0; i < len; i++) {
+    acc[i].re += x[i].re * h[i].re - x[i].im * h[i].im;
+    acc[i].im += x[i].re * h[i].im + x[i].im * h[i].re;
+  }
+}
+
+static float peak_4x_C(const float* x, const float* h, int len)
+{
+  float peak = 0;
+  int i, p, j;
+  for (i = 0; i < len; i++)
+    for (p = 0; p < 4; p++) {
+      float y = 0;
+      for (j = 0; j < 12; j++)
+        y += h[p * 12 + j] * x[i - j];
+      peak = FFMAX(peak, fabsf(y));
+    }
+  return peak;
+}
+
+static void gain_clip_float_C(float* out, const float* in, int len, const float* g)
+{
+  int i;
+  for (i = 0; i < len; i++)
+    out[i] = av_clipf(in[i] * g[i & 3], -1.0f, 1.0f);
+}
+
+static void gain_clip_s16_C(int16_t* out, const float* in, int len, const float* g)
+{
+  int i;
+  for (i = 0; i < len; i++)
+    out[i] = av_clip_int16(lrintf(32768.0f * av_clipf(in[i] * g[i & 3], -1.0f, 1.0f)));
+}
+
+static float min_max_sumsq_C(const float* x, int len, float* min, float* max)
+{
+  float lo = *min, hi = *max, sumsq = 0;
+  int i;
+  for (i = 0; i < len; i++) {
+    lo     = FFMIN(lo, x[i]);
+    hi     = FFMAX(hi, x[i]);
+    sumsq += x[i] * x[i];
+  }
+  *min = lo;
+  *max = hi;
+  return sumsq;
+}
+
+#if HAVE_EMMINTRIN_H
+#include <emmintrin.h>
+
+ATTR_TARGET_SSE2
+static void float_to_s16_SSE2(int16_t* out, const float* in, int len)
+{
+  const __m128 k = _mm_set1_ps(32768.0f);
+  int i;
+  // cvtps rounds like lrintf, packs saturates like av_clip_int16
+  for (i = 0; i < len - 7; i += 8) {
+    __m128i l = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i), k));
+    __m128i h = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i + 4), k));
+    _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(l, h));
+  }
+  float_to_s16_C(out + i, in + i, len - i);
+}
+
+ATTR_TARGET_SSE2
+static void s16_to_float_SSE2(float* out, const int16_t* in, int len)
+{
+  const __m128 k = _mm_set1_ps(1.0f / 32768.0f);
+  int i;
+  for (i = 0; i < len - 7; i += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+    __m128i l = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+    __m128i h = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+    _mm_storeu_ps(out + i,     _mm_mul_ps(_mm_cvtepi32_ps(l), k));
+    _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(h), k));
+  }
+  s16_to_float_C(out + i, in + i, len - i);
+}
+
+ATTR_TARGET_SSE2
+static void scale_clip_float_SSE2(float* a, int len, float level)
+{
+  const __m128 l  = _mm_set1_ps(level);
+  const __m128 hi = _mm_set1_ps(1.0f);
+  const __m128 lo = _mm_set1_ps(-1.0f);
+  int i;
+  for (i = 0; i < len - 3; i += 4) {
+    __m128 x = _mm_mul_ps(_mm_loadu_ps(a + i), l);
+    _mm_storeu_ps(a + i, _mm_min_ps(_mm_max_ps(x, lo), hi));
+  }
+  scale_clip_float_C(a + i, len - i, level);
+}
+
+ATTR_TARGET_SSE2
+static float dot_float_SSE2(const float* a, const float* b, int len)
+{
+  __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+  float t[4];
+  int i;
+  for (i = 0; i < len - 7; i += 8) {
+    s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i),     _mm_loadu_ps(b + i)));
+    s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+  }
+  _mm_storeu_ps(t, _mm_add_ps(s0, s1));
+  return t[0] + t[1] + t[2] + t[3] + dot_float_C(a + i, b + i, len - i);
+}
+
+ATTR_TARGET_SSE2
+static void cmac_SSE2(AVComplexFloat* acc, const AVComplexFloat* x,
+                      const AVComplexFloat* h, int len)
+{
+  const __m128 sign = _mm_setr_ps(-1.0f, 1.0f, -1.0f, 1.0f);
+  int i;
+  for (i = 0; i < len - 1; i += 2) {
+    __m128 a  = _mm_loadu_ps(&x[i].re);
+    __m128 b  = _mm_loadu_ps(&h[i].re);
+    __m128 re = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 2, 0, 0));
+    __m128 im = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 1, 1));
+    __m128 bs = _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 y  = _mm_add_ps(_mm_mul_ps(re, b), _mm_mul_ps(_mm_mul_ps(im, bs), sign));
+    _mm_storeu_ps(&acc[i].re, _mm_add_ps(_mm_loadu_ps(&acc[i].re), y));
+  }
+  cmac_C(acc + i, x + i, h + i, len - i);
+}
+
+ATTR_TARGET_SSE2
+static float peak_4x_SSE2(const float* x, const float* h, int len)
+{
+  const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  __m128 peak = _mm_setzero_ps();
+  float t[4];
+  int i, p, j;
+  for (i = 0; i < len - 3; i += 4) {
+    __m128 v[12];
+    for (j = 0; j < 12; j++)
+      v[j] = _mm_loadu_ps(x + i - j);
+    for (p = 0; p < 4; p++) {
+      __m128 y = _mm_setzero_ps();
+      for (j = 0; j < 12; j++)
+        y = _mm_add_ps(y, _mm_mul_ps(_mm_set1_ps(h[p * 12 + j]), v[j]));
+      peak = _mm_max_ps(peak, _mm_and_ps(y, mask));
+    }
+  }
+  _mm_storeu_ps(t, peak);
+  return FFMAX(FFMAX(FFMAX(t[0], t[1]), FFMAX(t[2], t[3])),
+               peak_4x_C(x + i, h, len - i));
+}
+
+/* The gain vector repeats every four samples, i must stay a multiple of
+   four for the C version to pick up the tail with the right gains. */
+
+ATTR_TARGET_SSE2
+static void gain_clip_float_SSE2(float* out, const float* in, int len, const float* g)
+{
+  const __m128 gv   = _mm_loadu_ps(g);
+  const __m128 one  = _mm_set1_ps(1.0f);
+  const __m128 mone = _mm_set1_ps(-1.0f);
+  int i;
+  for (i = 0; i < len - 3; i += 4) {
+    __m128 x = _mm_mul_ps(_mm_loadu_ps(in + i), gv);
+    _mm_storeu_ps(out + i, _mm_max_ps(_mm_min_ps(x, one), mone));
+  }
+  gain_clip_float_C(out + i, in + i, len - i, g);
+}
+
+ATTR_TARGET_SSE2
+static void gain_clip_s16_SSE2(int16_t* out, const float* in, int len, const float* g)
+{
+  const __m128 gv   = _mm_loadu_ps(g);
+  const __m128 one  = _mm_set1_ps(1.0f);
+  const __m128 mone = _mm_set1_ps(-1.0f);
+  const __m128 k    = _mm_set1_ps(32768.0f);
+  int i;
+  for (i = 0; i < len - 7; i += 8) {
+    __m128 x0 = _mm_mul_ps(_mm_loadu_ps(in + i),     gv);
+    __m128 x1 = _mm_mul_ps(_mm_loadu_ps(in + i + 4), gv);
+    x0 = _mm_mul_ps(_mm_max_ps(_mm_min_ps(x0, one), mone), k);
+    x1 = _mm_mul_ps(_mm_max_ps(_mm_min_ps(x1, one), mone), k);
+    // rounds to nearest like lrintf, the pack saturates +32768
+    _mm_storeu_si128((__m128i*)(out + i),
+                     _mm_packs_epi32(_mm_cvtps_epi32(x0), _mm_cvtps_epi32(x1)));
+  }
+  gain_clip_s16_C(out + i, in + i, len - i, g);
+}
+
+ATTR_TARGET_SSE2
+static float min_max_sumsq_SSE2(const float* x, int len, float* min, float* max)
+{
+  __m128 vmin = _mm_set1_ps(*min);
+  __m128 vmax = _mm_set1_ps(*max);
+  __m128 vsq  = _mm_setzero_ps();
+  float t[4];
+  int i;
+  for (i = 0; i < len - 7; i += 8) {
+    __m128 x0 = _mm_loadu_ps(x + i);
+    __m128 x1 = _mm_loadu_ps(x + i + 4);
+    vmin = _mm_min_ps(vmin, _mm_min_ps(x0, x1));
+    vmax = _mm_max_ps(vmax, _mm_max_ps(x0, x1));
+    vsq  = _mm_add_ps(vsq, _mm_add_ps(_mm_mul_ps(x0, x0), _mm_mul_ps(x1, x1)));
+  }
+  vmin = _mm_min_ps(vmin, _mm_movehl_ps(vmin, vmin));
+  vmin = _mm_min_ss(vmin, _mm_shuffle_ps(vmin, vmin, 1));
+  vmax = _mm_max_ps(vmax, _mm_movehl_ps(vmax, vmax));
+  vmax = _mm_max_ss(vmax, _mm_shuffle_ps(vmax, vmax, 1));
+  _mm_store_ss(min, vmin);
+  _mm_store_ss(max, vmax);
+  _mm_storeu_ps(t, vsq);
+  return t[0] + t[1] + t[2] + t[3] + min_max_sumsq_C(x + i, len - i, min, max);
+}
+#endif /* HAVE_EMMINTRIN_H */
+
+#if HAVE_IMMINTRIN_H
+#include <immintrin.h>
+
+ATTR_TARGET_AVX2
+static void float_to_s16_AVX2(int16_t* out, const float* in, int len)
+{
+  const __m256 k = _mm256_set1_ps(32768.0f);
+  int i;
+  for (i = 0; i < len - 15; i += 16) {
+    __m256i l = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(in + i), k));
+    __m256i h = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(in + i + 8), k));
+    // packs works per 128 bit lane, put the quadwords back in order
+    __m256i p = _mm256_permute4x64_epi64(_mm256_packs_epi32(l, h),
+                                         _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256((__m256i*)(out + i), p);
+  }
+  float_to_s16_C(out + i, in + i, len - i);
+}
+
+ATTR_TARGET_AVX2
+static void s16_to_float_AVX2(float* out, const int16_t* in, int len)
+{
+  const __m256 k = _mm256_set1_ps(1.0f / 32768.0f);
+  int i;
+  for (i = 0; i < len - 15; i += 16) {
+    __m256i l = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i)));
+    __m256i h = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i + 8)));
+    _mm256_storeu_ps(out + i,     _mm256_mul_ps(_mm256_cvtepi32_ps(l), k));
+    _mm256_storeu_ps(out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(h), k));
+  }
+  s16_to_float_C(out + i, in + i, len - i);
+}
+
+ATTR_TARGET_AVX2
+static void scale_clip_float_AVX2(float* a, int len, float level)
+{
+  const __m256 l  = _mm256_set1_ps(level);
+  const __m256 hi = _mm256_set1_ps(1.0f);
+  const __m256 lo = _mm256_set1_ps(-1.0f);
+  int i;
+  for (i = 0; i < len - 7; i += 8) {
+    __m256 x = _mm256_mul_ps(_mm256_loadu_ps(a + i), l);
+    _mm256_storeu_ps(a + i, _mm256_min_ps(_mm256_max_ps(x, lo), hi));
+  }
+  scale_clip_float_C(a + i, len - i, level);
+}
+
+ATTR_TARGET_AVX2
+static float dot_float_AVX2(const float* a, const float* b, int len)
+{
+  __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+  __m128 s;
+  int i;
+  for (i = 0; i < len - 15; i += 16) {
+    s0 = _mm256_add_ps(s0, _mm256_mul_ps(_mm256_loadu_ps(a + i),     _mm256_loadu_ps(b + i)));
+    s1 = _mm256_add_ps(s1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+  }
+  s0 = _mm256_add_ps(s0, s1);
+  s  = _mm_add_ps(_mm256_castps256_ps128(s0), _mm256_extractf128_ps(s0, 1));
+  s  = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s  = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  return _mm_cvtss_f32(s) + dot_float_C(a + i, b + i, len - i);
+}
+
+ATTR_TARGET_AVX2
+static void cmac_AVX2(AVComplexFloat* acc, const AVComplexFloat* x,
+                      const AVComplexFloat* h, int len)
+{
+  int i;
+  for (i = 0; i < len - 3; i += 4) {
+    __m256 a  = _mm256_loadu_ps(&x[i].re);
+    __m256 b  = _mm256_loadu_ps(&h[i].re);
+    __m256 re = _mm256_moveldup_ps(a);
+    __m256 im = _mm256_movehdup_ps(a);
+    __m256 bs = _mm256_permute_ps(b, _MM_SHUFFLE(2, 3, 0, 1));
+    // even lanes re * h.re - im * h.im, odd lanes re * h.im + im * h.re
+    __m256 y  = _mm256_addsub_ps(_mm256_mul_ps(re, b), _mm256_mul_ps(im, bs));
+    _mm256_storeu_ps(&acc[i].re, _mm256_add_ps(_mm256_loadu_ps(&acc[i].re), y));
+  }
+  cmac_C(acc + i, x + i, h + i, len - i);
+}
+
+ATTR_TARGET_AVX2
+static float peak_4x_AVX2(const float* x, const float* h, int len)
+{
+  const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  __m256 peak = _mm256_setzero_ps();
+  __m128 m;
+  int i, p, j;
+  for (i = 0; i < len - 7; i += 8) {
+    __m256 v[12];
+    for (j = 0; j < 12; j++)
+      v[j] = _mm256_loadu_ps(x + i - j);
+    for (p = 0; p < 4; p++) {
+      __m256 y = _mm256_setzero_ps();
+      for (j = 0; j < 12; j++)
+        y = _mm256_add_ps(y, _mm256_mul_ps(_mm256_set1_ps(h[p * 12 + j]), v[j]));
+      peak = _mm256_max_ps(peak, _mm256_and_ps(y, mask));
+    }
+  }
+  m = _mm_max_ps(_mm256_castps256_ps128(peak), _mm256_extractf128_ps(peak, 1));
+  m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+  m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+  return FFMAX(_mm_cvtss_f32(m), peak_4x_C(x + i, h, len - i));
+}
+#endif /* HAVE_IMMINTRIN_H */
+
+#if HAVE_INTRINSICS_NEON && ARCH_AARCH64
+#include <arm_neon.h>
+
+static void float_to_s16_NEON(int16_t* out, const float* in, int len)
+{
+  const float32x4_t k = vdupq_n_f32(32768.0f);
+  int i;
+  for (i = 0; i < len - 7; i += 8) {
+    int32x4_t l = vcvtnq_s32_f32(vmulq_f32(vld1q_f32(in + i), k));
+    int32x4_t h = vcvtnq_s32_f32(vmulq_f32(vld1q_f32(in + i + 4), k));
+    vst1q_s16(out + i, vcombine_s16(vqmovn_s32(l), vqmovn_s32(h)));
+  }
+  float_to_s16_C(out + i, in + i, len - i);
+}
+
+static void s16_to_float_NEON(float* out, const int16_t* in, int len)
+{
+  int i;
+  for (i = 0; i < len - 7; i += 8) {
+    int16x8_t x = vld1q_s16(in + i);
+    vst1q_f32(out + i,     vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))),
+                                       1.0f / 32768.0f));
+    vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))),
+                                       1.0f / 32768.0f));
+  }
+  s16_to_float_C(out + i, in + i, len - i);
+}
+
+static void scale_clip_float_NEON(float* a, int len, float level)
+{
+  const float32x4_t hi = vdupq_n_f32(1.0f);
+  const float32x4_t lo = vdupq_n_f32(-1.0f);
+  int i;
+  for (i = 0; i < len - 3; i += 4) {
+    float32x4_t x = vmulq_n_f32(vld1q_f32(a + i), level);
+    vst1q_f32(a + i, vminq_f32(vmaxq_f32(x, lo), hi));
+  }
+  scale_clip_float_C(a + i, len - i, level);
+}
+
+static float dot_float_NEON(const float* a, const float* b, int len)
+{
+  float32x4_t s0 = vdupq_n_f32(0), s1 = vdupq_n_f32(0);
+  int i;
+  for (i = 0; i < len - 7; i += 8) {
+    s0 = vmlaq_f32(s0, vld1q_f32(a + i),     vld1q_f32(b + i));
+    s1 = vmlaq_f32(s1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+  }
+  return vaddvq_f32(vaddq_f32(s0, s1)) + dot_float_C(a + i, b + i, len - i);
+}
+
+static void cmac_NEON(AVComplexFloat* acc, const AVComplexFloat* x,
+                      const AVComplexFloat* h, int len)
+{
+  int i;
+  for (i = 0; i < len - 3; i += 4) {
+    float32x4x2_t a = vld2q_f32(&x[i].re);
+    float32x4x2_t b = vld2q_f32(&h[i].re);
+    float32x4x2_t y = vld2q_f32(&acc[i].re);
+    y.val[0] = vmlaq_f32(y.val[0], a.val[0], b.val[0]);
+    y.val[0] = vmlsq_f32(y.val[0], a.val[1], b.val[1]);
+    y.val[1] = vmlaq_f32(y.val[1], a.val[0], b.val[1]);
+    y.val[1] = vmlaq_f32(y.val[1], a.val[1], b.val[0]);
+    vst2q_f32(&acc[i].re, y);
+  }
+  cmac_C(acc + i, x + i, h + i, len - i);
+}
+
+static float peak_4x_NEON(const float* x, const float* h, int len)
+{
+  float32x4_t peak = vdupq_n_f32(0);
+  int i, p, j;
+  for (i = 0; i < len - 3; i += 4) {
+    float32x4_t v[12];
+    for (j = 0; j < 12; j++)
+      v[j] = vld1q_f32(x + i - j);
+    for (p = 0; p < 4; p++) {
+      float32x4_t y = vdupq_n_f32(0);
+      for (j = 0; j < 12; j++)
+        y = vmlaq_n_f32(y, v[j], h[p * 12 + j]);
+      peak = vmaxq_f32(peak, vabsq_f32(y));
+    }
+  }
+  return FFMAX(vmaxvq_f32(peak), peak_4x_C(x + i, h, len - i));
+}
+#endif /* HAVE_INTRINSICS_NEON && ARCH_AARCH64 */
+
+af_kernels_t af_kernels = {
+  float_to_s16_C,
+  s16_to_float_C,
+  scale_clip_float_C,
+  dot_float_C,
+  cmac_C,
+  peak_4x_C,
+  gain_clip_float_C,
+  gain_clip_s16_C,
+  min_max_sumsq_C,
+};
+
+void af_kernels_init(void)
+{
+  const char* isa = "C";
+#if HAVE_EMMINTRIN_H
+  if (gCpuCaps.hasSSE2) {
+    af_kernels.float_to_s16     = float_to_s16_SSE2;
+    af_kernels.s16_to_float     = s16_to_float_SSE2;
+    af_kernels.scale_clip_float = scale_clip_float_SSE2;
+    af_kernels.dot_float        = dot_float_SSE2;
+    af_kernels.cmac             = cmac_SSE2;
+    af_kernels.peak_4x          = peak_4x_SSE2;
+    af_kernels.gain_clip_float  = gain_clip_float_SSE2;
+    af_kernels.gain_clip_s16    = gain_clip_s16_SSE2;
+    af_kernels.min_max_sumsq    = min_max_sumsq_SSE2;
+    isa = "SSE2";
+  }
+#endif
+#if HAVE_IMMINTRIN_H
+  if (gCpuCaps.hasAVX2) {
+    af_kernels.float_to_s16     = float_to_s16_AVX2;
+    af_kernels.s16_to_float     = s16_to_float_AVX2;
+    af_kernels.scale_clip_float = scale_clip_float_AVX2;
+    af_kernels.dot_float        = dot_float_AVX2;
+    af_kernels.cmac             = cmac_AVX2;
+    af_kernels.peak_4x          = peak_4x_AVX2;
+    isa = "AVX2";
+  }
+#endif
+#if HAVE_INTRINSICS_NEON && ARCH_AARCH64
+  af_kernels.float_to_s16     = float_to_s16_NEON;
+  af_kernels.s16_to_float     = s16_to_float_NEON;
+  af_kernels.scale_clip_float = scale_clip_float_NEON;
+  af_kernels.dot_float        = dot_float_NEON;
+  af_kernels.cmac             = cmac_NEON;
+  af_kernels.peak_4x          = peak_4x_NEON;
+  isa = "NEON";
+#endif
+  mp_msg(MSGT_AFILTER, MSGL_V, "[libaf] Using %s kernels\n", isa);
+}
@@ -0,0 +1,62 @@
+/*
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Inner loops shared by the audio filters. Each kernel has a plain C
+   version and, where it pays off, versions for SIMD extensions that are
+   compiled with per-function target attributes, so they need neither
+   runtime CPU detection for the whole binary nor -march. The best
+   version for the CPU in gCpuCaps is chosen once by af_kernels_init().
+   kernels.c is built with -O3 even when the rest is optimized for size.
+*/
+
+#ifndef MPLAYER_KERNELS_H
+#define MPLAYER_KERNELS_H
+
+#include <stdint.h>
+#include "libavutil/tx.h"
+
+typedef struct af_kernels_s
+{
+  // out[i] = clip(round(in[i] * 32768))
+  void (*float_to_s16)(int16_t* out, const float* in, int len);
+  // out[i] = in[i] / 32768
+  void (*s16_to_float)(float* out, const int16_t* in, int len);
+  // a[i] = clip(a[i] * level, -1, 1)
+  void (*scale_clip_float)(float* a, int len, float level);
+  // Sum of a[i] * b[i]
+  float (*dot_float)(const float* a, const float* b, int len);
+  // acc[i] += x[i] * h[i] for complex numbers
+  void (*cmac)(AVComplexFloat* acc, const AVComplexFloat* x,
+               const AVComplexFloat* h, int len);
+  // Largest magnitude of x upsampled 4 times, h holds the 12 taps of
+  // each of the 4 phases, applied to x[i] ... x[i - 11]
+  float (*peak_4x)(const float* x, const float* h, int len);
+  // out[i] = clip(in[i] * g[i % 4], -1, 1), may work in place
+  void (*gain_clip_float)(float* out, const float* in, int len, const float* g);
+  // out[i] = clip(round(clip(in[i] * g[i % 4], -1, 1) * 32768))
+  void (*gain_clip_s16)(int16_t* out, const float* in, int len, const float* g);
+  // Lower *min and raise *max to the extremes of x, returns the sum of x[i]^2
+  float (*min_max_sumsq)(const float* x, int len, float* min, float* max);
+} af_kernels_t;
+
+extern af_kernels_t af_kernels;
+
+// Select the kernels for gCpuCaps, call after GetCpuCaps()
+void af_kernels_init(void);
+
+#endif /* MPLAYER_KERNELS_H */
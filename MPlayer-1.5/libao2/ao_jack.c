@@ -27,6 +27,7 @@
 #include <unistd.h>
 
 #include "config.h"
+#include "mp_mem.h"
 #include "mp_msg.h"
 #include "help_mp.h"
 
@@ -243,6 +244,8 @@ static int init(int rate, int channels, int format, int flags) {
     goto err_out;
   }
   buffer = av_fifo_alloc(BUFFSIZE);
+  if (buffer)
+    mp_mem_account(MP_MEM_AO, BUFFSIZE);
   jack_set_process_callback(client, outputaudio, 0);
 
   // list matching ports if connections should be made
@@ -302,6 +305,8 @@ err_out:
   free(client_name);
   if (client)
     jack_client_close(client);
+  if (buffer)
+    mp_mem_account(MP_MEM_AO, -BUFFSIZE);
   av_fifo_free(buffer);
   buffer = NULL;
   return 0;
@@ -315,6 +320,8 @@ static void uninit(int immed) {
   reset();
   usec_sleep(100 * 1000);
   jack_client_close(client);
+  if (buffer)
+    mp_mem_account(MP_MEM_AO, -BUFFSIZE);
   av_fifo_free(buffer);
   buffer = NULL;
 }
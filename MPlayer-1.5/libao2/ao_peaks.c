@@ -0,0 +1,298 @@
+/*
+ * waveform peak file writer audio output
+ *
+ * Decodes as fast as possible and writes min/max/RMS buckets at several
+ * resolutions instead of the samples, e.g. for waveform thumbnails.
+ *
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * File layout, all values little-endian:
+ *   "MPPEAKS1"
+ *   u32 samplerate, u32 channels, u64 sample frames, u32 level count
+ *   per level: u32 frames per bucket, u32 bucket count,
+ *              bucket count * (s16 min, s16 max, u16 rms)
+ * Level 0 has the finest resolution, each further level merges
+ * PEAKS_LEVEL_FACTOR buckets of the previous one. All channels are
+ * combined into one bucket.
+ */
+
+#include "config.h"
+
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "libavutil/common.h"
+#include "subopt-helper.h"
+#include "libaf/af_format.h"
+#include "libaf/kernels.h"
+#include "audio_out.h"
+#include "audio_out_internal.h"
+#include "mp_msg.h"
+
+static const ao_info_t info =
+{
+    "Waveform peak file writer audio output",
+    "peaks",
+    "",
+    ""
+};
+
+LIBAO_EXTERN(peaks)
+
+#define PEAKS_MAGIC        "MPPEAKS1"
+#define PEAKS_LEVEL_FACTOR 4
+#define PEAKS_MAX_LEVELS   16
+
+typedef struct {
+    float min, max;
+    double sumsq;
+} peak_bucket_t;
+
+static char *peaks_filename;
+static int spb;     ///< sample frames per bucket at level 0
+static int levels;  ///< maximum number of levels
+static int width;   ///< stop at the first level with at most this many buckets
+
+static peak_bucket_t *buckets;
+static int num_buckets, max_buckets;
+static peak_bucket_t cur;
+static int cur_samples;
+static uint64_t frames;
+
+static void scan(const float *s, int n, peak_bucket_t *b)
+{
+    b->sumsq += af_kernels.min_max_sumsq(s, n, &b->min, &b->max);
+}
+
+static void bucket_reset(peak_bucket_t *b)
+{
+    b->min   =  FLT_MAX;
+    b->max   = -FLT_MAX;
+    b->sumsq = 0;
+}
+
+static void bucket_merge(peak_bucket_t *dst, const peak_bucket_t *src)
+{
+    dst->min    = FFMIN(dst->min, src->min);
+    dst->max    = FFMAX(dst->max, src->max);
+    dst->sumsq += src->sumsq;
+}
+
+static void push_bucket(void)
+{
+    if (!cur_samples)
+        return;
+    if (num_buckets == max_buckets) {
+        peak_bucket_t *tmp;
+        max_buckets = FFMAX(2 * max_buckets, 1024);
+        tmp = realloc(buckets, max_buckets * sizeof(*buckets));
+        if (!tmp) {
+            mp_msg(MSGT_AO, MSGL_ERR, "[AO PEAKS] Out of memory, peaks are truncated.\n");
+            max_buckets = num_buckets;
+            cur_samples = 0;
+            return;
+        }
+        buckets = tmp;
+    }
+    // store the mean square, merged buckets then only need to average it
+    cur.sumsq /= cur_samples;
+    buckets[num_buckets++] = cur;
+    bucket_reset(&cur);
+    cur_samples = 0;
+}
+
+static void put32le(uint32_t val, FILE *fp)
+{
+    uint8_t bytes[4] = {val, val >> 8, val >> 16, val >> 24};
+    fwrite(bytes, 1, 4, fp);
+}
+
+static void put16le(uint16_t val, FILE *fp)
+{
+    uint8_t bytes[2] = {val, val >> 8};
+    fwrite(bytes, 1, 2, fp);
+}
+
+static void write_level(FILE *fp, const peak_bucket_t *b, int n, int frames_per_bucket)
+{
+    int i;
+    put32le(frames_per_bucket, fp);
+    put32le(n, fp);
+    for (i = 0; i < n; i++) {
+        put16le(av_clip_int16(lrintf(b[i].min * 32767)), fp);
+        put16le(av_clip_int16(lrintf(b[i].max * 32767)), fp);
+        put16le(av_clip(lrint(sqrt(b[i].sumsq) * 32767), 0, 65535), fp);
+    }
+}
+
+/**
+ * Writes level 0 and builds each coarser level in place from the one
+ * before it, so no extra memory is needed.
+ */
+static void write_peaks(void)
+{
+    int n = num_buckets, fpb = spb, nlevels = 1, i, j;
+    FILE *fp;
+
+    // count the levels first, the header needs the number
+    while (nlevels < levels && n > 1 && (!width || n > width)) {
+        n = (n + PEAKS_LEVEL_FACTOR - 1) / PEAKS_LEVEL_FACTOR;
+        nlevels++;
+    }
+
+    fp = fopen(peaks_filename, "wb");
+    if (!fp) {
+        mp_msg(MSGT_AO, MSGL_ERR, "[AO PEAKS] Cannot open %s for writing.\n", peaks_filename);
+        return;
+    }
+    fwrite(PEAKS_MAGIC, 1, 8, fp);
+    put32le(ao_data.samplerate, fp);
+    put32le(ao_data.channels, fp);
+    put32le(frames, fp);
+    put32le(frames >> 32, fp);
+    put32le(nlevels, fp);
+
+    n = num_buckets;
+    write_level(fp, buckets, n, fpb);
+    for (i = 1; i < nlevels; i++) {
+        int m = (n + PEAKS_LEVEL_FACTOR - 1) / PEAKS_LEVEL_FACTOR;
+        for (j = 0; j < m; j++) {
+            int k, cnt = FFMIN(PEAKS_LEVEL_FACTOR, n - j * PEAKS_LEVEL_FACTOR);
+            peak_bucket_t b = buckets[j * PEAKS_LEVEL_FACTOR];
+            for (k = 1; k < cnt; k++)
+                bucket_merge(&b, &buckets[j * PEAKS_LEVEL_FACTOR + k]);
+            b.sumsq /= cnt;
+            buckets[j] = b;
+        }
+        n    = m;
+        fpb *= PEAKS_LEVEL_FACTOR;
+        write_level(fp, buckets, n, fpb);
+    }
+    if (fclose(fp))
+        mp_msg(MSGT_AO, MSGL_ERR, "[AO PEAKS] Error writing %s.\n", peaks_filename);
+    else
+        mp_msg(MSGT_AO, MSGL_INFO, "[AO PEAKS] Wrote %d levels, %d buckets of %d frames at level 0 to %s.\n",
+               nlevels, num_buckets, spb, peaks_filename);
+}
+
+// to set/get/query special features/parameters
+static int control(int cmd, void *arg)
+{
+    return -1;
+}
+
+// open & setup audio device
+// return: 1=success 0=fail
+static int init(int rate, int channels, int format, int flags)
+{
+    const opt_t subopts[] = {
+        {"file",   OPT_ARG_MSTRZ, &peaks_filename, NULL},
+        {"spb",    OPT_ARG_INT,   &spb,    int_pos},
+        {"levels", OPT_ARG_INT,   &levels, int_pos},
+        {"width",  OPT_ARG_INT,   &width,  int_non_neg},
+        {NULL}
+    };
+    // set defaults
+    spb    = 256;
+    levels = 8;
+    width  = 0;
+
+    if (subopt_parse(ao_subdevice, subopts) != 0)
+        return 0;
+    if (!peaks_filename)
+        peaks_filename = strdup("audiodump.peaks");
+    levels = FFMIN(levels, PEAKS_MAX_LEVELS);
+
+    ao_data.outburst   = 65536;
+    ao_data.buffersize = 2 * 65536;
+    ao_data.channels   = channels;
+    ao_data.samplerate = rate;
+    ao_data.format     = AF_FORMAT_FLOAT_NE;
+    ao_data.bps        = channels * rate * sizeof(float);
+
+    num_buckets = 0;
+    frames      = 0;
+    cur_samples = 0;
+    bucket_reset(&cur);
+    return 1;
+}
+
+// close audio device
+static void uninit(int immed)
+{
+    push_bucket();
+    write_peaks();
+    free(buckets);
+    buckets     = NULL;
+    max_buckets = 0;
+    free(peaks_filename);
+    peaks_filename = NULL;
+}
+
+// stop playing and empty buffers (for seeking/pause)
+static void reset(void)
+{
+}
+
+// stop playing, keep buffers (for pause)
+static void audio_pause(void)
+{
+}
+
+// resume playing, after audio_pause()
+static void audio_resume(void)
+{
+}
+
+// return: how many bytes can be played without blocking
+static int get_space(void)
+{
+    return ao_data.outburst;
+}
+
+// plays 'len' bytes of 'data'
+// return: number of bytes played
+static int play(void *data, int len, int flags)
+{
+    const float *s = data;
+    int samples = len / sizeof(float);
+    int bucket_samples = spb * ao_data.channels;
+
+    samples -= samples % ao_data.channels;
+    frames  += samples / ao_data.channels;
+    while (samples > 0) {
+        int n = FFMIN(samples, bucket_samples - cur_samples);
+        scan(s, n, &cur);
+        cur_samples += n;
+        s           += n;
+        samples     -= n;
+        if (cur_samples == bucket_samples)
+            push_bucket();
+    }
+    return (const char *)s - (const char *)data;
+}
+
+// return: delay in seconds between first and last sample in buffer
+static float get_delay(void)
+{
+    return 0.0;
+}
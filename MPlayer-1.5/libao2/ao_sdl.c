@@ -25,6 +25,7 @@
 #include <string.h>
 
 #include "config.h"
+#include "mp_mem.h"
 #include "mp_msg.h"
 #include "help_mp.h"
 
@@ -139,6 +140,8 @@ static int init(int rate,int channels,int format,int flags){
 
 	/* Allocate ring-buffer memory */
 	buffer = av_fifo_alloc(BUFFSIZE);
+	if (buffer)
+	  mp_mem_account(MP_MEM_AO, BUFFSIZE);
 
 	mp_msg(MSGT_AO,MSGL_INFO,MSGTR_AO_SDL_INFO, rate, (channels > 1) ? "Stereo" : "Mono", af_fmt2str_short(format));
 
@@ -254,6 +257,8 @@ static void uninit(int immed){
 	  usec_sleep(get_delay() * 1000 * 1000);
 	SDL_CloseAudio();
 	SDL_QuitSubSystem(SDL_INIT_AUDIO);
+	if (buffer)
+	  mp_mem_account(MP_MEM_AO, -BUFFSIZE);
 	av_fifo_free(buffer);
 }
 
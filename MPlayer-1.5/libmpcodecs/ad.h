@@ -52,4 +52,7 @@ extern const ad_functions_t * const mpcodecs_ad_drivers[];
 // fallback: use hw mixer in libao
 #define ADCTRL_SET_VOLUME 4 /* set volume (used for mp3lib and liba52) */
 
+// fallback: try to init the decoder
+#define ADCTRL_QUERY_CODEC 5 /* check that sh->codec can be opened, called before preinit */
+
 #endif /* MPLAYER_AD_H */
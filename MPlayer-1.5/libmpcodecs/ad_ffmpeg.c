@@ -211,6 +211,13 @@ static int control(sh_audio_t *sh,int cmd,void* arg, ...)
         avcodec_flush_buffers(lavc_context);
         ds_clear_parser(sh->ds);
     return CONTROL_TRUE;
+    case ADCTRL_QUERY_CODEC:
+        init_avcodec();
+        if (!avcodec_find_decoder_by_name(codec_idx2str(sh->codec->dll_idx))) {
+            mp_msg(MSGT_DECAUDIO,MSGL_ERR,MSGTR_MissingLAVCcodec,codec_idx2str(sh->codec->dll_idx));
+            return CONTROL_FALSE;
+        }
+    return CONTROL_TRUE;
     }
     return CONTROL_UNKNOWN;
 }
@@ -18,11 +18,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <assert.h>
+#include <limits.h>
+#include <math.h>
 
 #include "config.h"
+#include "mp_mem.h"
 #include "mp_msg.h"
+#include "mpcommon.h"
 #include "help_mp.h"
 
 #include "stream/stream.h"
@@ -47,6 +52,7 @@ int fakemono = 0;
 
 /* used for ac3surround decoder - set using -channels option */
 int audio_output_channels = 2;
+float audio_seek_buffer = 0; // seconds of decoded audio kept for seeking
 af_cfg_t af_cfg = { 1, NULL };	// Configuration for audio filters
 
 void afm_help(void)
@@ -68,6 +74,17 @@ void afm_help(void)
 		   mpcodecs_ad_drivers[i]->info->name);
 }
 
+/// Update the accounting after the decoder buffers changed.
+static void account_buffers(sh_audio_t *sh)
+{
+    int bytes = (sh->a_in_buffer ? sh->a_in_buffer_size : 0) +
+                (sh->a_buffer ? sh->a_buffer_size : 0) +
+                (sh->a_out_buffer ? sh->a_out_buffer_size : 0) +
+                (sh->seek_buf ? sh->seek_buf_size : 0);
+    mp_mem_account(MP_MEM_DECODER, bytes - sh->mem_accounted);
+    sh->mem_accounted = bytes;
+}
+
 static int init_audio_codec(sh_audio_t *sh_audio)
 {
     if ((af_cfg.force & AF_INIT_FORMAT_MASK) == AF_INIT_FLOAT) {
@@ -103,6 +120,7 @@ static int init_audio_codec(sh_audio_t *sh_audio)
 	return 0;
     }
     sh_audio->a_buffer_len = 0;
+    account_buffers(sh_audio);
 
     if (!sh_audio->ad_driver->init(sh_audio)) {
 	mp_msg(MSGT_DECAUDIO, MSGL_WARN, MSGTR_ADecoderInitFailed);
@@ -144,35 +162,103 @@ static int init_audio_codec(sh_audio_t *sh_audio)
     sh_audio->a_out_buffer_size = 0;
     sh_audio->a_out_buffer = NULL;
     sh_audio->a_out_buffer_len = 0;
+    // some decoders allocate their own input buffer
+    account_buffers(sh_audio);
+
+    return 1;
+}
 
+/* Codecs that may handle a stream, in codecs.conf order */
+typedef struct ad_candidates {
+    codecs_t **codec;
+    unsigned int *fourccmap;
+    int nr;
+} ad_candidates_t;
+
+static void free_candidates(ad_candidates_t *cand)
+{
+    free(cand->codec);
+    free(cand->fourccmap);
+    memset(cand, 0, sizeof(*cand));
+}
+
+/**
+ * \brief look the codecs for the stream up once
+ * \param force list all codecs, as for a forced codec name
+ */
+static int get_candidates(sh_audio_t *sh_audio, int force,
+			  ad_candidates_t *cand)
+{
+    unsigned int orig_fourcc = sh_audio->wf ? sh_audio->wf->wFormatTag : 0;
+    codecs_t *c = NULL;
+    int max;
+
+    memset(cand, 0, sizeof(*cand));
+    if (!force) {
+	max = find_codecs(sh_audio->format, 1, NULL, NULL, 0);
+	if (!max)
+	    return 1;
+	cand->codec     = malloc(max * sizeof(*cand->codec));
+	cand->fourccmap = malloc(max * sizeof(*cand->fourccmap));
+	if (!cand->codec || !cand->fourccmap) {
+	    free_candidates(cand);
+	    return 0;
+	}
+	cand->nr = find_codecs(sh_audio->format, 1, cand->codec,
+			       cand->fourccmap, max);
+	return 1;
+    }
+    // a forced codec is tried whatever its fourccs are
+    for (max = 0;; cand->nr++) {
+	unsigned int fourccmap = orig_fourcc;
+	if (!(c = find_audio_codec(sh_audio->format, &fourccmap, c, 1)))
+	    break;
+	if (cand->nr == max) {
+	    codecs_t **codec;
+	    unsigned int *map;
+	    max = max ? 2 * max : 64;
+	    codec = realloc(cand->codec, max * sizeof(*codec));
+	    if (codec)
+		cand->codec = codec;
+	    map = realloc(cand->fourccmap, max * sizeof(*map));
+	    if (map)
+		cand->fourccmap = map;
+	    if (!codec || !map) {
+		free_candidates(cand);
+		return 0;
+	    }
+	}
+	cand->codec[cand->nr] = c;
+	cand->fourccmap[cand->nr] = fourccmap;
+    }
     return 1;
 }
 
-static int init_audio(sh_audio_t *sh_audio, char *codecname, char *afm,
-		      int status, stringset_t *selected)
+static int init_audio(sh_audio_t *sh_audio, const ad_candidates_t *cand,
+		      char *codecname, char *afm, int status,
+		      stringset_t *selected)
 {
     unsigned int orig_fourcc = sh_audio->wf ? sh_audio->wf->wFormatTag : 0;
+    ad_candidates_t all = { 0 };
     int force = 0;
+    int n;
     if (codecname && codecname[0] == '+') {
 	codecname = &codecname[1];
 	force = 1;
+	if (!get_candidates(sh_audio, 1, &all))
+	    return 0;
+	cand = &all;
     }
     sh_audio->codec = NULL;
-    while (1) {
+    for (n = 0; n < cand->nr; n++) {
         const char *drv;
 	const ad_functions_t *mpadec;
 	int i;
 	sh_audio->ad_driver = 0;
-	// restore original fourcc:
-	if (sh_audio->wf)
-	    sh_audio->wf->wFormatTag = i = orig_fourcc;
-	if (!(sh_audio->codec = find_audio_codec(sh_audio->format,
-						 sh_audio->wf ? (&i) : NULL,
-						 sh_audio->codec, force)))
-	    break;
+	sh_audio->codec = cand->codec[n];
         drv = codec_idx2str(sh_audio->codec->drv_idx);
 	if (sh_audio->wf)
-	    sh_audio->wf->wFormatTag = i;
+	    sh_audio->wf->wFormatTag = cand->fourccmap[n];
 	// ok we found one codec
 	if (stringset_test(selected, codec_idx2str(sh_audio->codec->name_idx)))
 	    continue;	// already tried & failed
@@ -234,6 +320,9 @@ static int init_audio(sh_audio_t *sh_audio, char *codecname, char *afm,
 	if (sh_audio->codec->flags & CODECS_FLAG_DUMMY && !codecname) {
 	    continue;
 	}
+	// cheap check that the decoder exists before setting it up
+	if (mpadec->control(sh_audio, ADCTRL_QUERY_CODEC, NULL) == CONTROL_FALSE)
+	    continue;
 
 	// it's available, let's try to init!
 	// init()
@@ -245,8 +334,14 @@ static int init_audio(sh_audio_t *sh_audio, char *codecname, char *afm,
 	    continue;		// try next...
 	}
 	// Yeah! We got it!
+	free_candidates(&all);
 	return 1;
     }
+    free_candidates(&all);
+    sh_audio->codec = NULL;
+    sh_audio->ad_driver = 0;
+    if (sh_audio->wf)
+	sh_audio->wf->wFormatTag = orig_fourcc;
     return 0;
 }
 
@@ -254,12 +349,15 @@ int init_best_audio_codec(sh_audio_t *sh_audio, char **audio_codec_list,
 			  char **audio_fm_list)
 {
     stringset_t selected;
+    ad_candidates_t cand;
     char *ac_l_default[2] = { "", (char *) NULL };
     // hack:
     if (!audio_codec_list)
 	audio_codec_list = ac_l_default;
     // Go through the codec.conf and find the best codec...
     sh_audio->initialized = 0;
+    if (!get_candidates(sh_audio, 0, &cand))
+	return 0;
     stringset_init(&selected);
     while (!sh_audio->initialized && *audio_codec_list) {
 	char *audio_codec = *(audio_codec_list++);
@@ -271,7 +369,7 @@ int init_best_audio_codec(sh_audio_t *sh_audio, char **audio_codec_list,
 		// forced codec by name:
 		mp_msg(MSGT_DECAUDIO, MSGL_INFO, MSGTR_ForcedAudioCodec,
 		       audio_codec);
-		init_audio(sh_audio, audio_codec, NULL, -1, &selected);
+		init_audio(sh_audio, &cand, audio_codec, NULL, -1, &selected);
 	    }
 	} else {
 	    int status;
@@ -286,18 +384,19 @@ int init_best_audio_codec(sh_audio_t *sh_audio, char **audio_codec_list,
 			   audio_fm);
 		    for (status = CODECS_STATUS__MAX;
 			 status >= CODECS_STATUS__MIN; --status)
-			if (init_audio(sh_audio, NULL, audio_fm, status, &selected))
+			if (init_audio(sh_audio, &cand, NULL, audio_fm, status, &selected))
 			    break;
 		}
 	    }
 	    if (!sh_audio->initialized)
 		for (status = CODECS_STATUS__MAX; status >= CODECS_STATUS__MIN;
 		     --status)
-		    if (init_audio(sh_audio, NULL, NULL, status, &selected))
+		    if (init_audio(sh_audio, &cand, NULL, NULL, status, &selected))
 			break;
 	}
     }
     stringset_free(&selected);
+    free_candidates(&cand);
 
     if (!sh_audio->initialized) {
 	mp_msg(MSGT_DECAUDIO, MSGL_ERR, MSGTR_CantFindAudioCodec,
@@ -335,6 +434,9 @@ void uninit_audio(sh_audio_t *sh_audio)
     sh_audio->a_out_buffer_size = 0;
     av_freep(&sh_audio->a_buffer);
     av_freep(&sh_audio->a_in_buffer);
+    av_freep(&sh_audio->seek_buf);
+    sh_audio->seek_buf_len = sh_audio->seek_buf_replay = 0;
+    account_buffers(sh_audio);
 }
 
 
@@ -387,6 +489,80 @@ int init_audio_filters(sh_audio_t *sh_audio, int in_samplerate,
     return 1;
 }
 
+/// Keep len bytes the decoder just output in the -audio-seek-buffer ring.
+static void store_seek_buffer(sh_audio_t *sh, const unsigned char *buf, int len)
+{
+    double end;
+    int n;
+
+    if (!sh->seek_buf_keep) {
+        if (sh->seek_buf) {
+            av_freep(&sh->seek_buf);
+            sh->seek_buf_len = sh->seek_buf_replay = 0;
+            account_buffers(sh);
+        }
+        return;
+    }
+    end = calc_a_pts(sh, sh->ds);
+    if (!sh->seek_buf) {
+        int frame = sh->channels * sh->samplesize;
+        if (audio_seek_buffer <= 0 || mp_mem_lowmem || !frame)
+            return;
+        // whole frames only, and the ring offsets must fit an int
+        sh->seek_buf_size = FFMIN((int64_t)(audio_seek_buffer * sh->samplerate),
+                                  INT_MAX / frame) * frame;
+        if (sh->seek_buf_size <= 0)
+            return;
+        sh->seek_buf = av_malloc(sh->seek_buf_size);
+        if (!sh->seek_buf)
+            return;
+        mp_msg(MSGT_DECAUDIO, MSGL_V, "dec_audio: Keeping %d bytes of decoded audio for seeking.\n",
+               sh->seek_buf_size);
+        account_buffers(sh);
+        sh->seek_buf_pos = sh->seek_buf_len = 0;
+        sh->seek_buf_pts = MP_NOPTS_VALUE;
+    }
+    // start over when the timestamps jump, the ring must stay continuous
+    if (end == MP_NOPTS_VALUE || (sh->seek_buf_pts != MP_NOPTS_VALUE &&
+        fabs(end - len / (double)sh->o_bps - sh->seek_buf_pts) > 0.1))
+        sh->seek_buf_len = 0;
+    sh->seek_buf_pts = end;
+    if (end == MP_NOPTS_VALUE)
+        return;
+    if (len > sh->seek_buf_size) {
+        buf += len - sh->seek_buf_size;
+        len  = sh->seek_buf_size;
+    }
+    sh->seek_buf_len = FFMIN(sh->seek_buf_len + len, sh->seek_buf_size);
+    while (len) {
+        n = FFMIN(len, sh->seek_buf_size - sh->seek_buf_pos);
+        memcpy(sh->seek_buf + sh->seek_buf_pos, buf, n);
+        sh->seek_buf_pos = (sh->seek_buf_pos + n) % sh->seek_buf_size;
+        buf += n;
+        len -= n;
+    }
+}
+
+/// Feed audio from the -audio-seek-buffer ring instead of the decoder.
+static int replay_seek_buffer(sh_audio_t *sh, unsigned char *buf, int maxlen)
+{
+    int frame = sh->channels * sh->samplesize;
+    int len = FFMIN(maxlen - maxlen % frame, sh->seek_buf_replay);
+    int pos = sh->seek_buf_pos - sh->seek_buf_replay;
+    int n, done = 0;
+
+    if (pos < 0)
+        pos += sh->seek_buf_size;
+    while (done < len) {
+        n = FFMIN(len - done, sh->seek_buf_size - pos);
+        memcpy(buf + done, sh->seek_buf + pos, n);
+        pos = (pos + n) % sh->seek_buf_size;
+        done += n;
+    }
+    sh->seek_buf_replay -= len;
+    return len;
+}
+
 static int filter_n_bytes(sh_audio_t *sh, int len)
 {
     int error = 0;
@@ -406,15 +582,25 @@ static int filter_n_bytes(sh_audio_t *sh, int len)
 	unsigned char *buf = sh->a_buffer + sh->a_buffer_len;
 	int minlen = len - sh->a_buffer_len;
 	int maxlen = sh->a_buffer_size - sh->a_buffer_len;
-	int ret = sh->ad_driver->decode_audio(sh, buf, minlen, maxlen);
+	int replay = sh->seek_buf_replay > 0;
+	int ret = replay ? replay_seek_buffer(sh, buf, maxlen) :
+	          sh->ad_driver->decode_audio(sh, buf, minlen, maxlen);
 	int format_change = sh->samplerate != filter_input.rate ||
 	                    sh->channels != filter_input.nch ||
 	                    sh->sample_format != filter_input.format;
+	// the ring holds whole frames of the old format, start a new one
+	if (format_change) {
+	    av_freep(&sh->seek_buf);
+	    sh->seek_buf_len = sh->seek_buf_replay = 0;
+	    account_buffers(sh);
+	}
 	if (ret <= 0 || format_change) {
 	    error = format_change ? -2 : -1;
 	    len = sh->a_buffer_len;
 	    break;
 	}
+	if (!replay && audio_seek_buffer > 0)
+	    store_seek_buffer(sh, buf, ret);
 	sh->a_buffer_len += ret;
     }
 
@@ -429,6 +615,7 @@ static int filter_n_bytes(sh_audio_t *sh, int len)
 	       "from %d to %d\n", sh->a_out_buffer_size, newlen);
 	sh->a_out_buffer = realloc(sh->a_out_buffer, newlen);
 	sh->a_out_buffer_size = newlen;
+	account_buffers(sh);
     }
     memcpy(sh->a_out_buffer + sh->a_out_buffer_len, filter_output->audio,
 	   filter_output->len);
@@ -497,8 +684,35 @@ int mp_decode_audio(sh_audio_t *sh_audio, int minlen)
     return 0;
 }
 
+/**
+ * Serve a seek to pts from the decoded audio kept by -audio-seek-buffer.
+ * Nothing is flushed besides the buffered output, the demuxer and decoder
+ * simply continue from where they are once the ring has been replayed.
+ * \return 1 if pts was within the ring, 0 if the demuxer has to seek
+ */
+int seek_audio_buffer(sh_audio_t *sh_audio, double pts)
+{
+    int frame = sh_audio->channels * sh_audio->samplesize;
+    double back;
+
+    if (!sh_audio->seek_buf_len || sh_audio->seek_buf_pts == MP_NOPTS_VALUE ||
+        pts == MP_NOPTS_VALUE || !frame)
+        return 0;
+    // whole sample frames back from the end of the decoded audio, range
+    // checked before the conversion so far seeks cannot wrap into the ring
+    back = rint((sh_audio->seek_buf_pts - pts) * sh_audio->samplerate);
+    if (!(back > 0 && back <= sh_audio->seek_buf_len / frame))
+        return 0;
+    sh_audio->seek_buf_replay  = (int)back * frame;
+    sh_audio->a_buffer_len     = 0;
+    sh_audio->a_out_buffer_len = 0;
+    return 1;
+}
+
 void resync_audio_stream(sh_audio_t *sh_audio)
 {
+    sh_audio->seek_buf_len = sh_audio->seek_buf_replay = 0;
+    sh_audio->seek_buf_pts = MP_NOPTS_VALUE;
     sh_audio->a_buffer_len = 0;
     sh_audio->a_out_buffer_len = 0;
     sh_audio->a_in_buffer_len = 0;	// clear audio input buffer
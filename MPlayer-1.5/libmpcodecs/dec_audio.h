@@ -26,12 +26,14 @@ extern af_cfg_t af_cfg;
 
 extern int audio_output_channels;
 extern int fakemono;
+extern float audio_seek_buffer;
 
 // dec_audio.c:
 void afm_help(void);
 int init_best_audio_codec(sh_audio_t *sh_audio, char** audio_codec_list, char** audio_fm_list);
 int mp_decode_audio(sh_audio_t *sh_audio, int minlen);
 void resync_audio_stream(sh_audio_t *sh_audio);
+int seek_audio_buffer(sh_audio_t *sh_audio, double pts);
 void skip_audio_frame(sh_audio_t *sh_audio);
 void uninit_audio(sh_audio_t *sh_audio);
 
@@ -30,6 +30,15 @@
 #include "stheader.h"
 #include "aac_hdr.h"
 #include "ms_hdr.h"
+#include "index_cache.h"
+
+/// minimum distance in seconds between two entries of the seek index
+#define AAC_INDEX_INTERVAL 0.5
+
+typedef struct {
+	off_t pos;	/// file position of the ADTS header
+	float pts;	/// value of last_pts before the frame was read
+} aac_seekpoint_t;
 
 typedef struct {
 	uint8_t *buf;
@@ -37,8 +46,125 @@ typedef struct {
 	float time;	/// amount of time elapsed based upon samples_per_frame/sample_rate (in milliseconds)
 	float last_pts; /// last pts seen
 	int bitrate;	/// bitrate computed as size/time
+	aac_seekpoint_t *index;	/// sparse frame index, sorted by pos and pts
+	int num_index;
+	int max_index;
+	float duration;	/// exact stream length once the end was reached, 0 if unknown
+	int cached_index;	/// number of index entries loaded from the index cache
+	float cached_duration;
+	char cache_key[INDEX_CACHE_KEY_LEN];
 } aac_priv_t;
 
+#define AAC_CACHE_VERSION 1
+
+typedef struct {
+	int32_t version;
+	int32_t num_index;
+	float duration;
+} aac_cache_hdr_t;
+
+/**
+ * Records a frame start in the seek index.
+ * Frames are always parsed contiguously starting from movi_start or from
+ * an index entry, so last_pts is exact and only frames past the last entry
+ * need to be considered.
+ */
+static void aac_index_add(aac_priv_t *priv, off_t pos, float pts)
+{
+	if(priv->num_index)
+	{
+		aac_seekpoint_t *last = &priv->index[priv->num_index - 1];
+		if(pos <= last->pos || pts < last->pts + AAC_INDEX_INTERVAL)
+			return;
+	}
+	if(priv->num_index >= priv->max_index)
+	{
+		int max = priv->max_index ? 2 * priv->max_index : 256;
+		aac_seekpoint_t *index = realloc_struct(priv->index, max, sizeof(aac_seekpoint_t));
+		if(!index)
+			return;
+		priv->index = index;
+		priv->max_index = max;
+	}
+	priv->index[priv->num_index].pos = pos;
+	priv->index[priv->num_index].pts = pts;
+	priv->num_index++;
+}
+
+/// returns the last index entry with pts <= time, NULL if there is none
+static aac_seekpoint_t *aac_index_find(aac_priv_t *priv, float time)
+{
+	int lo = 0, hi = priv->num_index;
+
+	while(lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if(priv->index[mid].pts <= time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo ? &priv->index[lo - 1] : NULL;
+}
+
+static void aac_load_index(demuxer_t *demuxer)
+{
+	aac_priv_t *priv = (aac_priv_t *) demuxer->priv;
+	aac_cache_hdr_t *hdr;
+	aac_seekpoint_t *index;
+	int len, i;
+
+	if(!index_cache_key(demuxer->stream, priv->cache_key))
+		return;
+	hdr = index_cache_load(priv->cache_key, "aac", &len);
+	if(!hdr)
+		return;
+	index = (aac_seekpoint_t *) (hdr + 1);
+	if(len < sizeof(*hdr) || hdr->version != AAC_CACHE_VERSION || hdr->num_index < 0 ||
+	   hdr->num_index > (len - sizeof(*hdr)) / sizeof(aac_seekpoint_t))
+		goto out;
+	for(i = 1; i < hdr->num_index; i++)
+		if(index[i].pos <= index[i-1].pos || index[i].pts < index[i-1].pts)
+			goto out;
+
+	if(hdr->num_index)
+	{
+		priv->index = malloc(hdr->num_index * sizeof(aac_seekpoint_t));
+		if(!priv->index)
+			goto out;
+		memcpy(priv->index, index, hdr->num_index * sizeof(aac_seekpoint_t));
+	}
+	priv->num_index = priv->max_index = priv->cached_index = hdr->num_index;
+	priv->duration = priv->cached_duration = hdr->duration;
+	mp_msg(MSGT_DEMUX, MSGL_V, "demux_aac: loaded %d index entries, duration %.3f\n",
+	       priv->num_index, priv->duration);
+out:
+	free(hdr);
+}
+
+/// writes the index back to the index cache if it has grown
+static void aac_save_index(aac_priv_t *priv)
+{
+	aac_cache_hdr_t *hdr;
+	int len;
+
+	if(!priv->cache_key[0] ||
+	   (priv->num_index <= priv->cached_index && priv->duration == priv->cached_duration))
+		return;
+	len = sizeof(*hdr) + priv->num_index * sizeof(aac_seekpoint_t);
+	hdr = malloc(len);
+	if(!hdr)
+		return;
+	hdr->version = AAC_CACHE_VERSION;
+	hdr->num_index = priv->num_index;
+	hdr->duration = priv->duration;
+	if(priv->num_index)
+		memcpy(hdr + 1, priv->index, priv->num_index * sizeof(aac_seekpoint_t));
+	index_cache_save(priv->cache_key, "aac", hdr, len);
+	free(hdr);
+}
+
 static int demux_aac_init(demuxer_t *demuxer)
 {
 	aac_priv_t *priv;
@@ -65,7 +191,9 @@ static void demux_close_aac(demuxer_t *demuxer)
 	if(!priv)
 		return;
 
+	aac_save_index(priv);
 	free(priv->buf);
+	free(priv->index);
 
 	free(demuxer->priv);
 
@@ -132,6 +260,7 @@ static demuxer_t* demux_aac_open(demuxer_t *demuxer)
 	demuxer->audio->sh = sh;
 
 	demuxer->filepos = stream_tell(demuxer->stream);
+	aac_load_index(demuxer);
 
 	return demuxer;
 }
@@ -144,7 +273,7 @@ static int demux_aac_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds)
 	float tm = 0;
 
 	if(demuxer->stream->eof || (demuxer->movi_end && stream_tell(demuxer->stream) >= demuxer->movi_end))
-        	return 0;
+		goto eof;
 
 	while(! demuxer->stream->eof)
 	{
@@ -153,18 +282,18 @@ static int demux_aac_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds)
 		{
 			c1 = stream_read_char(demuxer->stream);
 			if(c1 < 0)
-				return 0;
+				goto eof;
 		}
 		c2 = stream_read_char(demuxer->stream);
 		if(c2 < 0)
-			return 0;
+			goto eof;
 		if((c2 & 0xF6) != 0xF0)
 			continue;
 
 		priv->buf[0] = (unsigned char) c1;
 		priv->buf[1] = (unsigned char) c2;
 		if(stream_read(demuxer->stream, &(priv->buf[2]), 6) < 6)
-			return 0;
+			goto eof;
 
 		len = aac_parse_frame(priv->buf, &srate, &num);
 		if(len > 0)
@@ -177,6 +306,7 @@ static int demux_aac_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds)
 			}
 
 
+			aac_index_add(priv, stream_tell(demuxer->stream) - 8, priv->last_pts);
 			memcpy(dp->buffer, priv->buf, 8);
 			stream_read(demuxer->stream, &(dp->buffer[8]), len-8);
 			if(srate)
@@ -197,33 +327,77 @@ static int demux_aac_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds)
 			stream_skip(demuxer->stream, -6);
 	}
 
+eof:
+	// frames are parsed contiguously, so this is the exact length
+	if(!priv->duration)
+		priv->duration = priv->last_pts;
 	return 0;
 }
 
+static int demux_aac_control(demuxer_t *demuxer, int cmd, void *arg)
+{
+	aac_priv_t *priv = (aac_priv_t *) demuxer->priv;
 
-//This is an almost verbatim copy of high_res_mp3_seek(), from demux_audio.c
+	switch(cmd)
+	{
+		case DEMUXER_CTRL_GET_TIME_LENGTH:
+			if(priv->duration <= 0)
+				return DEMUXER_CTRL_DONTKNOW;
+			*((double *)arg) = priv->duration;
+			return DEMUXER_CTRL_OK;
+
+		case DEMUXER_CTRL_GET_PERCENT_POS:
+			if(priv->duration <= 0)
+				return DEMUXER_CTRL_DONTKNOW;
+			*((int *)arg) = (int) (priv->last_pts * 100 / priv->duration);
+			return DEMUXER_CTRL_OK;
+
+		default:
+			return DEMUXER_CTRL_NOTIMPL;
+	}
+}
+
+
+/**
+ * Seeks by bisecting the frame index for the closest known frame before
+ * the target, then walking the ADTS headers of the remaining gap.
+ * Every frame walked is added to the index, so the gap shrinks with use.
+ */
 static void demux_aac_seek(demuxer_t *demuxer, float rel_seek_secs, float audio_delay, int flags)
 {
 	aac_priv_t *priv = (aac_priv_t *) demuxer->priv;
 	demux_stream_t *d_audio=demuxer->audio;
 	sh_audio_t *sh_audio=d_audio->sh;
-	float time;
+	aac_seekpoint_t *sp;
+	float target;
 
 	ds_free_packs(d_audio);
 
-	time = (flags & SEEK_ABSOLUTE) ? rel_seek_secs - priv->last_pts : rel_seek_secs;
-	if(time < 0)
+	target = (flags & SEEK_ABSOLUTE) ? rel_seek_secs : priv->last_pts + rel_seek_secs;
+	if(target < 0)
+		target = 0;
+
+	// continue from the current position unless the index gets us closer
+	sp = aac_index_find(priv, target);
+	if(target < priv->last_pts || (sp && sp->pts > priv->last_pts))
 	{
-		stream_seek(demuxer->stream, demuxer->movi_start);
-		time = priv->last_pts + time;
-		priv->last_pts = 0;
+		if(sp)
+		{
+			stream_seek(demuxer->stream, sp->pos);
+			priv->last_pts = sp->pts;
+		}
+		else
+		{
+			stream_seek(demuxer->stream, demuxer->movi_start);
+			priv->last_pts = 0;
+		}
 	}
 
-	if(time > 0)
+	if(target > priv->last_pts)
 	{
 		int len, nf, srate, num;
 
-		nf = time * sh_audio->samplerate/1024;
+		nf = (target - priv->last_pts) * sh_audio->samplerate/1024;
 
 		while(nf > 0)
 		{
@@ -235,6 +409,7 @@ static void demux_aac_seek(demuxer_t *demuxer, float rel_seek_secs, float audio_
 				stream_skip(demuxer->stream, -7);
 				continue;
 			}
+			aac_index_add(priv, stream_tell(demuxer->stream) - 8, priv->last_pts);
 			stream_skip(demuxer->stream, len - 8);
 			priv->last_pts += (float) (num*1024.0/srate);
 			nf -= num;
@@ -256,5 +431,5 @@ const demuxer_desc_t demuxer_desc_aac = {
   demux_aac_open,
   demux_close_aac,
   demux_aac_seek,
-  NULL
+  demux_aac_control
 };
@@ -45,6 +45,7 @@ typedef struct da_priv {
   int frmt;
   double next_pts;
   int r_gain;
+  double duration; // from the Xing/VBRI frame count, 0 if unknown
 } da_priv_t;
 
 //! rather arbitrary value for maximum length of wav-format headers
@@ -452,6 +453,7 @@ static int demux_audio_open(demuxer_t* demuxer) {
 
   priv = malloc(sizeof(da_priv_t));
   priv->r_gain = INT32_MIN;
+  priv->duration = 0;
 
   switch(frmt) {
   case MP3:
@@ -471,6 +473,7 @@ static int demux_audio_open(demuxer_t* demuxer) {
     sh_audio->wf->wBitsPerSample = 16;
     sh_audio->wf->cbSize = 0;
     duration = (double) mp3_vbr_frames(s, demuxer->movi_start, priv) * mp3_found->mpa_spf / mp3_found->mp3_freq;
+    priv->duration = duration;
     free(mp3_found);
     mp3_found = NULL;
     if(demuxer->movi_end && (s->flags & MP_STREAM_SEEK) == MP_STREAM_SEEK) {
@@ -691,6 +694,36 @@ static int demux_audio_open(demuxer_t* demuxer) {
 }
 
 
+/// Read the next MP3 frame header into hdr, searching forward byte by byte
+/// for a valid one, and return the frame length or -1 at the end.
+/// A memory mapped file is searched in place instead of through the
+/// stream buffer.
+static int mp3_next_header(demuxer_t *demux, uint8_t *hdr) {
+  stream_t* s = demux->stream;
+  const unsigned char *p;
+  int l;
+
+  while(1) {
+    if ((p = stream_map_ptr(s, 4))) {
+      memcpy(hdr, p, 4);
+      l = mp_decode_mp3_header(hdr);
+      stream_skip(s, l < 0 ? 1 : 4);
+      if (l >= 0)
+        return l;
+    } else {
+      stream_read(s,hdr,4);
+      if (s->eof)
+        return -1;
+      l = mp_decode_mp3_header(hdr);
+      if (l >= 0)
+        return l;
+      stream_skip(s,-3);
+    }
+    if (demux->movi_end && stream_tell(s) >= demux->movi_end)
+      return -1; // might be ID3 tag, i.e. EOF
+  }
+}
+
 static int demux_audio_fill_buffer(demuxer_t *demux, demux_stream_t *ds) {
   int l;
   demux_packet_t* dp;
@@ -703,29 +736,21 @@ static int demux_audio_fill_buffer(demuxer_t *demux, demux_stream_t *ds) {
     return 0;
 
   switch(priv->frmt) {
-  case MP3 :
-    while(1) {
-      uint8_t hdr[4];
-      stream_read(s,hdr,4);
-      if (s->eof)
-        return 0;
-      l = mp_decode_mp3_header(hdr);
-      if(l < 0) {
-	if (demux->movi_end && stream_tell(s) >= demux->movi_end)
-	  return 0; // might be ID3 tag, i.e. EOF
-	stream_skip(s,-3);
-      } else {
-	dp = new_demux_packet(l);
-	memcpy(dp->buffer,hdr,4);
-	if (stream_read(s,dp->buffer + 4,l-4) != l-4)
-	{
-	  free_demux_packet(dp);
-	  return 0;
-	}
-	priv->next_pts += sh_audio->audio.dwScale/(double)sh_audio->samplerate;
-	break;
-      }
-    } break;
+  case MP3 : {
+    uint8_t hdr[4];
+    l = mp3_next_header(demux, hdr);
+    if (l < 0)
+      return 0;
+    dp = new_demux_packet(l);
+    memcpy(dp->buffer,hdr,4);
+    if (stream_read(s,dp->buffer + 4,l-4) != l-4)
+    {
+      free_demux_packet(dp);
+      return 0;
+    }
+    priv->next_pts += sh_audio->audio.dwScale/(double)sh_audio->samplerate;
+    break;
+  }
   case WAV : {
     unsigned align = sh_audio->wf->nBlockAlign;
     l = sh_audio->wf->nAvgBytesPerSec;
@@ -768,12 +793,9 @@ static void high_res_mp3_seek(demuxer_t *demuxer,float time) {
 
   nf = time*sh->samplerate/sh->audio.dwScale;
   while(nf > 0) {
-    stream_read(demuxer->stream,hdr,4);
-    len = mp_decode_mp3_header(hdr);
-    if(len < 0) {
-      stream_skip(demuxer->stream,-3);
-      continue;
-    }
+    len = mp3_next_header(demuxer, hdr);
+    if(len < 0)
+      break;
     stream_skip(demuxer->stream,len-4);
     priv->next_pts += sh->audio.dwScale/(double)sh->samplerate;
     nf--;
@@ -842,8 +864,12 @@ static int demux_audio_control(demuxer_t *demuxer,int cmd, void *arg){
 
     switch(cmd) {
 	case DEMUXER_CTRL_GET_TIME_LENGTH:
+	    if (priv->duration > 0) {
+		*((double *)arg) = priv->duration;
+		return DEMUXER_CTRL_OK;
+	    }
 	    if (audio_length<=0) return DEMUXER_CTRL_DONTKNOW;
-	    *((double *)arg)=(double)audio_length;
+	    *((double *)arg) = (double)(demuxer->movi_end - demuxer->movi_start) / sh_audio->i_bps;
 	    return DEMUXER_CTRL_GUESS;
 
 	case DEMUXER_CTRL_GET_PERCENT_POS:
@@ -298,7 +298,7 @@ do{
 
   ds=demux_avi_select_stream(demux,id);
   if(ds)
-    if(ds->packs+1>=MAX_PACKS || ds->bytes+len>=MAX_PACK_BYTES){
+    if(ds->packs+1>=MAX_PACKS || ds->bytes+len>=MAX_QUEUE_BYTES){
 	// this packet will cause a buffer overflow, switch to -ni mode!!!
 	switch_to_ni(demux);
 	// quit now, we can't even (no enough buffer memory) read this packet :(
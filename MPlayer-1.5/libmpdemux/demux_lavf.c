@@ -66,6 +66,8 @@ const m_option_t lavfdopts_conf[] = {
 };
 
 #define BIO_BUFFER_SIZE 32768
+// local files are read in larger blocks, the reads go straight to lavf
+#define BIO_FILE_BUFFER_SIZE (256*1024)
 
 typedef struct lavf_priv {
     const AVInputFormat *avif;
@@ -82,14 +84,19 @@ typedef struct lavf_priv {
     int nb_streams_last;
     int use_lavf_netstream;
     int r_gain;
+    uint8_t *probe_buf; // data read by lavf_check_file, the stream is behind it
+    int probe_size;
+    int bio_size;
 }lavf_priv_t;
 
 static int mp_read(void *opaque, uint8_t *buf, int size) {
     demuxer_t *demuxer = opaque;
     stream_t *stream = demuxer->stream;
+    lavf_priv_t *priv = demuxer->priv;
     int ret;
 
-    ret=stream_read(stream, buf, size);
+    // lavf copes with short reads, do not wait for more than a buffer
+    ret=stream_read_direct(stream, buf, FFMIN(size, priv->bio_size));
     if (!ret && stream->eof)
       ret = AVERROR_EOF;
 
@@ -207,9 +214,13 @@ static int lavf_check_file(demuxer_t *demuxer){
               probe_data_size < SMALL_MAX_PROBE_SIZE) &&
              score <= AVPROBE_SCORE_MAX / 4 &&
              read_size > 0 && probe_data_size < PROBE_BUF_SIZE);
-    av_free(avpd.buf);
+    // keep the data, it becomes the first buffer of the AVIO context
+    av_free(priv->probe_buf);
+    priv->probe_buf  = avpd.buf;
+    priv->probe_size = probe_data_size;
 
     if(!priv->avif){
+        av_freep(&priv->probe_buf);
         mp_msg(MSGT_HEADER,MSGL_V,"LAVF_check: no clue about this gibberish!\n");
         return 0;
     }else{
@@ -551,7 +562,10 @@ static demuxer_t* demux_open_lavf(demuxer_t *demuxer){
     int i;
     char mp_filename[2048]="mp:";
 
-    stream_seek(demuxer->stream, 0);
+    if (!priv->probe_buf || (priv->avif->flags & AVFMT_NOFILE)) {
+        av_freep(&priv->probe_buf);
+        stream_seek(demuxer->stream, 0);
+    }
 
     avfc = avformat_alloc_context();
 
@@ -596,9 +610,26 @@ static demuxer_t* demux_open_lavf(demuxer_t *demuxer){
         av_strlcat(mp_filename, "foobar.dummy", sizeof(mp_filename));
 
     if (!(priv->avif->flags & AVFMT_NOFILE)) {
-        uint8_t *buffer = av_mallocz(BIO_BUFFER_SIZE);
-        priv->pb = avio_alloc_context(buffer, BIO_BUFFER_SIZE, 0,
-                                      demuxer, mp_read, NULL, mp_seek);
+        uint8_t *buffer;
+        priv->bio_size = demuxer->stream->type == STREAMTYPE_FILE ?
+                         BIO_FILE_BUFFER_SIZE : BIO_BUFFER_SIZE;
+        if (priv->probe_buf) {
+            // Start with the probed data in the buffer instead of reading
+            // it again, this also works on unseekable streams.
+            int size = FFMAX(priv->bio_size, priv->probe_size);
+            buffer = av_realloc(priv->probe_buf, size + AV_INPUT_BUFFER_PADDING_SIZE);
+            if (!buffer)
+                buffer = priv->probe_buf;
+            priv->probe_buf = NULL;
+            priv->pb = avio_alloc_context(buffer, size, 0,
+                                          demuxer, mp_read, NULL, mp_seek);
+            priv->pb->buf_end = buffer + priv->probe_size;
+            priv->pb->pos     = priv->probe_size;
+        } else {
+            buffer = av_mallocz(priv->bio_size);
+            priv->pb = avio_alloc_context(buffer, priv->bio_size, 0,
+                                          demuxer, mp_read, NULL, mp_seek);
+        }
         priv->pb->read_seek = mp_read_seek;
         if (!demuxer->stream->end_pos || (demuxer->stream->flags & MP_STREAM_SEEK) != MP_STREAM_SEEK)
             priv->pb->seekable = 0;
@@ -938,6 +969,7 @@ static void demux_close_lavf(demuxer_t *demuxer)
         }
         if (priv->pb) av_freep(&priv->pb->buffer);
         av_freep(&priv->pb);
+        av_free(priv->probe_buf);
         free(priv); demuxer->priv= NULL;
     }
 }
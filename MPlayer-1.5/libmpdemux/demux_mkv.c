@@ -154,6 +154,10 @@ typedef struct mkv_index {
     uint64_t timecode, filepos;
 } mkv_index_t;
 
+typedef struct mkv_cluster {
+    uint64_t filepos, timecode;
+} mkv_cluster_t;
+
 typedef struct mkv_demuxer {
     off_t segment_start;
 
@@ -169,6 +173,7 @@ typedef struct mkv_demuxer {
     uint64_t cluster_size;
     uint64_t blockgroup_size;
 
+    /* cue points sorted by timecode */
     mkv_index_t *indexes;
     int num_indexes;
 
@@ -177,8 +182,10 @@ typedef struct mkv_demuxer {
     off_t *parsed_seekhead;
     int parsed_seekhead_num;
 
-    uint64_t *cluster_positions;
-    int num_cluster_pos;
+    /* clusters seen so far, sorted by position */
+    mkv_cluster_t *clusters;
+    int num_clusters;
+    uint64_t cluster_start;
 
     int64_t skip_to_timecode;
     int v_skip_to_keyframe, a_skip_to_keyframe;
@@ -199,17 +206,20 @@ typedef struct mkv_demuxer {
  * \param arrayp array to grow
  * \param nelem current number of elements in array
  * \param elsize size of one array element
+ *
+ * The allocation starts at 32 elements and doubles whenever nelem reaches
+ * it, so it needs not be stored and appending is amortized O(1).
  */
 static void av_noinline grow_array(void *arrayp, int nelem, size_t elsize)
 {
     void **array = arrayp;
     void *oldp = *array;
-    if (nelem & 31)
+    if (nelem && (nelem < 32 || (nelem & (nelem - 1))))
         return;
-    if (nelem > UINT_MAX / elsize - 32)
+    if (nelem > UINT_MAX / elsize / 2 - 32)
         *array = NULL;
     else
-        *array = realloc(*array, (nelem + 32) * elsize);
+        *array = realloc(*array, (nelem ? 2 * nelem : 32) * elsize);
     if (!*array)
         free(oldp);
 }
@@ -227,21 +237,100 @@ static mkv_track_t *demux_mkv_find_track_by_num(mkv_demuxer_t *d, int n,
     return NULL;
 }
 
-static void add_cluster_position(mkv_demuxer_t *mkv_d, uint64_t position)
+static void add_cluster_position(mkv_demuxer_t *mkv_d, uint64_t position,
+                                 uint64_t timecode)
 {
-    int i = mkv_d->num_cluster_pos;
+    int lo = 0, hi = mkv_d->num_clusters;
+    mkv_cluster_t *c;
+
+    /* clusters are mostly seen in file order */
+    if (hi && mkv_d->clusters[hi - 1].filepos < position)
+        lo = hi;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (mkv_d->clusters[mid].filepos < position)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < mkv_d->num_clusters && mkv_d->clusters[lo].filepos == position)
+        return;
+
+    grow_array(&mkv_d->clusters, mkv_d->num_clusters, sizeof(mkv_cluster_t));
+    if (!mkv_d->clusters) {
+        mkv_d->num_clusters = 0;
+        return;
+    }
+    c = mkv_d->clusters + lo;
+    memmove(c + 1, c, (mkv_d->num_clusters - lo) * sizeof(*c));
+    c->filepos  = position;
+    c->timecode = timecode;
+    mkv_d->num_clusters++;
+}
 
-    while (i--)
-        if (mkv_d->cluster_positions[i] == position)
+static void add_index_entry(mkv_demuxer_t *mkv_d, int tnum,
+                            uint64_t timecode, uint64_t filepos)
+{
+    int i, lo = 0, hi = mkv_d->num_indexes;
+    mkv_index_t *index;
+
+    /* cue points are mostly stored in order, keep them sorted by
+       timecode so that seeking can use binary search */
+    if (hi && mkv_d->indexes[hi - 1].timecode <= timecode)
+        lo = hi;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (mkv_d->indexes[mid].timecode <= timecode)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (i = lo - 1; i >= 0 && mkv_d->indexes[i].timecode == timecode; i--)
+        if (mkv_d->indexes[i].tnum == tnum && mkv_d->indexes[i].filepos == filepos)
             return;
 
-    grow_array(&mkv_d->cluster_positions, mkv_d->num_cluster_pos,
-               sizeof(uint64_t));
-    if (!mkv_d->cluster_positions) {
-        mkv_d->num_cluster_pos = 0;
+    grow_array(&mkv_d->indexes, mkv_d->num_indexes, sizeof(mkv_index_t));
+    if (!mkv_d->indexes) {
+        mkv_d->num_indexes = 0;
         return;
     }
-    mkv_d->cluster_positions[mkv_d->num_cluster_pos++] = position;
+    index = mkv_d->indexes + lo;
+    memmove(index + 1, index, (mkv_d->num_indexes - lo) * sizeof(*index));
+    index->tnum     = tnum;
+    index->timecode = timecode;
+    index->filepos  = filepos;
+    mkv_d->num_indexes++;
+}
+
+/**
+ * \brief distance of a timecode from a seek target
+ * \param target seek target in ms
+ * \param timecode unscaled cue point or cluster timecode
+ * \return difference in ms, negative if timecode is after the target
+ */
+static int64_t seek_diff(mkv_demuxer_t *mkv_d, int64_t target,
+                         uint64_t timecode)
+{
+    return target + mkv_d->first_tc -
+           (int64_t) timecode * mkv_d->tc_scale / 1000000.0;
+}
+
+/**
+ * \return number of cue points before target, including those at the
+ *         target if inclusive is set
+ */
+static int index_bound(mkv_demuxer_t *mkv_d, int64_t target, int inclusive)
+{
+    int lo = 0, hi = mkv_d->num_indexes;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int64_t diff = seek_diff(mkv_d, target, mkv_d->indexes[mid].timecode);
+        if (inclusive ? diff >= 0 : diff > 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
 }
 
 
@@ -972,8 +1061,12 @@ static int demux_mkv_read_cues(demuxer_t *demuxer)
             ebml_read_skip(s, NULL);
             return 0;
         }
-    mkv_d->parsed_cues = realloc(mkv_d->parsed_cues,
-                                 (mkv_d->parsed_cues_num + 1) * sizeof(off_t));
+    grow_array(&mkv_d->parsed_cues, mkv_d->parsed_cues_num, sizeof(off_t));
+    if (!mkv_d->parsed_cues) {
+        mkv_d->parsed_cues_num = 0;
+        ebml_read_skip(s, NULL);
+        return 0;
+    }
     mkv_d->parsed_cues[mkv_d->parsed_cues_num++] = off;
 
     mp_msg(MSGT_DEMUX, MSGL_V, "[mkv] /---- [ parsing cues ] -----------\n");
@@ -1046,21 +1139,13 @@ static int demux_mkv_read_cues(demuxer_t *demuxer)
 
         if (time != EBML_UINT_INVALID && track != EBML_UINT_INVALID
             && pos != EBML_UINT_INVALID) {
-            grow_array(&mkv_d->indexes, mkv_d->num_indexes,
-                       sizeof(mkv_index_t));
-            if (!mkv_d->indexes) {
-                mkv_d->num_indexes = 0;
+            add_index_entry(mkv_d, track, time, mkv_d->segment_start + pos);
+            if (!mkv_d->indexes)
                 break;
-            }
-            mkv_d->indexes[mkv_d->num_indexes].tnum = track;
-            mkv_d->indexes[mkv_d->num_indexes].timecode = time;
-            mkv_d->indexes[mkv_d->num_indexes].filepos = mkv_d->segment_start
-                                                         + pos;
             mp_msg(MSGT_DEMUX, MSGL_DBG2,
                    "[mkv] |+ found cue point " "for track %" PRIu64
                    ": timecode %" PRIu64 ", filepos: %" PRIu64 "\n", track,
                    time, mkv_d->segment_start + pos);
-            mkv_d->num_indexes++;
         }
     }
 
@@ -2226,7 +2311,7 @@ static void demux_close_mkv(demuxer_t *demuxer)
             free(mkv_d->tracks);
         }
         free(mkv_d->indexes);
-        free(mkv_d->cluster_positions);
+        free(mkv_d->clusters);
         free(mkv_d->parsed_cues);
         free(mkv_d->parsed_seekhead);
         free(mkv_d);
@@ -2794,6 +2879,7 @@ static int demux_mkv_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds)
                         mkv_d->has_first_tc = 1;
                     }
                     mkv_d->cluster_tc = num * mkv_d->tc_scale;
+                    add_cluster_position(mkv_d, mkv_d->cluster_start, num);
                     break;
                 }
 
@@ -2842,7 +2928,7 @@ static int demux_mkv_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds)
 
         if (ebml_read_id(s, &il) != MATROSKA_ID_CLUSTER)
             return 0;
-        add_cluster_position(mkv_d, stream_tell(s) - il);
+        mkv_d->cluster_start = stream_tell(s) - il;
         mkv_d->cluster_size = ebml_read_length(s, NULL);
     }
 
@@ -2856,7 +2942,7 @@ static void demux_mkv_seek(demuxer_t *demuxer, float rel_seek_secs,
     if (!(flags & SEEK_FACTOR)) {       /* time in secs */
         mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
         stream_t *s = demuxer->stream;
-        int64_t target_timecode = 0, diff, min_diff = 0xFFFFFFFFFFFFFFFLL;
+        int64_t target_timecode = 0, diff;
         int i;
 
         if (!(flags & SEEK_ABSOLUTE))   /* relative seek */
@@ -2866,89 +2952,98 @@ static void demux_mkv_seek(demuxer_t *demuxer, float rel_seek_secs,
             target_timecode = 0;
 
         if (mkv_d->indexes == NULL) {   /* no index was found */
-            uint64_t target_filepos, cluster_pos, max_pos;
-
-            target_filepos =
-                (uint64_t) (target_timecode * mkv_d->last_filepos /
-                            (mkv_d->last_pts * 1000.0));
-
-            max_pos = mkv_d->num_cluster_pos ?
-                mkv_d->cluster_positions[mkv_d->num_cluster_pos - 1] : 0;
-            if (target_filepos > max_pos) {
-                if ((off_t) max_pos > stream_tell(s))
-                    stream_seek(s, max_pos);
+            mkv_cluster_t *last = mkv_d->num_clusters ?
+                mkv_d->clusters + mkv_d->num_clusters - 1 : NULL;
+
+            /* parse the clusters up to the one after the target, taking
+               only their timecodes and skipping the rest */
+            if (!last || seek_diff(mkv_d, target_timecode, last->timecode) >= 0) {
+                if (last && (off_t) last->filepos > stream_tell(s))
+                    stream_seek(s, last->filepos);
                 else
                     stream_seek(s, stream_tell(s) + mkv_d->cluster_size);
-                /* parse all the clusters upto target_filepos */
-                while (!s->eof && stream_tell(s) < (off_t) target_filepos) {
+                while (!s->eof) {
+                    off_t pos = stream_tell(s);
+                    uint64_t len, tc;
+                    int ll;
                     switch (ebml_read_id(s, &i)) {
                     case MATROSKA_ID_CLUSTER:
-                        add_cluster_position(mkv_d,
-                                             (uint64_t) stream_tell(s) - i);
-                        break;
+                        len = ebml_read_length(s, &ll);
+                        if (len == EBML_UINT_INVALID)
+                            break;  /* unknown size, cannot be skipped */
+                        pos += i + ll + len;
+                        if (ebml_read_id(s, NULL) == MATROSKA_ID_CLUSTERTIMECODE &&
+                            (tc = ebml_read_uint(s, NULL)) != EBML_UINT_INVALID) {
+                            add_cluster_position(mkv_d, pos - len - ll - i, tc);
+                            if (seek_diff(mkv_d, target_timecode, tc) < 0)
+                                break;
+                        }
+                        stream_seek(s, pos);
+                        continue;
 
                     case MATROSKA_ID_CUES:
                         demux_mkv_read_cues(demuxer);
-                        break;
+                        continue;
+
+                    default:
+                        ebml_read_skip(s, NULL);
+                        continue;
                     }
-                    ebml_read_skip(s, NULL);
+                    break;
                 }
                 if (s->eof)
                     stream_reset(s);
             }
+        }
 
-            if (mkv_d->indexes == NULL) {
-                cluster_pos = mkv_d->cluster_positions[0];
-                /* Let's find the nearest cluster */
-                for (i = 0; i < mkv_d->num_cluster_pos; i++) {
-                    diff = mkv_d->cluster_positions[i] - target_filepos;
-                    if (rel_seek_secs < 0 && diff < 0 && -diff < min_diff) {
-                        cluster_pos = mkv_d->cluster_positions[i];
-                        min_diff = -diff;
-                    } else if (rel_seek_secs > 0
-                               && (diff < 0 ? -1 * diff : diff) < min_diff) {
-                        cluster_pos = mkv_d->cluster_positions[i];
-                        min_diff = diff < 0 ? -1 * diff : diff;
-                    }
-                }
+        if (mkv_d->indexes == NULL) {
+            /* the last cluster that starts before the target */
+            int lo = 0, hi = mkv_d->num_clusters;
+            while (lo < hi) {
+                int mid = (lo + hi) / 2;
+                if (seek_diff(mkv_d, target_timecode,
+                              mkv_d->clusters[mid].timecode) >= 0)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            if (mkv_d->num_clusters) {
                 mkv_d->cluster_size = mkv_d->blockgroup_size = 0;
-                stream_seek(s, cluster_pos);
+                stream_seek(s, mkv_d->clusters[FFMAX(lo - 1, 0)].filepos);
             }
         } else {
             mkv_index_t *index = NULL;
             int seek_id = (demuxer->video->id < 0) ?
                 demuxer->audio->id : demuxer->video->id;
 
-            /* let's find the entry in the indexes with the smallest */
-            /* difference to the wanted timecode. */
-            for (i = 0; i < mkv_d->num_indexes; i++)
-                if (mkv_d->indexes[i].tnum == seek_id) {
-                    diff =
-                        target_timecode + mkv_d->first_tc -
-                        (int64_t) mkv_d->indexes[i].timecode *
-                        mkv_d->tc_scale / 1000000.0;
-
-                    if ((flags & SEEK_ABSOLUTE
-                         || target_timecode <= mkv_d->last_pts * 1000)) {
-                        // Absolute seek or seek backward: find the last index
-                        // position before target time
-                        if (diff < 0 || diff >= min_diff)
-                            continue;
-                    } else {
-                        // Relative seek forward: find the first index position
-                        // after target time. If no such index exists, find last
-                        // position between current position and target time.
-                        if (diff <= 0) {
-                            if (min_diff <= 0 && diff <= min_diff)
-                                continue;
-                        } else if (diff >=
-                                   FFMIN(target_timecode - mkv_d->last_pts,
-                                         min_diff))
-                            continue;
+            if ((flags & SEEK_ABSOLUTE
+                 || target_timecode <= mkv_d->last_pts * 1000)) {
+                // Absolute seek or seek backward: find the last index
+                // position before target time
+                for (i = index_bound(mkv_d, target_timecode, 1) - 1; i >= 0; i--)
+                    if (mkv_d->indexes[i].tnum == seek_id) {
+                        index = mkv_d->indexes + i;
+                        break;
                     }
-                    min_diff = diff;
-                    index = mkv_d->indexes + i;
-                }
+            } else {
+                // Relative seek forward: find the first index position
+                // after target time. If no such index exists, find last
+                // position between current position and target time.
+                int bound = index_bound(mkv_d, target_timecode, 0);
+                for (i = bound; i < mkv_d->num_indexes; i++)
+                    if (mkv_d->indexes[i].tnum == seek_id) {
+                        index = mkv_d->indexes + i;
+                        break;
+                    }
+                for (i = bound - 1; !index && i >= 0; i--)
+                    if (mkv_d->indexes[i].tnum == seek_id) {
+                        diff = seek_diff(mkv_d, target_timecode,
+                                         mkv_d->indexes[i].timecode);
+                        if (diff < target_timecode - mkv_d->last_pts)
+                            index = mkv_d->indexes + i;
+                        break;
+                    }
+            }
 
             if (index) {        /* We've found an entry. */
                 mkv_d->cluster_size = mkv_d->blockgroup_size = 0;
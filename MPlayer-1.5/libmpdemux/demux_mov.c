@@ -82,12 +82,16 @@
 #define char2short(x,y)	AV_RB16(&(x)[(y)])
 #define char2int(x,y) 	AV_RB32(&(x)[(y)])
 
+// A sample, expanded from the tables on demand
 typedef struct {
-    unsigned int pts; // duration
+    uint64_t pts;
     unsigned int size;
     off_t pos;
 } mov_sample_t;
 
+// number of samples expanded at once around the read position
+#define MOV_WINDOW 256
+
 typedef struct {
     unsigned int sample; // number of the first sample in the chunk
     unsigned int size;   // number of samples in the chunk
@@ -104,6 +108,8 @@ typedef struct {
 typedef struct {
     unsigned int num;
     unsigned int dur;
+    unsigned int first; // number of the first sample of this run
+    uint64_t pts;       // pts of the first sample of this run
 } mov_durmap_t;
 
 typedef struct {
@@ -150,7 +156,11 @@ typedef struct {
     int stream_header_len; // if >0, this header should be sent before the 1st frame
     //
     int samples_size;
-    mov_sample_t* samples;
+    unsigned int* sizes; // sample sizes, NULL if all are fixed_size
+    unsigned int fixed_size;
+    mov_sample_t window[MOV_WINDOW]; // samples window_first ... window_first+window_len-1
+    int window_first;
+    int window_len;
     int chunks_size;
     mov_chunk_t* chunks;
     int chunkmap_size;
@@ -166,10 +176,129 @@ typedef struct {
     void* desc; // image/sound/etc description (pointer to ImageDescription etc)
 } mov_track_t;
 
+static inline unsigned int mov_sample_size(mov_track_t* trak, int n)
+{
+    return trak->sizes ? trak->sizes[n] : trak->fixed_size;
+}
+
+/// number of the duration run containing sample n, or the last run
+static int mov_durmap_index(mov_track_t* trak, unsigned int n)
+{
+    int lo = 0, hi = trak->durmap_size - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (trak->durmap[mid].first <= n)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+static uint64_t mov_sample_pts(mov_track_t* trak, unsigned int n)
+{
+    mov_durmap_t* d;
+    if (!trak->durmap_size)
+        return 0;
+    d = &trak->durmap[mov_durmap_index(trak, n)];
+    // samples past the table get its end
+    n = FFMIN(n, d->first + d->num);
+    return d->pts + (uint64_t)(n - d->first) * d->dur;
+}
+
+/// number of the first sample with a pts of at least pts, samples_size if none
+static int mov_pts_to_sample(mov_track_t* trak, uint64_t pts)
+{
+    int lo = 0, hi = trak->durmap_size;
+    mov_durmap_t* d;
+    uint64_t k;
+    // first run whose last sample is not before pts
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        d = &trak->durmap[mid];
+        if (d->pts + (uint64_t)(d->num - 1) * d->dur < pts)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == trak->durmap_size)
+        return trak->samples_size;
+    d = &trak->durmap[lo];
+    k = pts <= d->pts ? 0 : (pts - d->pts + d->dur - 1) / d->dur;
+    return FFMIN(d->first + k, trak->samples_size);
+}
+
+/// number of the chunk containing sample n
+static int mov_chunk_index(mov_track_t* trak, unsigned int n)
+{
+    int lo = 0, hi = trak->chunks_size - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (trak->chunks[mid].sample <= n)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+/**
+ * Returns sample n < samples_size of a track with variable sample size.
+ * The tables are kept in their run-length form, the samples from n on
+ * are expanded into a small window when n is not in it. Reading
+ * sequentially costs O(1) per sample, random access O(log n) plus the
+ * samples before n in its chunk.
+ */
+static const mov_sample_t* mov_get_sample(mov_track_t* trak, int n)
+{
+    int c = -1, d = 0, i, len;
+    off_t pos = 0;
+    uint64_t pts;
+
+    if (n >= trak->window_first && n < trak->window_first + trak->window_len)
+        return &trak->window[n - trak->window_first];
+
+    if (trak->chunks_size) {
+        c = mov_chunk_index(trak, n);
+        pos = trak->chunks[c].pos;
+        if (n < trak->chunks[c].sample + trak->chunks[c].size)
+            for (i = trak->chunks[c].sample; i < n; i++)
+                pos += mov_sample_size(trak, i);
+    }
+    if (trak->durmap_size)
+        d = mov_durmap_index(trak, n);
+    pts = mov_sample_pts(trak, n);
+
+    len = FFMIN(MOV_WINDOW, trak->samples_size - n);
+    for (i = 0; i < len; i++) {
+        mov_sample_t* smp = &trak->window[i];
+        int s = n + i;
+        while (c + 1 < trak->chunks_size && trak->chunks[c + 1].sample <= s)
+            pos = trak->chunks[++c].pos;
+        smp->pts  = pts;
+        smp->size = mov_sample_size(trak, s);
+        // samples no chunk accounts for have no position
+        smp->pos  = c >= 0 && s < trak->chunks[c].sample + trak->chunks[c].size ? pos : 0;
+        pos      += smp->size;
+        if (trak->durmap_size) {
+            mov_durmap_t* dm = &trak->durmap[d];
+            if (s + 1 < dm->first + dm->num)
+                pts += dm->dur;
+            else if (d + 1 < trak->durmap_size)
+                pts = trak->durmap[++d].pts;
+            else
+                pts = dm->pts + (uint64_t)dm->num * dm->dur;
+        }
+    }
+    trak->window_first = n;
+    trak->window_len   = len;
+    return &trak->window[0];
+}
+
 static void mov_build_index(mov_track_t* trak,int timescale){
     int i,j,s;
     int last=trak->chunks_size;
-    unsigned int pts=0;
+    uint64_t pts=0;
 
 #if 0
     if (trak->chunks_size <= 0)
@@ -228,10 +357,8 @@ static void mov_build_index(mov_track_t* trak,int timescale){
 
     // workaround for fixed-size video frames (dv and uncompressed)
     if(!trak->samples_size && trak->type!=MOV_TRAK_AUDIO){
-	trak->samples=calloc(s, sizeof(mov_sample_t));
-	trak->samples_size=trak->samples ? s : 0;
-	for(i=0;i<trak->samples_size;i++)
-	    trak->samples[i].size=trak->samplesize;
+	trak->samples_size=s;
+	trak->fixed_size=trak->samplesize;
 	trak->samplesize=0;
     }
 
@@ -247,39 +374,30 @@ static void mov_build_index(mov_track_t* trak,int timescale){
       mp_msg(MSGT_DEMUX, MSGL_WARN,
              "MOV: durmap or chunkmap bigger than sample count (%i vs %i)\n",
              s, trak->samples_size);
-      free(trak->samples);
-      trak->samples = calloc(s, sizeof(mov_sample_t));
-      trak->samples_size = trak->samples ? s : 0;
-    }
-
-    // calc pts:
-    s=0;
-    for(j=0;j<trak->durmap_size;j++){
-	for(i=0;i<trak->durmap[j].num;i++){
-	    if (s >= trak->samples_size)
-		break;
-	    trak->samples[s].pts=pts;
-	    ++s;
-	    pts+=trak->durmap[j].dur;
-	}
+      if (trak->sizes) {
+        unsigned int *sizes = realloc(trak->sizes, s * sizeof(*sizes));
+        if (sizes) {
+          memset(sizes + trak->samples_size, 0, (s - trak->samples_size) * sizeof(*sizes));
+          trak->sizes = sizes;
+          trak->samples_size = s;
+        }
+      } else
+        trak->samples_size = s;
     }
 
-    // calc sample offsets
+    // prefix sums of the duration runs, empty runs are dropped
     s=0;
-    for(j=0;j<trak->chunks_size;j++){
-	off_t pos=trak->chunks[j].pos;
-	for(i=0;i<trak->chunks[j].size;i++){
-	    if (s >= trak->samples_size)
-		break;
-	    trak->samples[s].pos=pos;
-	    mp_msg(MSGT_DEMUX, MSGL_DBG3, "Sample %5d: pts=%8d  off=0x%08X  size=%d\n",s,
-		trak->samples[s].pts,
-		(int)trak->samples[s].pos,
-		trak->samples[s].size);
-	    pos+=trak->samples[s].size;
-	    ++s;
-	}
+    for(i=j=0;j<trak->durmap_size;j++){
+	if(!trak->durmap[j].num) continue;
+	trak->durmap[i]=trak->durmap[j];
+	trak->durmap[i].first=s;
+	trak->durmap[i].pts=pts;
+	s+=trak->durmap[i].num;
+	pts+=(uint64_t)trak->durmap[i].num*trak->durmap[i].dur;
+	i++;
     }
+    trak->durmap_size=i;
+    trak->window_len=0;
 
     // precalc editlist entries
     if(trak->editlist_size>0){
@@ -287,7 +405,7 @@ static void mov_build_index(mov_track_t* trak,int timescale){
 	int e_pts=0;
 	for(i=0;i<trak->editlist_size;i++){
 	    mov_editlist_t* el=&trak->editlist[i];
-	    int sample=0;
+	    int sample;
 	    int pts=el->pos;
 	    el->start_frame=frame;
 	    if(pts<0){
@@ -295,17 +413,13 @@ static void mov_build_index(mov_track_t* trak,int timescale){
 		el->frames=0; continue;
 	    }
 	    // find start sample
-	    for(;sample<trak->samples_size;sample++){
-		if(pts<=trak->samples[sample].pts) break;
-	    }
+	    sample=mov_pts_to_sample(trak,pts);
 	    el->start_sample=sample;
-	    el->pts_offset=((long long)e_pts*(long long)trak->timescale)/(long long)timescale-trak->samples[sample].pts;
+	    el->pts_offset=((long long)e_pts*(long long)trak->timescale)/(long long)timescale-mov_sample_pts(trak,sample);
 	    pts+=((long long)el->dur*(long long)trak->timescale)/(long long)timescale;
 	    e_pts+=el->dur;
 	    // find end sample
-	    for(;sample<trak->samples_size;sample++){
-		if(pts<trak->samples[sample].pts) break;
-	    }
+	    sample=FFMAX(sample,mov_pts_to_sample(trak,(uint64_t)pts+1));
 	    el->frames=sample-el->start_sample;
 	    frame+=el->frames;
 	    mp_msg(MSGT_DEMUX,MSGL_V,"EL#%d: pts=%d  1st_sample=%d  frames=%d (%5.3fs)  pts_offs=%d\n",i,
@@ -493,6 +607,12 @@ static int mov_check_file(demuxer_t* demuxer){
 	      }
 	  }
 	  flags|=1;
+	  if(flags==3){
+	    // the header follows the data: stop before reading past it, so
+	    // it is parsed while it is still buffered
+	    demuxer->priv=priv;
+	    return DEMUXER_TYPE_MOV;
+	  }
 	  break;
 	case MOV_FOURCC('w','i','d','e'):
 	  mp_msg(MSGT_DEMUX,MSGL_V,"MOV: 'WIDE' chunk found!\n");
@@ -509,6 +629,11 @@ static int mov_check_file(demuxer_t* demuxer){
 	    demuxer->priv=priv;
 	    return DEMUXER_TYPE_MOV;
 	  }
+	  // The header is behind the data, as in files straight from
+	  // recorders. The skip below seeks over it if the stream can.
+	  if(!(demuxer->stream->flags & MP_STREAM_SEEK_FW))
+	    mp_msg(MSGT_DEMUX,MSGL_WARN,"MOV: Header after the data on an unseekable stream, reading %"PRId64" bytes to reach it.\n",
+	      (int64_t)(len-skipped));
 	  break;
 	case MOV_FOURCC('f','r','e','e'):
 	case MOV_FOURCC('s','k','i','p'):
@@ -558,7 +683,7 @@ static void demux_close_mov(demuxer_t *demuxer) {
       free(track->tkdata);
       free(track->stdata);
       free(track->stream_header);
-      free(track->samples);
+      free(track->sizes);
       free(track->chunks);
       free(track->chunkmap);
       free(track->durmap);
@@ -1370,12 +1495,12 @@ static void lschunks(demuxer_t* demuxer,int level,off_t endpos,mov_track_t* trak
 
 		for (i=0; i<trak->samples_size; i++)
 		{
-		    char buf[trak->samples[i].size];
-		    stream_seek(demuxer->stream, trak->samples[i].pos);
+		    char buf[mov_get_sample(trak, i)->size];
+		    stream_seek(demuxer->stream, mov_get_sample(trak, i)->pos);
 		    snprintf((char *)&name[0], 20, "samp%d", i);
 		    fd = open((char *)&name[0], O_CREAT|O_WRONLY);
-		    stream_read(demuxer->stream, &buf[0], trak->samples[i].size);
-		    write(fd, &buf[0], trak->samples[i].size);
+		    stream_read(demuxer->stream, &buf[0], mov_get_sample(trak, i)->size);
+		    write(fd, &buf[0], mov_get_sample(trak, i)->size);
 		    close(fd);
 		 }
 		for (i=0; i<trak->chunks_size; i++)
@@ -1815,12 +1940,18 @@ static int lschunks_intrak(demuxer_t* demuxer, int level, unsigned int id,
              entries, ss, ver, flags);
       trak->samplesize = ss;
       if (!ss) {
-        // variable samplesize
-        free(trak->samples);
-        trak->samples = calloc(entries, sizeof(mov_sample_t));
-        trak->samples_size = trak->samples ? entries : 0;
-        for (i = 0; i < trak->samples_size; i++)
-          trak->samples[i].size = stream_read_dword(demuxer->stream);
+        // variable samplesize, read as a whole and kept as it is
+        free(trak->sizes);
+        trak->sizes = NULL;
+        trak->samples_size = 0;
+        if (entries > 0 && entries < INT_MAX / sizeof(*trak->sizes))
+          trak->sizes = malloc(entries * sizeof(*trak->sizes));
+        if (trak->sizes) {
+          trak->samples_size = stream_read(demuxer->stream, (char *)trak->sizes,
+                                           entries * sizeof(*trak->sizes)) / sizeof(*trak->sizes);
+          for (i = 0; i < trak->samples_size; i++)
+            trak->sizes[i] = AV_RB32(&trak->sizes[i]);
+        }
       }
       break;
     }
@@ -2037,9 +2168,9 @@ static demuxer_t* mov_read_header(demuxer_t* demuxer){
 		mp_msg(MSGT_DEMUX, MSGL_INFO, "MOV: Track #%d: Extracting %d data chunks to files\n",t_no,trak->samples_size);
 		for (i=0; i<trak->samples_size; i++)
 		{
-		    int len=trak->samples[i].size;
+		    int len=mov_get_sample(trak, i)->size;
 		    char buf[len];
-		    stream_seek(demuxer->stream, trak->samples[i].pos);
+		    stream_seek(demuxer->stream, mov_get_sample(trak, i)->pos);
 		    snprintf(name, 20, "t%02d-s%03d.%s", t_no,i,
 			(trak->media_handler==MOV_FOURCC('f','l','s','h')) ?
 			    "swf":"dump");
@@ -2094,6 +2225,12 @@ static demuxer_t* mov_read_header(demuxer_t* demuxer){
     demuxer->stream->eof = 0;
 #endif
 
+    // with a trailing header start reading the data right away, so that
+    // the cache is filled while the decoders are set up
+    if(priv->mdat_end && priv->moov_start > priv->mdat_start &&
+       (demuxer->stream->flags & MP_STREAM_SEEK_BW))
+	stream_seek(demuxer->stream,priv->mdat_start);
+
     return demuxer;
 }
 
@@ -2162,6 +2299,7 @@ if(trak->samplesize){
     pos=trak->chunks[trak->pos].pos;
 } else {
     int frame=trak->pos;
+    const mov_sample_t* smp;
     // editlist support:
     if(trak->type == MOV_TRAK_VIDEO && trak->editlist_size>=1){
 	// find the right editlist entry:
@@ -2175,17 +2313,20 @@ if(trak->samplesize){
 	// calc real frame index:
 	frame-=trak->editlist[trak->editlist_pos].start_frame;
 	frame+=trak->editlist[trak->editlist_pos].start_sample;
+	if(frame>=trak->samples_size) return 0; // EOF
+	smp=mov_get_sample(trak,frame);
 	// calc pts:
-	pts=(float)(trak->samples[frame].pts+
+	pts=(float)((int64_t)smp->pts+
 	    trak->editlist[trak->editlist_pos].pts_offset)/(float)trak->timescale;
     } else {
 	if(frame>=trak->samples_size) return 0; // EOF
-	pts=(float)trak->samples[frame].pts/(float)trak->timescale;
+	smp=mov_get_sample(trak,frame);
+	pts=(float)smp->pts/(float)trak->timescale;
     }
     // read sample:
-    stream_seek(demuxer->stream,trak->samples[frame].pos);
-    x=trak->samples[frame].size;
-    pos=trak->samples[frame].pos;
+    stream_seek(demuxer->stream,smp->pos);
+    x=smp->size;
+    pos=smp->pos;
 }
 if(trak->pos==0 && trak->stream_header_len>0){
     // we have to append the stream header...
@@ -2208,19 +2349,15 @@ if(trak->pos==0 && trak->stream_header_len>0){
     if (demuxer->sub->id >= 0 && demuxer->sub->id < priv->track_db)
       trak = priv->tracks[demuxer->sub->id];
     if (trak) {
-      int samplenr = 0;
-      while (samplenr < trak->samples_size) {
-        double subpts = (double)trak->samples[samplenr].pts / (double)trak->timescale;
-        if (subpts >= pts) break;
-        samplenr++;
-      }
-      samplenr--;
+      // the last subtitle that starts before pts
+      int samplenr = mov_pts_to_sample(trak, FFMAX(ceil((double)pts * trak->timescale), 0)) - 1;
       if (samplenr < 0)
         vo_sub = NULL;
       else if (samplenr != priv->current_sub) {
-        off_t pos = trak->samples[samplenr].pos;
-        int len = trak->samples[samplenr].size;
-        double subpts = (double)trak->samples[samplenr].pts / (double)trak->timescale;
+        const mov_sample_t *smp = mov_get_sample(trak, samplenr);
+        off_t pos = smp->pos;
+        int len = smp->size;
+        double subpts = (double)smp->pts / (double)trak->timescale;
         stream_seek(demuxer->stream, pos);
         ds_read_packet(demuxer->sub, demuxer->stream, len, subpts, pos, 0);
         priv->current_sub = samplenr;
@@ -2238,27 +2375,31 @@ static float mov_seek_track(mov_track_t* trak,float pts,int flags){
 
 if(trak->samplesize){
     int sample=pts/trak->duration;
+    int lo=0, hi=trak->chunks_size;
 //    printf("MOV track seek - chunk: %d  (pts: %5.3f  dur=%d)  \n",sample,pts,trak->duration);
     if(!(flags&SEEK_ABSOLUTE)) sample+=trak->chunks[trak->pos].sample; // relative
-    trak->pos=0;
-    while(trak->pos<trak->chunks_size && trak->chunks[trak->pos].sample<sample) ++trak->pos;
+    // first chunk that does not start before sample
+    while(lo<hi){
+	int mid=(lo+hi)/2;
+	if((int64_t)trak->chunks[mid].sample<sample) lo=mid+1; else hi=mid;
+    }
+    trak->pos=lo;
     if (trak->pos == trak->chunks_size) return -1;
     pts=(float)(trak->chunks[trak->pos].sample*trak->duration)/(float)trak->timescale;
 } else {
-    unsigned int ipts;
-    if(!(flags&SEEK_ABSOLUTE)) pts+=trak->samples[trak->pos].pts;
+    uint64_t ipts;
+    if(!(flags&SEEK_ABSOLUTE)) pts+=mov_sample_pts(trak,trak->pos);
     if(pts<0) pts=0;
     ipts=pts;
     //printf("MOV track seek - sample: %d  \n",ipts);
-    for(trak->pos=0;trak->pos<trak->samples_size;++trak->pos){
-	if(trak->samples[trak->pos].pts>=ipts) break; // found it!
-    }
+    trak->pos=mov_pts_to_sample(trak,ipts);
     if (trak->pos == trak->samples_size) return -1;
     if(trak->keyframes_size){
-	// find nearest keyframe
-	int i;
-	for(i=0;i<trak->keyframes_size;i++){
-	    if(trak->keyframes[i]>=trak->pos) break;
+	// find nearest keyframe, the table is sorted
+	int i=0, hi=trak->keyframes_size;
+	while(i<hi){
+	    int mid=(i+hi)/2;
+	    if(trak->keyframes[mid]<trak->pos) i=mid+1; else hi=mid;
 	}
 	if (i == trak->keyframes_size) return -1;
 	if(i>0 && (trak->keyframes[i]-trak->pos) > (trak->pos-trak->keyframes[i-1]))
@@ -2266,7 +2407,7 @@ if(trak->samplesize){
 	trak->pos=trak->keyframes[i];
 //	printf("nearest keyframe: %d  \n",trak->pos);
     }
-    pts=(float)trak->samples[trak->pos].pts/(float)trak->timescale;
+    pts=(float)mov_sample_pts(trak,trak->pos)/(float)trak->timescale;
 }
 
 //    printf("MOV track seek done:  %5.3f  \n",pts);
@@ -37,6 +37,7 @@
 #include "aviprint.h"
 #include "demux_mov.h"
 #include "demux_ogg.h"
+#include "index_cache.h"
 
 #define FOURCC_OPUS   mmioFOURCC('o', 'p', 'u', 's')
 #define FOURCC_VORBIS mmioFOURCC('v', 'r', 'b', 's')
@@ -56,6 +57,11 @@
 
 #define BLOCK_SIZE 4096
 
+/// bisection stops when the searched range is smaller than this
+#define BISECT_MIN_RANGE  BLOCK_SIZE
+#define BISECT_MAX_PROBES 64
+#define MAX_PROBE_CACHE   1024
+
 /* Theora decoder context : we won't be able to interpret granule positions
  * without using th_granule_time with the th_dec_ctx of the stream.
  * This is duplicated in `vd_theora.c'; put this in a common header?
@@ -149,10 +155,14 @@ typedef struct ogg_demuxer {
     int              num_sub;
     ogg_syncpoint_t *syncpoints;
     int              num_syncpoint;
+    /// pages of the seek stream found by bisection, sorted by granulepos
+    ogg_syncpoint_t *probes;
+    int              num_probe;
     off_t            pos, last_size;
     int64_t          initial_granulepos;
     int64_t          final_granulepos;
     int64_t          duration;
+    char             cache_key[INDEX_CACHE_KEY_LEN];
 
     /* Used for subtitle switching. */
     int    n_text;
@@ -550,6 +560,45 @@ static int demux_ogg_add_packet(demux_stream_t *ds, ogg_stream_t *os,
     return 1;
 }
 
+/// Go back to the start of the data and queue the first page, so the
+/// header packets are delivered to the decoders again.
+static void demux_ogg_rewind(demuxer_t *demuxer)
+{
+    ogg_demuxer_t *ogg_d = demuxer->priv;
+    stream_t      *s     = demuxer->stream;
+    ogg_sync_state *sync = &ogg_d->sync;
+    ogg_page       *page = &ogg_d->page;
+    ogg_stream_state *oss;
+    int np;
+
+    stream_reset(s);
+    stream_seek(s, demuxer->movi_start);
+    ogg_sync_reset(sync);
+    for (np = 0; np < ogg_d->num_sub; np++) {
+        ogg_stream_reset(&ogg_d->subs[np].stream);
+        ogg_d->subs[np].lastpos = ogg_d->subs[np].lastsize = ogg_d->subs[np].hdr_packets = 0;
+    }
+
+    // Get the first page
+    while (1) {
+        np = ogg_sync_pageout(sync, page);
+        if (np <= 0) { // We need more data
+            char *buf = ogg_sync_buffer(sync, BLOCK_SIZE);
+            int len = stream_read(s, buf, BLOCK_SIZE);
+
+            if (len == 0 && s->eof) {
+                mp_msg(MSGT_DEMUX, MSGL_ERR, "EOF while trying to get the first page !!!!\n");
+                break;
+            }
+            ogg_sync_wrote(sync, len);
+            continue;
+        }
+        demux_ogg_get_page_stream(ogg_d, &oss);
+        ogg_stream_pagein(oss, page);
+        break;
+    }
+}
+
 /// if -forceidx build a table of all syncpoints to make seeking easier
 /// otherwise try to get at least the final_granulepos
 static void demux_ogg_scan_stream(demuxer_t *demuxer)
@@ -658,32 +707,80 @@ static void demux_ogg_scan_stream(demuxer_t *demuxer)
     mp_msg(MSGT_DEMUX, MSGL_V, "Ogg stream length (granulepos): %"PRId64"\n",
            ogg_d->final_granulepos);
 
-    stream_reset(s);
-    stream_seek(s, demuxer->movi_start);
-    ogg_sync_reset(sync);
-    for (np = 0; np < ogg_d->num_sub; np++) {
-        ogg_stream_reset(&ogg_d->subs[np].stream);
-        ogg_d->subs[np].lastpos = ogg_d->subs[np].lastsize = ogg_d->subs[np].hdr_packets = 0;
-    }
+    demux_ogg_rewind(demuxer);
+}
 
-    // Get the first page
-    while (1) {
-        np = ogg_sync_pageout(sync, page);
-        if (np <= 0) { // We need more data
-            char *buf = ogg_sync_buffer(sync, BLOCK_SIZE);
-            int len = stream_read(s, buf, BLOCK_SIZE);
+#define OGG_CACHE_VERSION 1
 
-            if (len == 0 && s->eof) {
-                mp_msg(MSGT_DEMUX, MSGL_ERR, "EOF while trying to get the first page !!!!\n");
-                break;
-            }
-            ogg_sync_wrote(sync, len);
-            continue;
-        }
-        demux_ogg_get_page_stream(ogg_d, &oss);
-        ogg_stream_pagein(oss, page);
-        break;
+typedef struct ogg_cache_hdr {
+    int32_t version;
+    int32_t serialno;       ///< stream the table was built for
+    int32_t num_syncpoint;  ///< -1 if the syncpoint table wasn't built
+    int64_t initial_granulepos;
+    int64_t final_granulepos;
+} ogg_cache_hdr_t;
+
+/// Load the results of demux_ogg_scan_stream() from the index cache.
+/// \return 1 on success, 0 if the stream still has to be scanned
+static int demux_ogg_load_index(demuxer_t *demuxer)
+{
+    ogg_demuxer_t *ogg_d = demuxer->priv;
+    ogg_cache_hdr_t *hdr;
+    int sid, len, ret = 0;
+
+    sid = demuxer->video->id >= 0 ? demuxer->video->id : demuxer->audio->id;
+    if (sid < 0 || !index_cache_key(demuxer->stream, ogg_d->cache_key))
+        return 0;
+    hdr = index_cache_load(ogg_d->cache_key, "ogg", &len);
+    if (!hdr)
+        return 0;
+    if (len < sizeof(*hdr) || hdr->version != OGG_CACHE_VERSION ||
+        hdr->serialno != (int32_t)ogg_d->subs[sid].stream.serialno ||
+        (index_mode == 2 && hdr->num_syncpoint < 0) ||
+        hdr->num_syncpoint > (int)((len - sizeof(*hdr)) / sizeof(ogg_syncpoint_t)))
+        goto out;
+
+    if (index_mode == 2 && hdr->num_syncpoint > 0) {
+        ogg_d->syncpoints = malloc(hdr->num_syncpoint * sizeof(ogg_syncpoint_t));
+        if (!ogg_d->syncpoints)
+            goto out;
+        memcpy(ogg_d->syncpoints, hdr + 1, hdr->num_syncpoint * sizeof(ogg_syncpoint_t));
+        ogg_d->num_syncpoint = hdr->num_syncpoint;
     }
+    ogg_d->initial_granulepos = hdr->initial_granulepos;
+    ogg_d->final_granulepos   = hdr->final_granulepos;
+    mp_msg(MSGT_DEMUX, MSGL_V,
+           "Ogg stream length (granulepos) from index cache: %"PRId64", %d syncpoints\n",
+           ogg_d->final_granulepos, ogg_d->num_syncpoint);
+    demux_ogg_rewind(demuxer);
+    ret = 1;
+out:
+    free(hdr);
+    return ret;
+}
+
+static void demux_ogg_save_index(demuxer_t *demuxer)
+{
+    ogg_demuxer_t *ogg_d = demuxer->priv;
+    ogg_cache_hdr_t *hdr;
+    int sid, len;
+
+    sid = demuxer->video->id >= 0 ? demuxer->video->id : demuxer->audio->id;
+    if (sid < 0 || !ogg_d->cache_key[0])
+        return;
+    len = sizeof(*hdr) + ogg_d->num_syncpoint * sizeof(ogg_syncpoint_t);
+    hdr = malloc(len);
+    if (!hdr)
+        return;
+    hdr->version            = OGG_CACHE_VERSION;
+    hdr->serialno           = ogg_d->subs[sid].stream.serialno;
+    hdr->num_syncpoint      = index_mode == 2 ? ogg_d->num_syncpoint : -1;
+    hdr->initial_granulepos = ogg_d->initial_granulepos;
+    hdr->final_granulepos   = ogg_d->final_granulepos;
+    if (ogg_d->num_syncpoint)
+        memcpy(hdr + 1, ogg_d->syncpoints, ogg_d->num_syncpoint * sizeof(ogg_syncpoint_t));
+    index_cache_save(ogg_d->cache_key, "ogg", hdr, len);
+    free(hdr);
 }
 
 static void fixup_vorbis_wf(sh_audio_t *sh, ogg_demuxer_t *od)
@@ -1188,7 +1285,10 @@ int demux_ogg_open(demuxer_t *demuxer)
         demuxer->movi_start = s->start_pos; // Needed for XCD (Ogg written in MODE2)
         demuxer->movi_end   = s->end_pos;
         demuxer->seekable   = 1;
-        demux_ogg_scan_stream(demuxer);
+        if (!demux_ogg_load_index(demuxer)) {
+            demux_ogg_scan_stream(demuxer);
+            demux_ogg_save_index(demuxer);
+        }
     }
     if (ogg_d->initial_granulepos == MP_NOPTS_VALUE)
         ogg_d->initial_granulepos = 0;
@@ -1402,6 +1502,125 @@ fallback:
 
 }
 
+/// Find the first page of the given logical stream with a granulepos,
+/// starting the search at start and giving up at end.
+static int demux_ogg_probe_page(demuxer_t *demuxer, int serialno,
+                                off_t start, off_t end, ogg_syncpoint_t *res)
+{
+    ogg_demuxer_t *ogg_d = demuxer->priv;
+    ogg_sync_state *sync = &ogg_d->sync;
+    ogg_page       *page = &ogg_d->page;
+    off_t pos = start;
+    int np;
+
+    stream_seek(demuxer->stream, demuxer->movi_start + start);
+    ogg_sync_reset(sync);
+    while (pos < end) {
+        np = ogg_sync_pageseek(sync, page);
+        if (np < 0) { // We had to skip some bytes
+            pos += -np;
+            continue;
+        }
+        if (np == 0) { // We need more data
+            char *buf = ogg_sync_buffer(sync, BLOCK_SIZE);
+            int len   = stream_read(demuxer->stream, buf, BLOCK_SIZE);
+
+            if (len <= 0)
+                break;
+            ogg_sync_wrote(sync, len);
+            continue;
+        }
+        if (ogg_page_serialno(page) == serialno && ogg_page_granulepos(page) >= 0) {
+            res->granulepos = ogg_page_granulepos(page);
+            res->page_pos   = pos;
+            return 1;
+        }
+        pos += np;
+    }
+    return 0;
+}
+
+/// Remember a page found by bisection so later seeks start from a
+/// narrower range.
+static void demux_ogg_add_probe(ogg_demuxer_t *ogg_d, const ogg_syncpoint_t *p)
+{
+    int i;
+
+    if (ogg_d->num_probe >= MAX_PROBE_CACHE)
+        return;
+    for (i = ogg_d->num_probe; i > 0; i--)
+        if (ogg_d->probes[i - 1].granulepos <= p->granulepos)
+            break;
+    if (i > 0 && ogg_d->probes[i - 1].page_pos == p->page_pos)
+        return;
+    ogg_d->probes = realloc_struct(ogg_d->probes, ogg_d->num_probe + 1, sizeof(ogg_syncpoint_t));
+    if (!ogg_d->probes) {
+        ogg_d->num_probe = 0;
+        return;
+    }
+    memmove(ogg_d->probes + i + 1, ogg_d->probes + i,
+            (ogg_d->num_probe - i) * sizeof(ogg_syncpoint_t));
+    ogg_d->probes[i] = *p;
+    ogg_d->num_probe++;
+}
+
+/**
+ * Find the position of the last page of a logical stream whose granulepos
+ * is not after gp, by bisecting over the page granule positions.
+ * Each step interpolates between the known bounds (but always discards at
+ * least 1/8 of the range), so a seek takes O(log(filesize)) page reads and
+ * no syncpoint table is needed.
+ * \return the page position relative to movi_start
+ */
+static off_t demux_ogg_bisect(demuxer_t *demuxer, ogg_stream_t *os, int64_t gp)
+{
+    ogg_demuxer_t *ogg_d = demuxer->priv;
+    ogg_syncpoint_t lo = { ogg_d->initial_granulepos, 0 };
+    ogg_syncpoint_t hi = { INT64_MAX, demuxer->movi_end - demuxer->movi_start };
+    ogg_syncpoint_t page;
+    int i, probes;
+
+    if (ogg_d->duration > 0)
+        hi.granulepos = ogg_d->final_granulepos;
+
+    // start from the closest pages found by earlier seeks
+    for (i = 0; i < ogg_d->num_probe; i++)
+        if (ogg_d->probes[i].granulepos > gp)
+            break;
+    if (i > 0 && ogg_d->probes[i - 1].page_pos >= lo.page_pos)
+        lo = ogg_d->probes[i - 1];
+    if (i < ogg_d->num_probe && ogg_d->probes[i].page_pos <= hi.page_pos)
+        hi = ogg_d->probes[i];
+
+    for (probes = 0; probes < BISECT_MAX_PROBES &&
+                     hi.page_pos - lo.page_pos > BISECT_MIN_RANGE; probes++) {
+        off_t range = hi.page_pos - lo.page_pos;
+        off_t mid;
+
+        if (hi.granulepos != INT64_MAX && hi.granulepos > lo.granulepos)
+            mid = lo.page_pos + (double)(gp - lo.granulepos) * range /
+                                (hi.granulepos - lo.granulepos);
+        else
+            mid = lo.page_pos + range / 2;
+        mid = av_clip64(mid, lo.page_pos + range / 8, hi.page_pos - range / 8);
+
+        if (!demux_ogg_probe_page(demuxer, os->stream.serialno, mid, hi.page_pos, &page)) {
+            // no complete page of this stream between mid and hi
+            hi.page_pos = mid;
+            continue;
+        }
+        demux_ogg_add_probe(ogg_d, &page);
+        if (page.granulepos <= gp)
+            lo = page;
+        else
+            hi = page;
+    }
+    mp_msg(MSGT_DEMUX, MSGL_DBG2,
+           "Ogg bisection: granulepos %"PRId64" -> page at %"PRId64" (%d probes)\n",
+           gp, (int64_t)lo.page_pos, probes);
+    return lo.page_pos;
+}
+
 static void demux_ogg_seek(demuxer_t *demuxer, float rel_seek_secs,
                            float audio_delay, int flags)
 {
@@ -1471,6 +1690,10 @@ static void demux_ogg_seek(demuxer_t *demuxer, float rel_seek_secs,
         }
         pos = ogg_d->syncpoints[sp].page_pos;
         precision = 0;
+    } else if (demuxer->video->id < 0 &&
+               (!(flags & SEEK_FACTOR) || ogg_d->duration > 0)) {
+        pos = demux_ogg_bisect(demuxer, os, gp);
+        precision = 0;
     } else {
         pos = flags & SEEK_ABSOLUTE ? 0 : ogg_d->pos;
         if (flags & SEEK_FACTOR)
@@ -1607,6 +1830,7 @@ static void demux_close_ogg(demuxer_t *demuxer)
         free(ogg_d->subs);
     }
     free(ogg_d->syncpoints);
+    free(ogg_d->probes);
     free(ogg_d->text_ids);
     if (ogg_d->text_langs) {
         for (i = 0; i < ogg_d->n_text; i++)
@@ -34,8 +34,10 @@
 #include "codec-cfg.h"
 
 #include "libvo/fastmemcpy.h"
+#include "osdep/timer.h"
 
 #include "stream/stream.h"
+#include "stream/cache2.h"
 #include "demuxer.h"
 #include "stheader.h"
 #include "mf.h"
@@ -733,13 +735,13 @@ int ds_fill_buffer(demux_stream_t *ds)
         // avoid printing the "too many ..." message over and over
         if (ds->eof)
             break;
-        if (!force_ni && (apacks >= MAX_PACKS || abytes >= MAX_PACK_BYTES)) {
+        if (!force_ni && (apacks >= MAX_PACKS || abytes >= MAX_QUEUE_BYTES)) {
             mp_msg(MSGT_DEMUXER, MSGL_ERR, MSGTR_TooManyAudioInBuffer,
                    apacks, abytes);
             mp_msg(MSGT_DEMUXER, MSGL_HINT, MSGTR_MaybeNI);
             break;
         }
-        if (!force_ni && (vpacks >= MAX_PACKS || vbytes >= MAX_PACK_BYTES)) {
+        if (!force_ni && (vpacks >= MAX_PACKS || vbytes >= MAX_QUEUE_BYTES)) {
             mp_msg(MSGT_DEMUXER, MSGL_ERR, MSGTR_TooManyVideoInBuffer,
                    vpacks, vbytes);
             mp_msg(MSGT_DEMUXER, MSGL_HINT, MSGTR_MaybeNI);
@@ -957,14 +959,14 @@ double ds_get_next_pts(demux_stream_t *ds)
     // as the next, otherwise we never get the pts for the first packet.
     while (!ds->first && (!ds->current || ds->buffer_pos)) {
         if (!force_ni && (demux->audio->packs >= MAX_PACKS
-            || demux->audio->bytes >= MAX_PACK_BYTES)) {
+            || demux->audio->bytes >= MAX_QUEUE_BYTES)) {
             mp_msg(MSGT_DEMUXER, MSGL_ERR, MSGTR_TooManyAudioInBuffer,
                    demux->audio->packs, demux->audio->bytes);
             mp_msg(MSGT_DEMUXER, MSGL_HINT, MSGTR_MaybeNI);
             return MP_NOPTS_VALUE;
         }
         if (!force_ni && (demux->video->packs >= MAX_PACKS
-            || demux->video->bytes >= MAX_PACK_BYTES)) {
+            || demux->video->bytes >= MAX_QUEUE_BYTES)) {
             mp_msg(MSGT_DEMUXER, MSGL_ERR, MSGTR_TooManyVideoInBuffer,
                    demux->video->packs, demux->video->bytes);
             mp_msg(MSGT_DEMUXER, MSGL_HINT, MSGTR_MaybeNI);
@@ -979,6 +981,84 @@ double ds_get_next_pts(demux_stream_t *ds)
     return ds->first->pts;
 }
 
+float demux_readahead = 0;        // seconds, -demuxer-readahead
+int demux_readahead_size = 2048;  // kB, -demuxer-readahead-size
+
+/**
+ * Timestamp up to which packets of ds have been read, MP_NOPTS_VALUE
+ * if it is not known.
+ */
+double ds_buffered_pts(demux_stream_t *ds)
+{
+    if (!ds)
+        return MP_NOPTS_VALUE;
+    if (ds->last && ds->last->pts != MP_NOPTS_VALUE)
+        return ds->last->pts;
+    // packets without timestamps, estimate from the bitrate
+    if (ds->pts != MP_NOPTS_VALUE && ds->sh && ds == ds->demuxer->audio &&
+        ((sh_audio_t *)ds->sh)->i_bps > 0)
+        return ds->pts + (double)ds->bytes / ((sh_audio_t *)ds->sh)->i_bps;
+    return ds->pts;
+}
+
+/// Seconds of ds read but not yet consumed, 0 if unknown.
+static double ds_ahead_secs(demux_stream_t *ds)
+{
+    double first = ds->pts != MP_NOPTS_VALUE ? ds->pts :
+                   ds->first ? ds->first->pts : MP_NOPTS_VALUE;
+    double end = ds_buffered_pts(ds);
+    if (first == MP_NOPTS_VALUE || end == MP_NOPTS_VALUE || end < first)
+        return 0;
+    return end - first;
+}
+
+// bytes the cache must hold before demux_fill_ahead() reads a packet
+#define READAHEAD_MIN_CACHED (64 * 1024)
+
+/**
+ * Read packets ahead of the decoders, in the time the player would
+ * otherwise sleep, until ds holds demux_readahead seconds, all streams
+ * together hold demux_readahead_size kB or time_ms milliseconds passed.
+ * With -cache it also stops when the cache might not hold the next
+ * packet yet, so the reads do not wait for the network.
+ * \return number of packets read
+ */
+int demux_fill_ahead(demuxer_t *demux, demux_stream_t *ds, int time_ms)
+{
+    unsigned start = GetTimerMS();
+    int max_bytes = FFMIN(demux_readahead_size * 1024LL, MAX_QUEUE_BYTES);
+    int64_t need = READAHEAD_MIN_CACHED, pos;
+    int n = 0;
+
+    if (demux_readahead <= 0 || !ds || ds->eof || demux->readahead_eof)
+        return 0;
+    // a read from the network or a pipe could block playback,
+    // only the cache can serve those without waiting
+    if (demux->stream->type == STREAMTYPE_STREAM && !demux->stream->cache_pid)
+        return 0;
+    while (GetTimerMS() - start < time_ms) {
+        if (ds_ahead_secs(ds) >= demux_readahead)
+            break;
+        // stay clear of the limits ds_fill_buffer() complains about
+        if (demux->audio->bytes + demux->video->bytes + demux->sub->bytes >= max_bytes ||
+            demux->audio->packs >= MAX_PACKS / 2 || demux->video->packs >= MAX_PACKS / 2)
+            break;
+#ifdef CONFIG_STREAM_CACHE
+        // guess the size of the next packet from the last one
+        if (demux->stream->cache_pid && cache_buffered_bytes(demux->stream) < need)
+            break;
+#endif
+        pos = stream_tell(demux->stream);
+        if (!demux_fill_buffer(demux, ds)) {
+            demux->readahead_eof = 1;
+            break;
+        }
+        need = FFMAX(2 * (stream_tell(demux->stream) - pos), READAHEAD_MIN_CACHED);
+        n++;
+    }
+    return n;
+}
+
 // ====================================================================
 
 void demuxer_help(void)
@@ -1371,6 +1451,7 @@ void demux_flush(demuxer_t *demuxer)
     ds_free_packs(demuxer->video);
     ds_free_packs(demuxer->audio);
     ds_free_packs(demuxer->sub);
+    demuxer->readahead_eof = 0;
 }
 
 int demux_seek(demuxer_t *demuxer, float rel_seek_secs, float audio_delay,
@@ -1391,6 +1472,12 @@ int demux_seek(demuxer_t *demuxer, float rel_seek_secs, float audio_delay,
         return 0;
     }
 
+    // Relative seeks start from the last packet read, which is past what
+    // the decoders consumed by whatever demux_fill_ahead() queued.
+    if (demux_readahead > 0 && !(flags & (SEEK_ABSOLUTE | SEEK_FACTOR)))
+        rel_seek_secs -= ds_ahead_secs(demuxer->audio->sh ? demuxer->audio :
+                                       demuxer->video);
+
     demux_flush(demuxer);
 
     demuxer->stream->eof = 0;
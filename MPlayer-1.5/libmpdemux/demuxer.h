@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "mp_mem.h"
 #include "stream/stream.h"
 #include "sub/ass_mp.h"
 #include "m_option.h"
@@ -38,6 +39,8 @@
 
 #define MAX_PACKS 4096
 #define MAX_PACK_BYTES 0x2000000
+// bytes queued in one demuxer stream before giving up, smaller with -lowmem
+#define MAX_QUEUE_BYTES (mp_mem_lowmem ? MP_LOWMEM_PACK_BYTES : MAX_PACK_BYTES)
 
 #define DEMUXER_TYPE_UNKNOWN 0
 #define DEMUXER_TYPE_MPEG_ES 1
@@ -129,6 +132,7 @@ typedef struct demux_packet {
   int refcount;   //refcounter for the master packet, if 0, buffer can be free()d
   struct demux_packet* master; //pointer to the master packet if this one is a cloned one
   struct demux_packet* next;
+  int alloc; // bytes accounted to MP_MEM_DEMUX
 } demux_packet_t;
 
 typedef struct {
@@ -182,6 +186,8 @@ extern int sub_demuxer_type;
 extern int audio_stream_cache;
 extern int correct_pts;
 extern int user_correct_pts;
+extern float demux_readahead;
+extern int demux_readahead_size;
 
 extern char *demuxer_name;
 extern char *audio_demuxer_name;
@@ -252,6 +258,7 @@ typedef struct demuxer {
   int type;    // demuxer type: mpeg PS, mpeg ES, avi, avi-ni, avi-nini, asf
   int file_format;  // file format: mpeg/avi/asf
   int seekable;  // flag
+  int readahead_eof; // demux_fill_ahead() reached the end of the file
   //
   demux_stream_t *audio; // audio buffer/demuxer
   demux_stream_t *video; // video buffer/demuxer
@@ -301,11 +308,14 @@ static inline demux_packet_t* new_demux_packet(int len){
     free(dp);
     return NULL;
   }
+  dp->alloc = sizeof(demux_packet_t) + (len > 0 ? len + MP_INPUT_BUFFER_PADDING_SIZE : 0);
+  mp_mem_account(MP_MEM_DEMUX, dp->alloc);
   return dp;
 }
 
 static inline void resize_demux_packet(demux_packet_t* dp, int len)
 {
+  int alloc;
   if(len > 0)
   {
      dp->buffer=(unsigned char *)realloc(dp->buffer,len + MP_INPUT_BUFFER_PADDING_SIZE);
@@ -320,6 +330,9 @@ static inline void resize_demux_packet(demux_packet_t* dp, int len)
      memset(dp->buffer + len, 0, MP_INPUT_BUFFER_PADDING_SIZE);
   else
      dp->len = 0;
+  alloc = sizeof(demux_packet_t) + (dp->buffer ? dp->len + MP_INPUT_BUFFER_PADDING_SIZE : 0);
+  mp_mem_account(MP_MEM_DEMUX, alloc - dp->alloc);
+  dp->alloc = alloc;
 }
 
 static inline demux_packet_t* clone_demux_packet(demux_packet_t* pack){
@@ -329,6 +342,8 @@ static inline demux_packet_t* clone_demux_packet(demux_packet_t* pack){
   dp->next=NULL;
   dp->refcount=0;
   dp->master=pack;
+  dp->alloc=sizeof(demux_packet_t);
+  mp_mem_account(MP_MEM_DEMUX, dp->alloc);
   pack->refcount++;
   return dp;
 }
@@ -337,6 +352,7 @@ static inline void free_demux_packet(demux_packet_t* dp){
   if (dp->master==NULL){  //dp is a master packet
     dp->refcount--;
     if (dp->refcount==0){
+      mp_mem_account(MP_MEM_DEMUX, -dp->alloc);
       free(dp->buffer);
       free(dp);
     }
@@ -344,6 +360,7 @@ static inline void free_demux_packet(demux_packet_t* dp){
   }
   // dp is a clone:
   free_demux_packet(dp->master);
+  mp_mem_account(MP_MEM_DEMUX, -dp->alloc);
   free(dp);
 }
 
@@ -410,6 +427,8 @@ int ds_get_packet_pts_endpts(demux_stream_t *ds, unsigned char **start, double *
 int ds_get_packet_sub(demux_stream_t *ds,unsigned char **start,
                       double *pts, double *endpts);
 double ds_get_next_pts(demux_stream_t *ds);
+double ds_buffered_pts(demux_stream_t *ds);
+int demux_fill_ahead(struct demuxer *demux, demux_stream_t *ds, int time_ms);
 int ds_parse(demux_stream_t *sh, uint8_t **buffer, int *len, double pts, off_t pos);
 void ds_clear_parser(demux_stream_t *sh);
 
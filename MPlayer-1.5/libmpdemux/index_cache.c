@@ -0,0 +1,229 @@
+/*
+ * Persistent cache of demuxer seek indexes, keyed by file content
+ *
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "mp_msg.h"
+#include "path.h"
+#include "libavutil/common.h"
+#include "stream/stream.h"
+#include "index_cache.h"
+
+#ifdef __MINGW32__
+#define mkdir(a,b) mkdir(a)
+#endif
+
+/// amount of data hashed at each end of the file
+#define INDEX_CACHE_HASH_SIZE (64 * 1024)
+#define INDEX_CACHE_MAGIC     "MPIDXC1"
+#define INDEX_CACHE_MAX_LEN   (64 * 1024 * 1024)
+
+int index_cache = 0;
+char *index_cache_dir = NULL;
+
+static uint64_t fnv1a(uint64_t h, const unsigned char *buf, int len)
+{
+    int i;
+    for (i = 0; i < len; i++) {
+        h ^= buf[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/**
+ * Computes the cache key of a local file: its size, its modification
+ * time and a hash of the first and last 64 KB.
+ * Unlike index_cache_key() this does not depend on -index-cache.
+ * The stream position is preserved.
+ * \param key buffer of at least INDEX_CACHE_KEY_LEN bytes
+ * \return 1 on success, 0 if the stream can not be cached
+ */
+int index_cache_content_key(stream_t *s, char *key)
+{
+    struct stat st;
+    unsigned char *buf;
+    int64_t pos, size;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    int len;
+
+    key[0] = 0;
+    if (s->type != STREAMTYPE_FILE || s->fd < 0 ||
+        fstat(s->fd, &st) || (s->flags & MP_STREAM_SEEK) != MP_STREAM_SEEK)
+        return 0;
+    size = s->end_pos - s->start_pos;
+    if (size <= 0)
+        return 0;
+    buf = malloc(INDEX_CACHE_HASH_SIZE);
+    if (!buf)
+        return 0;
+
+    pos = stream_tell(s);
+    stream_seek(s, s->start_pos);
+    len = stream_read(s, buf, INDEX_CACHE_HASH_SIZE);
+    h   = fnv1a(h, buf, len);
+    if (size > INDEX_CACHE_HASH_SIZE) {
+        stream_seek(s, FFMAX(s->end_pos - INDEX_CACHE_HASH_SIZE, s->start_pos + len));
+        len = stream_read(s, buf, INDEX_CACHE_HASH_SIZE);
+        h   = fnv1a(h, buf, len);
+    }
+    stream_reset(s);
+    stream_seek(s, pos);
+    free(buf);
+
+    snprintf(key, INDEX_CACHE_KEY_LEN, "%016"PRIx64"%016"PRIx64"%016"PRIx64,
+             (uint64_t)size, (uint64_t)st.st_mtime, h);
+    return 1;
+}
+
+/**
+ * Computes the cache key of a local file if -index-cache is enabled.
+ * \param key buffer of at least INDEX_CACHE_KEY_LEN bytes
+ * \return 1 on success, 0 if the stream can not be cached
+ */
+int index_cache_key(stream_t *s, char *key)
+{
+    key[0] = 0;
+    return index_cache && index_cache_content_key(s, key);
+}
+
+static char *index_cache_filename(const char *key, const char *tag)
+{
+    char *dir = index_cache_dir ? strdup(index_cache_dir) : get_path("index_cache");
+    char *name;
+    int len;
+
+    if (!dir)
+        return NULL;
+    len  = strlen(dir) + strlen(key) + strlen(tag) + 3;
+    name = malloc(len);
+    if (name)
+        snprintf(name, len, "%s/%s.%s", dir, key, tag);
+    free(dir);
+    return name;
+}
+
+/**
+ * Loads the data stored for a file by index_cache_save().
+ * \param key cache key from index_cache_key(), empty if not cacheable
+ * \param tag short name of the module that saved the data
+ * \param len set to the length of the returned data
+ * \return malloc()ed data or NULL on cache miss
+ */
+void *index_cache_load(const char *key, const char *tag, int *len)
+{
+    char magic[sizeof(INDEX_CACHE_MAGIC)];
+    char *name;
+    void *data = NULL;
+    FILE *fp;
+    int32_t size;
+
+    if (!key[0] || !(name = index_cache_filename(key, tag)))
+        return NULL;
+    fp = fopen(name, "rb");
+    if (!fp)
+        goto out;
+    if (fread(magic, sizeof(magic), 1, fp) != 1 ||
+        memcmp(magic, INDEX_CACHE_MAGIC, sizeof(magic)) ||
+        fread(&size, sizeof(size), 1, fp) != 1 ||
+        size <= 0 || size > INDEX_CACHE_MAX_LEN)
+        goto err;
+    data = malloc(size);
+    if (!data || fread(data, size, 1, fp) != 1)
+        goto err;
+    fclose(fp);
+    *len = size;
+    mp_msg(MSGT_DEMUX, MSGL_V, "Loaded cached data from %s\n", name);
+    goto out;
+
+err:
+    mp_msg(MSGT_DEMUX, MSGL_WARN, "Ignoring invalid index cache file %s\n", name);
+    free(data);
+    data = NULL;
+    fclose(fp);
+out:
+    free(name);
+    return data;
+}
+
+/**
+ * Stores module specific data, e.g. a demuxer seek index, for a file.
+ * The file is written under a temporary name and renamed so concurrent
+ * players never see a partial entry.
+ */
+void index_cache_save(const char *key, const char *tag, const void *data, int len)
+{
+    char *name, *tmp, *dir;
+    FILE *fp;
+    int32_t size = len;
+    int ok;
+
+    if (!key[0] || len <= 0 || len > INDEX_CACHE_MAX_LEN)
+        return;
+    dir = index_cache_dir ? strdup(index_cache_dir) : get_path("index_cache");
+    if (!dir)
+        return;
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        mp_msg(MSGT_DEMUX, MSGL_WARN, "Failed to create seek index cache directory %s: %s\n",
+               dir, strerror(errno));
+        free(dir);
+        return;
+    }
+    free(dir);
+
+    name = index_cache_filename(key, tag);
+    if (!name)
+        return;
+    tmp = malloc(strlen(name) + 16);
+    if (!tmp) {
+        free(name);
+        return;
+    }
+    sprintf(tmp, "%s.%d", name, (int)getpid());
+    fp = fopen(tmp, "wb");
+    if (!fp) {
+        mp_msg(MSGT_DEMUX, MSGL_WARN, "Failed to write seek index cache file %s: %s\n",
+               tmp, strerror(errno));
+        goto out;
+    }
+    ok = fwrite(INDEX_CACHE_MAGIC, sizeof(INDEX_CACHE_MAGIC), 1, fp) == 1 &&
+         fwrite(&size, sizeof(size), 1, fp) == 1 &&
+         fwrite(data, len, 1, fp) == 1;
+    ok = !fclose(fp) && ok;
+#ifdef __MINGW32__
+    if (ok)
+        unlink(name);
+#endif
+    if (ok && !rename(tmp, name))
+        mp_msg(MSGT_DEMUX, MSGL_V, "Saved cached data to %s\n", name);
+    else
+        unlink(tmp);
+out:
+    free(tmp);
+    free(name);
+}
@@ -0,0 +1,35 @@
+/*
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPLAYER_INDEX_CACHE_H
+#define MPLAYER_INDEX_CACHE_H
+
+#include "stream/stream.h"
+
+/// size + mtime + content hash, as hex digits, plus terminating 0
+#define INDEX_CACHE_KEY_LEN 49
+
+extern int index_cache;
+extern char *index_cache_dir;
+
+int index_cache_content_key(stream_t *s, char *key);
+int index_cache_key(stream_t *s, char *key);
+void *index_cache_load(const char *key, const char *tag, int *len);
+void index_cache_save(const char *key, const char *tag, const void *data, int len);
+
+#endif /* MPLAYER_INDEX_CACHE_H */
@@ -76,6 +76,15 @@ typedef struct sh_audio {
   char* a_out_buffer;
   int a_out_buffer_len;
   int a_out_buffer_size;
+  // decoded audio kept for seeking back, see -audio-seek-buffer:
+  char* seek_buf;
+  int seek_buf_size;
+  int seek_buf_pos;    // write position
+  int seek_buf_len;    // valid bytes before seek_buf_pos
+  int seek_buf_replay; // bytes of these still to be fed to the filters
+  double seek_buf_pts; // pts of the end of the data
+  int seek_buf_keep;   // set by the player while seeks can use the data
+  int mem_accounted; // bytes of the buffers above accounted to MP_MEM_DECODER
 //  void* audio_out;        // the audio_out handle, used for this audio stream
   struct af_stream *afilter;          // the audio filter stream
   const struct ad_functions *ad_driver;
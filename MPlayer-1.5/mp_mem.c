@@ -0,0 +1,69 @@
+/*
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/**
+ * \file mp_mem.c
+ * Accounting of the memory used by the subsystems of the player. Only
+ * the large and long lived buffers are accounted, not every allocation.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "mp_msg.h"
+#include "mp_mem.h"
+
+int mp_mem_lowmem;
+int64_t mp_mem_used[MP_MEM_TAGS + 1];
+int64_t mp_mem_peak[MP_MEM_TAGS + 1];
+
+static const char * const tag_names[MP_MEM_TAGS] = {
+    [MP_MEM_STREAM]  = "stream",
+    [MP_MEM_CACHE]   = "cache",
+    [MP_MEM_DEMUX]   = "demux",
+    [MP_MEM_DECODER] = "decoder",
+    [MP_MEM_LIBAF]   = "libaf",
+    [MP_MEM_AO]      = "ao",
+};
+
+int mp_mem_tag_by_name(const char *name)
+{
+    int i;
+
+    for (i = 0; i < MP_MEM_TAGS; i++)
+        if (!strcmp(name, tag_names[i]))
+            return i;
+    return -1;
+}
+
+void mp_mem_print(int level)
+{
+    int i;
+
+    if (!mp_msg_test(MSGT_GLOBAL, level))
+        return;
+    mp_msg(MSGT_GLOBAL, level, "Memory by subsystem (in use / peak):\n");
+    for (i = 0; i < MP_MEM_TAGS; i++)
+        mp_msg(MSGT_GLOBAL, level, "  %-8s %8"PRId64" / %8"PRId64" kB\n",
+               tag_names[i], mp_mem_get(&mp_mem_used[i]) >> 10,
+               mp_mem_get(&mp_mem_peak[i]) >> 10);
+    mp_msg(MSGT_GLOBAL, level, "  %-8s %8"PRId64" / %8"PRId64" kB\n",
+           "total", mp_mem_get(&mp_mem_used[MP_MEM_TAGS]) >> 10,
+           mp_mem_get(&mp_mem_peak[MP_MEM_TAGS]) >> 10);
+}
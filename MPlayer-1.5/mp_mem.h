@@ -0,0 +1,78 @@
+/*
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MPLAYER_MP_MEM_H
+#define MPLAYER_MP_MEM_H
+
+#include <stdint.h>
+
+/// Subsystems the memory of the player is accounted to.
+enum mp_mem_tag {
+    MP_MEM_STREAM,
+    MP_MEM_CACHE,
+    MP_MEM_DEMUX,
+    MP_MEM_DECODER,
+    MP_MEM_LIBAF,
+    MP_MEM_AO,
+    MP_MEM_TAGS
+};
+
+// limits used with -lowmem
+#define MP_LOWMEM_CACHE        1024   // kB, -cache
+#define MP_LOWMEM_READAHEAD    4      // reads, -readahead
+#define MP_LOWMEM_READAHEAD_SZ 64     // kB, -readahead-size
+#define MP_LOWMEM_PACK_BYTES   0x400000 // bytes queued per demuxer stream
+
+extern int mp_mem_lowmem;
+/// Bytes in use and the peak for every tag, the last entry is the total.
+extern int64_t mp_mem_used[MP_MEM_TAGS + 1];
+extern int64_t mp_mem_peak[MP_MEM_TAGS + 1];
+
+/// Read a counter of mp_mem_used or mp_mem_peak.
+static inline int64_t mp_mem_get(const int64_t *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static inline void mp_mem_raise_peak(int64_t *peak, int64_t used)
+{
+    int64_t old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (used > old &&
+           !__atomic_compare_exchange_n(peak, &old, used, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/**
+ * Account bytes allocated (positive) or freed (negative) by a subsystem.
+ * Thread safe, the stream and probe workers account their buffers too.
+ */
+static inline void mp_mem_account(enum mp_mem_tag tag, int64_t bytes)
+{
+    int64_t used  = __atomic_fetch_add(&mp_mem_used[tag], bytes, __ATOMIC_RELAXED) + bytes;
+    int64_t total = __atomic_fetch_add(&mp_mem_used[MP_MEM_TAGS], bytes, __ATOMIC_RELAXED) + bytes;
+    mp_mem_raise_peak(&mp_mem_peak[tag], used);
+    mp_mem_raise_peak(&mp_mem_peak[MP_MEM_TAGS], total);
+}
+
+/// Return the tag with the given name, -1 if there is none.
+int mp_mem_tag_by_name(const char *name);
+void mp_mem_print(int level);
+
+#endif /* MPLAYER_MP_MEM_H */
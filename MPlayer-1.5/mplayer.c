@@ -38,6 +38,7 @@
 
 #ifndef __MINGW32__
 #include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
 #else
 #define SIGHUP  1       /* hangup */
@@ -82,6 +83,7 @@
 #include "libmpcodecs/vd.h"
 #include "libmpcodecs/vf.h"
 #include "libmpdemux/demuxer.h"
+#include "libmpdemux/index_cache.h"
 #include "libmpdemux/stheader.h"
 #include "sub/font_load.h"
 #include "sub/sub.h"
@@ -107,6 +109,7 @@
 #include "mixer.h"
 #include "mp_core.h"
 #include "mp_fifo.h"
+#include "mp_mem.h"
 #include "mp_msg.h"
 #include "mp_strings.h"
 #include "mpcommon.h"
@@ -118,6 +121,7 @@
 #include "path.h"
 #include "playtree.h"
 #include "playtreeparser.h"
+#include "probe.h"
 #include "sub/spudec.h"
 #include "sub/subreader.h"
 #include "sub/vobsub.h"
@@ -173,6 +177,8 @@ static double audio_time_usage;
 static int total_time_usage_start;
 static int total_frame_cnt;
 static int drop_frame_cnt; // total number of dropped frames
+static unsigned int open_time_start;
+static int first_sample_time; // us from opening the file to the first audio output
 int benchmark;
 
 // options:
@@ -727,6 +733,7 @@ void exit_player_with_rc(enum exit_reason how, int rc)
 
     free(edl_records); // free mem allocated for EDL
     edl_records = NULL;
+    mp_mem_print(MSGL_V);
     switch (how) {
     case EXIT_QUIT:
         mp_msg(MSGT_CPLAYER, MSGL_INFO, MSGTR_ExitingHow, MSGTR_Exit_quit);
@@ -1313,6 +1320,24 @@ static void stream_dump_progress_end(void)
            stream_dump_count, stream_dump_name);
 }
 
+/**
+ * Tell the filters that keep per-track results which file is played.
+ * Hashing the file is only worth it if such a filter is in the chain.
+ */
+static void set_afilter_content(sh_audio_t *sh_audio)
+{
+    char key[INDEX_CACHE_KEY_LEN];
+    af_content_t content;
+
+    if (!af_get(sh_audio->afilter, "loudnorm") || !mpctx->stream ||
+        !index_cache_content_key(mpctx->stream, key))
+        return;
+    content.key    = key;
+    content.track  = mpctx->d_audio->id;
+    content.length = demuxer_get_time_length(mpctx->demuxer);
+    af_control_all(sh_audio->afilter, AF_CONTROL_CONTENT | AF_CONTROL_SET, &content);
+}
+
 /**
  * @brief Build a chain of audio filters that converts the input format.
  * to the ao's format, taking into account the current playback_speed.
@@ -1345,6 +1370,8 @@ static int build_afilter_chain(sh_audio_t *sh_audio, ao_data_t *ao_data)
     result = init_audio_filters(sh_audio, new_srate,
                                 &ao_data->samplerate, &ao_data->channels, &ao_data->format);
     mpctx->mixer.afilter = sh_audio->afilter;
+    if (result)
+        set_afilter_content(sh_audio);
     return result;
 }
 
@@ -1713,8 +1740,9 @@ static double written_audio_pts(sh_audio_t *sh_audio, demux_stream_t *d_audio)
     // Now a_pts hopefully holds the pts for end of audio from decoder.
     // Substract data in buffers between decoder and audio out.
 
-    // Decoded but not filtered
-    a_pts -= sh_audio->a_buffer_len / (double)sh_audio->o_bps;
+    // Decoded but not filtered, replayed after a seek in -audio-seek-buffer
+    a_pts -= (sh_audio->a_buffer_len + sh_audio->seek_buf_replay) /
+             (double)sh_audio->o_bps;
 
     // Data buffered in audio filters, measured in bytes of "missing" output
     buffered_output = af_calc_delay(sh_audio->afilter);
@@ -1738,6 +1766,70 @@ double playing_audio_pts(sh_audio_t *sh_audio, demux_stream_t *d_audio,
            audio_out->get_delay();
 }
 
+// Tell the audio filters which audio is being played, for filters that
+// timestamp what they publish.
+static void update_afilter_clock(int paused)
+{
+    sh_audio_t *sh_audio = mpctx->sh_audio;
+    af_clock_t clk;
+
+    if (!sh_audio || !sh_audio->afilter || !mpctx->audio_out)
+        return;
+    clk.in_pts   = calc_a_pts(sh_audio, mpctx->d_audio) -
+                   (sh_audio->a_buffer_len + sh_audio->seek_buf_replay) /
+                   (double)sh_audio->o_bps;
+    clk.play_pts = playing_audio_pts(sh_audio, mpctx->d_audio, mpctx->audio_out);
+    clk.speed    = paused ? 0 : playback_speed;
+    af_control_all(sh_audio->afilter,
+                   AF_CONTROL_PLAYBACK_CLOCK | AF_CONTROL_SET, &clk);
+}
+
+// In-band metadata change (e.g. ICY StreamTitle) waiting to be shown.
+// meta_event_state: 0 none, 1 waiting for the decoder to reach its stream
+// position, 2 waiting for the audio at meta_event_pts to be played.
+static struct stream_meta_event meta_event;
+static int meta_event_state;
+static double meta_event_pts;
+
+static void show_meta_event(void)
+{
+    mp_msg(MSGT_CPLAYER, MSGL_INFO, "\nICY Info: %s\n", meta_event.info);
+    if (meta_event.title[0]) {
+        mp_msg(MSGT_IDENTIFY, MSGL_INFO, "ID_ICY_TITLE=%s\n", meta_event.title);
+        if (mpctx->demuxer)
+            demux_info_add(mpctx->demuxer, "Title", meta_event.title);
+    }
+    meta_event_state = 0;
+}
+
+/**
+ * Fetches metadata changes from the stream and reports them once the
+ * audio they were sent with is heard instead of when they were received,
+ * which can be the whole cache earlier.
+ */
+static void update_meta_events(void)
+{
+    if (!mpctx->stream)
+        return;
+    if (!meta_event_state) {
+        if (stream_control(mpctx->stream, STREAM_CTRL_GET_META_EVENT, &meta_event) != STREAM_OK)
+            return;
+        meta_event_state = 1;
+    }
+    if (!mpctx->sh_audio) {
+        show_meta_event();
+        return;
+    }
+    if (meta_event_state == 1) {
+        if (mpctx->d_audio->pos < meta_event.pos && !mpctx->d_audio->eof)
+            return;
+        meta_event_pts   = written_audio_pts(mpctx->sh_audio, mpctx->d_audio);
+        meta_event_state = 2;
+    }
+    if (playing_audio_pts(mpctx->sh_audio, mpctx->d_audio, mpctx->audio_out) >= meta_event_pts)
+        show_meta_event();
+}
+
 static int is_at_end(MPContext *mpctx, m_time_size_t *end_at, double pts)
 {
     switch (end_at->type) {
@@ -2127,6 +2219,9 @@ static int fill_audio_out_buffers(void)
 
     current_module = "play_audio";
 
+    // seek_audio_buffered() only uses the decoded audio without video
+    sh_audio->seek_buf_keep = !mpctx->sh_video;
+
     while (1) {
         int sleep_time;
         // all the current uses of ao_data.pts seem to be in aos that handle
@@ -2147,6 +2242,11 @@ static int fill_audio_out_buffers(void)
         sleep_time = (ao_data.outburst - bytes_to_write) * 1000 / ao_data.bps;
         if (sleep_time < 10)
             sleep_time = 10;                  // limit to 100 wakeups per second
+        // read packets ahead instead of sleeping, see -demuxer-readahead
+        if (demux_fill_ahead(mpctx->demuxer, mpctx->d_audio, sleep_time / 2)) {
+            timeout--;
+            continue;
+        }
         usec_sleep(sleep_time * 1000);
     }
 
@@ -2160,6 +2260,7 @@ static int fill_audio_out_buffers(void)
         // Fill buffer if needed:
         current_module = "decode_audio";
         t = GetTimer();
+        update_afilter_clock(0);
         if (!sh_audio->a_buffer_format_change) {
             res = mp_decode_audio(sh_audio, playsize);
             sh_audio->a_buffer_format_change = res == -2;
@@ -2191,6 +2292,8 @@ static int fill_audio_out_buffers(void)
         playsize    = mpctx->audio_out->play(sh_audio->a_out_buffer, playsize, playflags);
 
         if (playsize > 0) {
+            if (first_sample_time < 0)
+                first_sample_time = GetTimer() - open_time_start;
             sh_audio->a_out_buffer_len -= playsize;
             memmove(sh_audio->a_out_buffer, &sh_audio->a_out_buffer[playsize],
                     sh_audio->a_out_buffer_len);
@@ -2285,6 +2388,13 @@ static int sleep_until_update(float *time_frame, float *aq_sleep_time)
 
     *aq_sleep_time += *time_frame;
 
+    // use part of the time until the next frame to read packets ahead
+    if (*time_frame > 0.005 &&
+        demux_fill_ahead(mpctx->demuxer,
+                         mpctx->sh_audio ? mpctx->d_audio : mpctx->d_video,
+                         *time_frame * 500))
+        *time_frame -= GetRelativeTime();
+
     //============================== SLEEP: ===================================
 
     // flag 256 means: libvo driver does its timing (dvb card)
@@ -2570,8 +2680,10 @@ static void pause_loop(void)
     if (mpctx->video_out && mpctx->sh_video && vo_config_count)
         mpctx->video_out->control(VOCTRL_PAUSE, NULL);
 
-    if (mpctx->audio_out && mpctx->sh_audio)
+    if (mpctx->audio_out && mpctx->sh_audio) {
         mpctx->audio_out->pause();  // pause audio, keep data if possible
+        update_afilter_clock(1);
+    }
 
     while ((cmd = mp_input_get_cmd(20, 1, 1)) == NULL || cmd->pausing == 4) {
         if (cmd) {
@@ -2725,13 +2837,32 @@ static void edl_update(MPContext *mpctx)
     }
 }
 
+// Audio-only playback: take seeks close behind the playback position
+// from the decoded audio kept by -audio-seek-buffer, without touching
+// the demuxer.
+static int seek_audio_buffered(MPContext *mpctx, double amount, int style)
+{
+    double pts = amount;
+
+    if (mpctx->sh_video || !mpctx->sh_audio || (style & SEEK_FACTOR))
+        return 0;
+    if (!(style & SEEK_ABSOLUTE))
+        pts += playing_audio_pts(mpctx->sh_audio, mpctx->d_audio,
+                                 mpctx->audio_out);
+    if (!seek_audio_buffer(mpctx->sh_audio, pts))
+        return 0;
+    mp_msg(MSGT_CPLAYER, MSGL_DBG2, "Seek to %.3f served from the decoded audio.\n", pts);
+    return 1;
+}
+
 // style & SEEK_ABSOLUTE == 0 means seek relative to current position, == 1 means absolute
 // style & SEEK_FACTOR   == 0 means amount in seconds, == 2 means fraction of file length
 // return -1 if seek failed (non-seekable stream?), 0 otherwise
 static int seek(MPContext *mpctx, double amount, int style)
 {
     current_module = "seek";
-    if (demux_seek(mpctx->demuxer, amount, audio_delay, style) == 0)
+    if (!seek_audio_buffered(mpctx, amount, style) &&
+        demux_seek(mpctx->demuxer, amount, audio_delay, style) == 0)
         return -1;
 
     mpctx->startup_decode_retry = DEFAULT_STARTUP_DECODE_RETRY;
@@ -2945,6 +3076,9 @@ int main(int argc, char *argv[])
     if (opt_exit)
         exit_player(EXIT_NONE);
 
+    if (probe_batch)
+        exit_player_with_rc(EXIT_NONE, probe_batch_run());
+
     if (!filename && !player_idle_mode && !use_gui) {
         // no file/vcd/dvd -> show HELP:
         mp_msg(MSGT_CPLAYER, MSGL_INFO, help_text);
@@ -3085,6 +3219,9 @@ int main(int argc, char *argv[])
 
 play_next_file:
 
+    open_time_start   = GetTimer();
+    first_sample_time = -1;
+
     // init global sub numbers
     mpctx->global_sub_size = 0;
     memset(mpctx->sub_counts, 0, sizeof(mpctx->sub_counts));
@@ -3369,10 +3506,12 @@ play_next_file:
 goto_enable_cache:
     if (stream_cache_size > 0) {
         int res;
+        int cache_size = mp_mem_lowmem ? FFMIN(stream_cache_size, MP_LOWMEM_CACHE)
+                                       : stream_cache_size;
         current_module = "enable_cache";
-        res = stream_enable_cache(mpctx->stream, stream_cache_size * 1024ull,
-                                  stream_cache_size * 1024ull * (stream_cache_min_percent / 100.0),
-                                  stream_cache_size * 1024ull * (stream_cache_seek_min_percent / 100.0));
+        res = stream_enable_cache(mpctx->stream, cache_size * 1024ull,
+                                  cache_size * 1024ull * (stream_cache_min_percent / 100.0),
+                                  cache_size * 1024ull * (stream_cache_seek_min_percent / 100.0));
         if (res == 0)
             if ((mpctx->eof = libmpdemux_was_interrupted(PT_NEXT_ENTRY)))
                 goto goto_next_file;
@@ -3729,6 +3868,7 @@ goto_enable_cache:
         drop_frame_cnt  = 0;         // fix for multifile fps benchmark
         play_n_frames   = play_n_frames_mf;
         mpctx->startup_decode_retry = DEFAULT_STARTUP_DECODE_RETRY;
+        meta_event_state = 0;
 
         if (play_n_frames == 0) {
             mpctx->eof = PT_NEXT_ENTRY;
@@ -3780,6 +3920,8 @@ goto_enable_cache:
                     if (!mpctx->sh_video)
                         mpctx->eof = PT_NEXT_ENTRY;
 
+            update_meta_events();
+
             if (!mpctx->sh_video) {
                 // handle audio-only case:
                 double a_pos = 0;
@@ -4113,6 +4255,22 @@ goto_next_file:  // don't jump here after ao/vo/getch initialization!
                    100 * drop_frame_cnt / total_frame_cnt,
                    total_frame_cnt,
                    (total_time_usage > 0.5) ? (total_frame_cnt / total_time_usage) : 0);
+        if (first_sample_time >= 0)
+            mp_msg(MSGT_CPLAYER, MSGL_INFO, "BENCHMARKa: first sample: %8.3fs\n",
+                   first_sample_time * 0.000001);
+#ifndef __MINGW32__
+        {
+            struct rusage ru;
+            if (!getrusage(RUSAGE_SELF, &ru))
+#ifdef __APPLE__
+                mp_msg(MSGT_CPLAYER, MSGL_INFO, "BENCHMARKm: peak RSS: %ld kB\n", (long)ru.ru_maxrss / 1024);
+#else
+                mp_msg(MSGT_CPLAYER, MSGL_INFO, "BENCHMARKm: peak RSS: %ld kB\n", (long)ru.ru_maxrss);
+#endif
+        }
+#endif
+        mp_msg(MSGT_CPLAYER, MSGL_INFO, "BENCHMARKm: peak accounted: %"PRId64" kB\n",
+               mp_mem_get(&mp_mem_peak[MP_MEM_TAGS]) >> 10);
     }
 
     // time to uninit all, except global stuff:
@@ -0,0 +1,351 @@
+/*
+ * Batch media probing for library scans
+ *
+ * Reads one file name per line from stdin, opens each file with the
+ * stream and demuxer layers only and writes one JSON object per line to
+ * stdout. No decoder or audio output is initialized, the length comes
+ * from the demuxer (Xing/VBRI, FLAC STREAMINFO, last Ogg granule, ...).
+ *
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#if !defined(__MINGW32__) && !defined(__OS2__)
+#define PROBE_FORK 1
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#else
+#define PROBE_FORK 0
+#endif
+
+#include "libavutil/bprint.h"
+#include "libavutil/common.h"
+#include "mp_msg.h"
+#include "mpcommon.h"
+#include "probe.h"
+#include "stream/stream.h"
+#include "libmpdemux/demuxer.h"
+#include "libmpdemux/stheader.h"
+
+#define PROBE_MAX_THREADS 64
+#define PROBE_LINE_SIZE   4096
+
+int probe_batch   = 0;
+int probe_threads = 4;
+
+static void json_string(AVBPrint *bp, const char *s)
+{
+    av_bprint_chars(bp, '"', 1);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        switch (c) {
+        case '"':  av_bprintf(bp, "\\\""); break;
+        case '\\': av_bprintf(bp, "\\\\"); break;
+        case '\n': av_bprintf(bp, "\\n");  break;
+        case '\r': av_bprintf(bp, "\\r");  break;
+        case '\t': av_bprintf(bp, "\\t");  break;
+        default:
+            if (c < 0x20)
+                av_bprintf(bp, "\\u%04x", c);
+            else
+                av_bprint_chars(bp, c, 1);
+        }
+    }
+    av_bprint_chars(bp, '"', 1);
+}
+
+static void probe_file(char *filename, AVBPrint *bp)
+{
+    int file_format = DEMUXER_TYPE_UNKNOWN;
+    stream_t *stream;
+    demuxer_t *demuxer;
+    sh_audio_t *sh_audio;
+    double length;
+    int res, i;
+
+    av_bprintf(bp, "{\"file\":");
+    json_string(bp, filename);
+
+    stream = open_stream_full(filename, STREAM_READ, NULL, &file_format);
+    if (!stream) {
+        av_bprintf(bp, ",\"error\":\"open\"}\n");
+        return;
+    }
+    demuxer = demux_open(stream, file_format, audio_id, -2, -2, filename);
+    if (!demuxer) {
+        av_bprintf(bp, ",\"error\":\"format\"}\n");
+        free_stream(stream);
+        return;
+    }
+
+    av_bprintf(bp, ",\"demuxer\":");
+    json_string(bp, demuxer->desc->name);
+    sh_audio = demuxer->audio->sh;
+    if (sh_audio) {
+        if (sh_audio->format >= 0x20202020)
+            av_bprintf(bp, ",\"format\":\"%.4s\"", (char *)&sh_audio->format);
+        else
+            av_bprintf(bp, ",\"format\":\"%d\"", sh_audio->format);
+        av_bprintf(bp, ",\"bitrate\":%d,\"rate\":%d,\"channels\":%d",
+                   sh_audio->i_bps * 8, sh_audio->samplerate, sh_audio->channels);
+    }
+    if (demuxer->video->sh)
+        av_bprintf(bp, ",\"video\":true");
+
+    // the length is exact when the demuxer knows it from the headers,
+    // otherwise it is estimated from the file size and bitrate
+    res    = demux_control(demuxer, DEMUXER_CTRL_GET_TIME_LENGTH, &length);
+    if (res != DEMUXER_CTRL_OK)
+        length = demuxer_get_time_length(demuxer);
+    av_bprintf(bp, ",\"length\":%.3f,\"length_exact\":%s,\"seekable\":%s",
+               length, res == DEMUXER_CTRL_OK ? "true" : "false",
+               stream->seek && demuxer->seekable ? "true" : "false");
+
+    if (demuxer->info && demuxer->info[0]) {
+        av_bprintf(bp, ",\"tags\":{");
+        for (i = 0; demuxer->info[2 * i]; i++) {
+            if (i)
+                av_bprint_chars(bp, ',', 1);
+            json_string(bp, demuxer->info[2 * i]);
+            av_bprint_chars(bp, ':', 1);
+            json_string(bp, demuxer->info[2 * i + 1] ? demuxer->info[2 * i + 1] : "");
+        }
+        av_bprint_chars(bp, '}', 1);
+    }
+    av_bprintf(bp, "}\n");
+
+    free_demuxer(demuxer);
+    free_stream(stream);
+}
+
+/// Strip the line end, 0 for lines to skip.
+static int probe_line(char *line)
+{
+    int len = strlen(line);
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        line[--len] = 0;
+    return len;
+}
+
+/// Probe each line of in and write one record per file to out.
+static void probe_loop(FILE *in, FILE *out)
+{
+    char line[PROBE_LINE_SIZE];
+    AVBPrint bp;
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+    while (fgets(line, sizeof(line), in)) {
+        if (!probe_line(line))
+            continue;
+        av_bprint_clear(&bp);
+        probe_file(line, &bp);
+        if (!av_bprint_is_complete(&bp))
+            continue;
+        fputs(bp.str, out);
+        fflush(out);
+    }
+    av_bprint_finalize(&bp, NULL);
+}
+
+#if PROBE_FORK
+/*
+ * The stream and demuxer layers are not reentrant (static probe state in
+ * the demuxers, global message and registry state), so files are probed
+ * in worker processes. The parent hands out one file name at a time and
+ * copies each finished record, which is always a single line, to stdout.
+ */
+struct probe_worker {
+    pid_t pid;
+    FILE *cmd;      // file names to the worker
+    int res;        // records from the worker
+    AVBPrint rec;   // partial record read from res
+    char file[PROBE_LINE_SIZE]; // file being probed, "" when idle
+};
+
+static struct probe_worker probe_workers[PROBE_MAX_THREADS];
+static int probe_nworkers;
+
+static int probe_spawn(struct probe_worker *w)
+{
+    int cmd[2], res[2], i;
+
+    if (pipe(cmd))
+        return 0;
+    if (pipe(res)) {
+        close(cmd[0]);
+        close(cmd[1]);
+        return 0;
+    }
+    fflush(stdout);
+    w->pid = fork();
+    if (w->pid < 0) {
+        close(cmd[0]); close(cmd[1]);
+        close(res[0]); close(res[1]);
+        return 0;
+    }
+    if (!w->pid) {
+        FILE *in  = fdopen(cmd[0], "r");
+        FILE *out = fdopen(res[1], "w");
+        close(cmd[1]);
+        close(res[0]);
+        // the other workers must see the end of their list
+        for (i = 0; i < probe_nworkers; i++) {
+            if (probe_workers[i].cmd)
+                close(fileno(probe_workers[i].cmd));
+            if (probe_workers[i].res >= 0)
+                close(probe_workers[i].res);
+        }
+        if (in && out)
+            probe_loop(in, out);
+        _exit(0);
+    }
+    close(cmd[0]);
+    close(res[1]);
+    w->cmd = fdopen(cmd[1], "w");
+    w->res = res[0];
+    av_bprint_clear(&w->rec);
+    return 1;
+}
+
+static void probe_reap(struct probe_worker *w)
+{
+    if (w->cmd)
+        fclose(w->cmd);
+    if (w->res >= 0)
+        close(w->res);
+    if (w->pid > 0)
+        waitpid(w->pid, NULL, 0);
+    w->pid = 0;
+    w->cmd = NULL;
+    w->res = -1;
+}
+
+/// Hand the next file name on stdin to w, 0 at the end of the list.
+static int probe_next(struct probe_worker *w)
+{
+    while (fgets(w->file, sizeof(w->file), stdin)) {
+        if (!probe_line(w->file))
+            continue;
+        if (!w->cmd && !probe_spawn(w))
+            break;
+        fprintf(w->cmd, "%s\n", w->file);
+        fflush(w->cmd);
+        return 1;
+    }
+    w->file[0] = 0;
+    if (w->cmd) {
+        fclose(w->cmd);
+        w->cmd = NULL;
+    }
+    return 0;
+}
+
+static void probe_run_workers(int n)
+{
+    struct probe_worker *w = probe_workers;
+    struct pollfd fds[PROBE_MAX_THREADS];
+    int i, busy = 0, eof = 0;
+
+    probe_nworkers = n;
+
+    for (i = 0; i < n; i++) {
+        av_bprint_init(&w[i].rec, 0, AV_BPRINT_SIZE_UNLIMITED);
+        w[i].pid = 0;
+        w[i].cmd = NULL;
+        w[i].res = -1;
+        w[i].file[0] = 0;
+    }
+    for (i = 0; i < n; i++) {
+        if (!eof && probe_next(&w[i]))
+            busy++;
+        else
+            eof = 1;
+    }
+    while (busy) {
+        for (i = 0; i < n; i++) {
+            fds[i].fd = w[i].file[0] ? w[i].res : -1;
+            fds[i].events = POLLIN;
+        }
+        if (poll(fds, n, -1) < 0)
+            break;
+        for (i = 0; i < n; i++) {
+            char buf[4096], *nl;
+            int len;
+
+            if (!w[i].file[0] || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            len = read(w[i].res, buf, sizeof(buf));
+            if (len > 0) {
+                av_bprint_append_data(&w[i].rec, buf, len);
+                nl = memchr(w[i].rec.str, '\n', w[i].rec.len);
+                if (!nl)
+                    continue;
+                fwrite(w[i].rec.str, nl + 1 - w[i].rec.str, 1, stdout);
+                fflush(stdout);
+                av_bprint_clear(&w[i].rec);
+            } else {
+                // the worker died on this file, report it and start over
+                AVBPrint bp;
+                av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+                av_bprintf(&bp, "{\"file\":");
+                json_string(&bp, w[i].file);
+                av_bprintf(&bp, ",\"error\":\"crash\"}\n");
+                fputs(bp.str, stdout);
+                fflush(stdout);
+                av_bprint_finalize(&bp, NULL);
+                probe_reap(&w[i]);
+                av_bprint_clear(&w[i].rec);
+            }
+            if (eof || !probe_next(&w[i])) {
+                eof = 1;
+                busy--;
+            }
+        }
+    }
+    for (i = 0; i < n; i++) {
+        probe_reap(&w[i]);
+        av_bprint_finalize(&w[i].rec, NULL);
+    }
+}
+#endif /* PROBE_FORK */
+
+/**
+ * Probes every file listed on stdin, in probe_threads worker processes.
+ * Records are written as soon as a file is done, so their order does
+ * not necessarily match the input order.
+ */
+int probe_batch_run(void)
+{
+    // keep stdout for the records, warnings and errors go to stderr
+    mp_msg_levels[MSGT_IDENTIFY] = -1;
+    mp_msg_level_all = FFMIN(mp_msg_level_all, MSGL_WARN);
+
+#if PROBE_FORK
+    if (probe_threads > 1) {
+        probe_run_workers(av_clip(probe_threads, 1, PROBE_MAX_THREADS));
+        return 0;
+    }
+#endif
+    probe_loop(stdin, stdout);
+    return 0;
+}
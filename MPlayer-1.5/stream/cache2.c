@@ -64,6 +64,7 @@ static void *ThreadProc(void *s);
 #define FORKED_CACHE 0
 #endif
 
+#include "mp_mem.h"
 #include "mp_msg.h"
 #include "help_mp.h"
 
@@ -99,9 +100,13 @@ typedef struct {
   volatile double control_double_arg;
   volatile char *control_char_p_arg;
   volatile struct stream_lang_req control_lang_arg;
+  volatile struct stream_read_latency control_latency_arg;
   volatile int control_res;
   volatile double stream_time_length;
   volatile double stream_time_pos;
+  // next in-band metadata change, valid while meta_event_ready is set
+  volatile struct stream_meta_event meta_event;
+  volatile int meta_event_ready;
 } cache_vars_t;
 
 static void cache_wakeup(stream_t *s)
@@ -292,6 +297,9 @@ static int cache_execute_control(cache_vars_t *s) {
       s->stream_time_pos = pos;
     else
       s->stream_time_pos = MP_NOPTS_VALUE;
+    if (!s->meta_event_ready &&
+        s->stream->control(s->stream, STREAM_CTRL_GET_META_EVENT, (void *)&s->meta_event) == STREAM_OK)
+      s->meta_event_ready = 1;
 #if FORKED_CACHE
     // if parent PID changed, main process was killed -> exit
     if (s->ppid != getppid()) {
@@ -334,6 +342,9 @@ static int cache_execute_control(cache_vars_t *s) {
     case STREAM_CTRL_GET_CURRENT_CHANNEL:
       s->control_res = s->stream->control(s->stream, s->control, &s->control_char_p_arg);
       break;
+    case STREAM_CTRL_GET_READ_LATENCY:
+      s->control_res = s->stream->control(s->stream, s->control, (void *)&s->control_latency_arg);
+      break;
     default:
       s->control_res = STREAM_UNSUPPORTED;
       break;
@@ -384,6 +395,7 @@ static cache_vars_t* cache_init(int64_t size,int sector){
     return NULL;
   }
 
+  mp_mem_account(MP_MEM_CACHE, sizeof(cache_vars_t) + s->buffer_size);
   s->fill_limit=8*sector;
   s->back_size=s->buffer_size/2;
 #if FORKED_CACHE
@@ -404,6 +416,7 @@ void cache_uninit(stream_t *s) {
     s->cache_pid = 0;
   }
   if(!c) return;
+  mp_mem_account(MP_MEM_CACHE, -(int64_t)(sizeof(cache_vars_t) + c->buffer_size));
   shared_free(c->buffer, c->buffer_size);
   c->buffer = NULL;
   c->stream = NULL;
@@ -465,6 +478,10 @@ int stream_enable_cache(stream_t *stream,int64_t size,int64_t min,int64_t seek_l
     mp_msg(MSGT_CACHE,MSGL_STATUS,"\rThis stream is non-cacheable\n");
     return 1;
   }
+  if (stream->map) {
+    mp_msg(MSGT_CACHE,MSGL_V,"Not caching a memory mapped file\n");
+    return 1;
+  }
   if (size > SIZE_MAX) {
     mp_msg(MSGT_CACHE, MSGL_FATAL, "Cache size larger than max. allocation size\n");
     return -1;
@@ -587,6 +604,19 @@ int cache_stream_fill_buffer(stream_t *s){
 
 }
 
+/**
+ * Read from the cache directly into buf, bypassing the stream buffer,
+ * which must be empty.
+ */
+int cache_stream_read(stream_t *s, void *buf, int len){
+  if(s->pos!=((cache_vars_t*)s->cache_data)->read_filepos) mp_msg(MSGT_CACHE,MSGL_ERR,"!!! read_filepos differs!!! report this bug...\n");
+  len=cache_read(s->cache_data,buf,len);
+  if(len<=0){ s->eof=1; return 0; }
+  s->eof=0;
+  s->pos+=len;
+  return len;
+}
+
 int cache_fill_status(stream_t *s) {
   cache_vars_t *cv;
   if (!s || !s->cache_data)
@@ -595,6 +625,20 @@ int cache_fill_status(stream_t *s) {
   return (cv->max_filepos-cv->read_filepos)/(cv->buffer_size / 100);
 }
 
+/**
+ * Number of bytes the reader gets from the cache without waiting for it,
+ * INT64_MAX once the cache reached the end of the stream.
+ */
+int64_t cache_buffered_bytes(stream_t *s) {
+  cache_vars_t *cv;
+  if (!s || !s->cache_data)
+    return -1;
+  cv = s->cache_data;
+  if (cv->eof)
+    return INT64_MAX;
+  return cv->max_filepos - cv->read_filepos + s->buf_len - s->buf_pos;
+}
+
 int cache_stream_seek_long(stream_t *stream,int64_t pos){
   cache_vars_t* s;
   int64_t newpos;
@@ -648,6 +692,12 @@ int cache_do_control(stream_t *stream, int cmd, void *arg) {
     case STREAM_CTRL_GET_CURRENT_TIME:
       *(double *)arg = s->stream_time_pos;
       return s->stream_time_pos != MP_NOPTS_VALUE ? STREAM_OK : STREAM_UNSUPPORTED;
+    case STREAM_CTRL_GET_META_EVENT:
+      if (!s->meta_event_ready)
+        return STREAM_UNSUPPORTED;
+      *(struct stream_meta_event *)arg = s->meta_event;
+      s->meta_event_ready = 0;
+      return STREAM_OK;
     case STREAM_CTRL_GET_LANG:
       s->control_lang_arg = *(struct stream_lang_req *)arg;
     case STREAM_CTRL_GET_NUM_TITLES:
@@ -658,6 +708,7 @@ int cache_do_control(stream_t *stream, int cmd, void *arg) {
     case STREAM_CTRL_GET_NUM_ANGLES:
     case STREAM_CTRL_GET_ANGLE:
     case STREAM_CTRL_GET_SIZE:
+    case STREAM_CTRL_GET_READ_LATENCY:
     case -2:
       s->control = cmd;
       break;
@@ -713,6 +764,9 @@ int cache_do_control(stream_t *stream, int cmd, void *arg) {
     case STREAM_CTRL_GET_CURRENT_CHANNEL:
       *(char **)arg = (char *)s->control_char_p_arg;
       break;
+    case STREAM_CTRL_GET_READ_LATENCY:
+      *(struct stream_read_latency *)arg = s->control_latency_arg;
+      break;
   }
   return s->control_res;
 }
@@ -24,5 +24,6 @@
 void cache_uninit(stream_t *s);
 int cache_do_control(stream_t *stream, int cmd, void *arg);
 int cache_fill_status(stream_t *s);
+int64_t cache_buffered_bytes(stream_t *s);
 
 #endif /* MPLAYER_CACHE2_H */
@@ -44,11 +44,20 @@
 
 #include "libavutil/avstring.h"
 #include "libavutil/base64.h"
+#include "libavutil/common.h"
+
+#define SCAST_MAX_EVENTS 8
 
 typedef struct {
   unsigned metaint;
   unsigned metapos;
   int is_ultravox;
+  uint64_t pos;            ///< audio bytes returned so far, i.e. the stream position
+  unsigned ev_first;
+  unsigned ev_count;
+  struct stream_meta_event events[SCAST_MAX_EVENTS];
+  char last_info[STREAM_META_TEXT_LEN];
+  char meta[255 * 16 + 1]; ///< scratch space for one metadata block
 } scast_data_t;
 
 /**
@@ -64,9 +73,11 @@ static unsigned my_read(int fd, char *buffer, int len, streaming_ctrl_t *sc) {
   unsigned cp_len = sc->buffer_size - sc->buffer_pos;
   if (cp_len > len)
     cp_len = len;
-  memcpy(buffer, &sc->buffer[sc->buffer_pos], cp_len);
-  sc->buffer_pos += cp_len;
-  pos += cp_len;
+  if (cp_len) {
+    memcpy(buffer, &sc->buffer[sc->buffer_pos], cp_len);
+    sc->buffer_pos += cp_len;
+    pos += cp_len;
+  }
   while (pos < len) {
     int ret = recv(fd, &buffer[pos], len - pos, 0);
     if (ret <= 0)
@@ -86,6 +97,7 @@ static unsigned my_read(int fd, char *buffer, int len, streaming_ctrl_t *sc) {
  * test.
  */
 static unsigned uvox_meta_read(int fd, streaming_ctrl_t *sc) {
+  scast_data_t *sd = sc->data;
   unsigned metaint;
   unsigned char info[6] = {0, 0, 0, 0, 0, 0};
   int info_read;
@@ -106,35 +118,75 @@ static unsigned uvox_meta_read(int fd, streaming_ctrl_t *sc) {
       mp_msg(MSGT_DEMUXER, MSGL_WARN, "Encrypted ultravox data\n");
     metaint = info[4] << 8 | info[5];
     if ((info[3] & 0xf) < 0x07) { // discard any metadata nonsense
-      char *metabuf = malloc(metaint);
-      my_read(fd, metabuf, metaint, sc);
-      free(metabuf);
+      unsigned left = metaint;
+      while (left) {
+        unsigned block = FFMIN(left, sizeof(sd->meta));
+        if (my_read(fd, sd->meta, block, sc) != block)
+          return 0;
+        left -= block;
+      }
     }
   } while ((info[3] & 0xf) < 0x07);
   return metaint;
 }
 
 /**
- * \brief read one scast meta data entry and print it
+ * \brief queue a metadata change for the current stream position
+ *
+ * The player fetches the events with STREAM_CTRL_GET_META_EVENT and shows
+ * them once the audio following the metadata block is actually played.
+ * If nobody fetches them only the newest SCAST_MAX_EVENTS are kept.
+ */
+static void scast_meta_event(scast_data_t *sd, const char *info) {
+  struct stream_meta_event *ev;
+  const char *title, *end;
+
+  if (!strcmp(info, sd->last_info))
+    return; // some servers repeat the metadata in every block
+  av_strlcpy(sd->last_info, info, sizeof(sd->last_info));
+  if (sd->ev_count == SCAST_MAX_EVENTS) {
+    sd->ev_first = (sd->ev_first + 1) % SCAST_MAX_EVENTS;
+    sd->ev_count--;
+  }
+  ev = &sd->events[(sd->ev_first + sd->ev_count++) % SCAST_MAX_EVENTS];
+  ev->pos = sd->pos;
+  av_strlcpy(ev->info, info, sizeof(ev->info));
+  ev->title[0] = 0;
+  title = strstr(info, "StreamTitle='");
+  if (title) {
+    title += 13;
+    // the title itself may contain quotes, so look for the terminator
+    end = strstr(title, "';");
+    if (!end)
+      end = strrchr(title, '\'');
+    if (!end)
+      end = title + strlen(title);
+    av_strlcpy(ev->title, title, FFMIN(end - title + 1, (int)sizeof(ev->title)));
+  }
+}
+
+/**
+ * \brief read one scast meta data entry and queue it as event
  * \param fd file descriptor to read from
  * \param sc streaming_ctrl_t whose buffer is consumed before reading from fd
  */
 static void scast_meta_read(int fd, streaming_ctrl_t *sc) {
+  scast_data_t *sd = sc->data;
   unsigned char tmp = 0;
   unsigned metalen;
   my_read(fd, &tmp, 1, sc);
   metalen = tmp * 16;
   if (metalen > 0) {
     int i;
-    uint8_t *info = malloc(metalen + 1);
+    char *info = sd->meta;
     unsigned nlen = my_read(fd, info, metalen, sc);
     // avoid breaking the user's terminal too much
-    if (nlen > 256) nlen = 256;
+    if (nlen >= STREAM_META_TEXT_LEN) nlen = STREAM_META_TEXT_LEN - 1;
     for (i = 0; i < nlen; i++)
-      if (info[i] && info[i] < 32) info[i] = '?';
+      if (info[i] && (unsigned char)info[i] < 32) info[i] = '?';
     info[nlen] = 0;
-    mp_msg(MSGT_DEMUXER, MSGL_INFO, "\nICY Info: %s\n", info);
-    free(info);
+    mp_msg(MSGT_DEMUXER, MSGL_V, "ICY metadata at %"PRIu64": %s\n", sd->pos, info);
+    scast_meta_event(sd, info);
   }
 }
 
@@ -144,6 +196,9 @@ static void scast_meta_read(int fd, streaming_ctrl_t *sc) {
  * \param buffer buffer to read data into
  * \param size number of bytes to read
  * \param sc streaming_ctrl_t whose buffer is consumed before reading from fd
+ *
+ * The audio data is received directly into buffer, metadata blocks are
+ * found by their offset and read into the scratch space in scast_data_t.
  */
 static int scast_streaming_read(int fd, char *buffer, int size,
                                 streaming_ctrl_t *sc) {
@@ -151,38 +206,40 @@ static int scast_streaming_read(int fd, char *buffer, int size,
   unsigned block, ret;
   unsigned done = 0;
 
-  // first read remaining data up to next metadata
-  block = sd->metaint - sd->metapos;
-  if (block > size)
-    block = size;
-  ret = my_read(fd, buffer, block, sc);
-  sd->metapos += ret;
-  done += ret;
-  if (ret != block) // read problems or eof
-    size = done;
-
-  while (done < size) { // now comes the metadata
-    if (sd->is_ultravox)
-    {
-      sd->metaint = uvox_meta_read(fd, sc);
-      if (!sd->metaint)
-        size = done;
+  while (done < size) {
+    if (sd->metapos == sd->metaint) { // now comes the metadata
+      if (sd->is_ultravox) {
+        sd->metaint = uvox_meta_read(fd, sc);
+        if (!sd->metaint)
+          break;
+      } else
+        scast_meta_read(fd, sc);
+      sd->metapos = 0;
     }
-    else
-      scast_meta_read(fd, sc); // read and display metadata
-    sd->metapos = 0;
-    block = size - done;
-    if (block > sd->metaint)
-      block = sd->metaint;
+    block = FFMIN(size - done, sd->metaint - sd->metapos);
     ret = my_read(fd, &buffer[done], block, sc);
     sd->metapos += ret;
-    done += ret;
+    sd->pos     += ret;
+    done        += ret;
     if (ret != block) // read problems or eof
-      size = done;
+      break;
   }
   return done;
 }
 
+static int scast_control(stream_t *stream, int cmd, void *arg) {
+  scast_data_t *sd;
+  if (cmd != STREAM_CTRL_GET_META_EVENT || !stream->streaming_ctrl)
+    return STREAM_UNSUPPORTED;
+  sd = stream->streaming_ctrl->data;
+  if (!sd->ev_count)
+    return STREAM_UNSUPPORTED;
+  *(struct stream_meta_event *)arg = sd->events[sd->ev_first];
+  sd->ev_first = (sd->ev_first + 1) % SCAST_MAX_EVENTS;
+  sd->ev_count--;
+  return STREAM_OK;
+}
+
 static int scast_streaming_start(stream_t *stream) {
   int metaint;
   scast_data_t *scast_data;
@@ -201,13 +258,13 @@ static int scast_streaming_start(stream_t *stream) {
   stream->streaming_ctrl->buffer_size = http_hdr->body_size;
   stream->streaming_ctrl->buffer_pos = 0;
   memcpy(stream->streaming_ctrl->buffer, http_hdr->body, http_hdr->body_size);
-  scast_data = malloc(sizeof(scast_data_t));
+  scast_data = calloc(1, sizeof(scast_data_t));
   scast_data->metaint = metaint;
-  scast_data->metapos = 0;
   scast_data->is_ultravox = is_ultravox;
   http_free(http_hdr);
   stream->streaming_ctrl->data = scast_data;
   stream->streaming_ctrl->streaming_read = scast_streaming_read;
+  stream->control = scast_control;
   stream->streaming_ctrl->streaming_seek = NULL;
   stream->streaming_ctrl->prebuffer_size = 64 * 1024; // 64 KBytes
   stream->streaming_ctrl->buffering = 1;
@@ -0,0 +1,522 @@
+/*
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * \file readahead.c
+ * Asynchronous readahead for the file stream.
+ *
+ * The file is read in aligned blocks. The block being read and the next
+ * ones are requested before they are needed, so that the latency of
+ * network filesystems is hidden from the reader. Reads are done with
+ * io_uring where the kernel supports it and by a pool of threads
+ * otherwise. The number of reads in flight follows the measured read
+ * latency and the rate at which the reader consumes blocks.
+ */
+
+// for syscall() and MAP_POPULATE
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#if HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "libavutil/common.h"
+#include "libavutil/mem.h"
+#include "mp_mem.h"
+#include "mp_msg.h"
+#include "osdep/timer.h"
+#include "readahead.h"
+
+#define RA_MAX_DEPTH   64
+#define RA_MAX_THREADS 8
+// slots beyond the window let reads made stale by a seek finish
+#define RA_SLOTS(depth) (2 * (depth))
+
+enum { SLOT_FREE, SLOT_PENDING, SLOT_DONE };
+
+typedef struct ra_slot {
+    unsigned char *buf;
+    int64_t block;
+    int state;
+    int len;            // bytes read, negative errno on error
+    unsigned start;     // GetTimer() when the read was requested
+} ra_slot_t;
+
+#if HAVE_IO_URING
+struct ra_uring {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    unsigned to_submit;
+};
+#endif
+
+struct readahead {
+    int fd;
+    int block_size;
+    int max_depth;
+    int depth;
+    int nr_slots;
+    ra_slot_t slot[RA_SLOTS(RA_MAX_DEPTH)];
+    int64_t size;               // file size when last checked
+    int64_t last_block;         // block the reader used last
+    unsigned last_block_time;
+    unsigned interval;          // average time the reader spends on a block
+    unsigned latency;           // average read latency
+    struct stream_read_latency stats;
+
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+
+    // thread pool
+    pthread_cond_t work;
+    pthread_t thread[RA_MAX_THREADS];
+    int nr_threads;
+    int queue[RA_SLOTS(RA_MAX_DEPTH)];
+    int queue_len;
+    int quit;
+
+#if HAVE_IO_URING
+    struct ra_uring *uring;
+#endif
+};
+
+static void complete_slot(struct readahead *ra, ra_slot_t *s, int len)
+{
+    unsigned latency = GetTimer() - s->start;
+    int i = 0;
+
+    s->len = len;
+    s->state = SLOT_DONE;
+    if (len > 0)
+        ra->size = FFMAX(ra->size, s->block * ra->block_size + len);
+    while (i < STREAM_LATENCY_BUCKETS - 1 && latency >= 64U << i)
+        i++;
+    ra->stats.count[i]++;
+    ra->latency = ra->latency ? (7 * ra->latency + latency) / 8 : latency;
+}
+
+static int read_block(int fd, unsigned char *buf, int len, int64_t pos)
+{
+    int done = 0;
+    while (done < len) {
+        int r = pread(fd, buf + done, len - done, pos + done);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+            return done ? done : -errno;
+        if (r == 0)
+            break;
+        done += r;
+    }
+    return done;
+}
+
+static void *pool_thread(void *arg)
+{
+    struct readahead *ra = arg;
+
+    pthread_mutex_lock(&ra->lock);
+    while (1) {
+        ra_slot_t *s;
+        int len;
+        while (!ra->quit && !ra->queue_len)
+            pthread_cond_wait(&ra->work, &ra->lock);
+        if (ra->quit)
+            break;
+        s = &ra->slot[ra->queue[0]];
+        memmove(ra->queue, ra->queue + 1, --ra->queue_len * sizeof(*ra->queue));
+        pthread_mutex_unlock(&ra->lock);
+        len = read_block(ra->fd, s->buf, ra->block_size, s->block * ra->block_size);
+        pthread_mutex_lock(&ra->lock);
+        complete_slot(ra, s, len);
+        pthread_cond_broadcast(&ra->done);
+    }
+    pthread_mutex_unlock(&ra->lock);
+    return NULL;
+}
+
+#if HAVE_IO_URING
+static void uring_uninit(struct ra_uring *u)
+{
+    if (u->sqes && u->sqes != MAP_FAILED)
+        munmap(u->sqes, u->sqes_size);
+    if (u->cq_ring && u->cq_ring != MAP_FAILED && u->cq_ring != u->sq_ring)
+        munmap(u->cq_ring, u->cq_ring_size);
+    if (u->sq_ring && u->sq_ring != MAP_FAILED)
+        munmap(u->sq_ring, u->sq_ring_size);
+    if (u->fd >= 0)
+        close(u->fd);
+    free(u);
+}
+
+static struct ra_uring *uring_init(unsigned entries)
+{
+    struct io_uring_params p;
+    struct ra_uring *u = calloc(1, sizeof(*u));
+
+    if (!u)
+        return NULL;
+    memset(&p, 0, sizeof(p));
+    u->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (u->fd < 0) {
+        mp_msg(MSGT_STREAM, MSGL_V, "[readahead] io_uring not available: %s\n",
+               strerror(errno));
+        free(u);
+        return NULL;
+    }
+    u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        u->sq_ring_size = u->cq_ring_size = FFMAX(u->sq_ring_size, u->cq_ring_size);
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED)
+        goto err;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        u->cq_ring = u->sq_ring;
+    else
+        u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    if (u->cq_ring == MAP_FAILED)
+        goto err;
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+        goto err;
+    u->sq_head  = (unsigned *)((char *)u->sq_ring + p.sq_off.head);
+    u->sq_tail  = (unsigned *)((char *)u->sq_ring + p.sq_off.tail);
+    u->sq_mask  = (unsigned *)((char *)u->sq_ring + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)((char *)u->sq_ring + p.sq_off.array);
+    u->cq_head  = (unsigned *)((char *)u->cq_ring + p.cq_off.head);
+    u->cq_tail  = (unsigned *)((char *)u->cq_ring + p.cq_off.tail);
+    u->cq_mask  = (unsigned *)((char *)u->cq_ring + p.cq_off.ring_mask);
+    u->cqes     = (struct io_uring_cqe *)((char *)u->cq_ring + p.cq_off.cqes);
+    return u;
+
+err:
+    mp_msg(MSGT_STREAM, MSGL_V, "[readahead] Cannot map the io_uring rings: %s\n",
+           strerror(errno));
+    uring_uninit(u);
+    return NULL;
+}
+
+static void uring_queue(struct readahead *ra, int idx)
+{
+    struct ra_uring *u = ra->uring;
+    ra_slot_t *s = &ra->slot[idx];
+    unsigned tail = *u->sq_tail;
+    unsigned i = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[i];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = IORING_OP_READ;
+    sqe->fd        = ra->fd;
+    sqe->addr      = (uintptr_t)s->buf;
+    sqe->len       = ra->block_size;
+    sqe->off       = s->block * ra->block_size;
+    sqe->user_data = idx;
+    u->sq_array[i] = i;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->to_submit++;
+}
+
+/// Collect finished reads, waiting for at least one if wait is set.
+static int uring_reap(struct readahead *ra, int wait)
+{
+    struct ra_uring *u = ra->uring;
+    unsigned head;
+    int n = 0;
+
+    if (u->to_submit || wait) {
+        int r = syscall(__NR_io_uring_enter, u->fd, u->to_submit, wait ? 1 : 0,
+                        wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            return -1;
+        if (r > 0)
+            u->to_submit -= FFMIN(r, u->to_submit);
+    }
+    head = *u->cq_head;
+    while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+        complete_slot(ra, &ra->slot[cqe->user_data], cqe->res);
+        head++;
+        n++;
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+#endif
+
+static void submit(struct readahead *ra, int idx, int64_t block)
+{
+    ra_slot_t *s = &ra->slot[idx];
+
+    s->block = block;
+    s->state = SLOT_PENDING;
+    s->start = GetTimer();
+#if HAVE_IO_URING
+    if (ra->uring) {
+        uring_queue(ra, idx);
+        return;
+    }
+#endif
+    ra->queue[ra->queue_len++] = idx;
+    pthread_cond_signal(&ra->work);
+}
+
+/// Wait until some pending read has finished.
+static void wait_any(struct readahead *ra)
+{
+#if HAVE_IO_URING
+    if (ra->uring) {
+        int i, r;
+        while (!(r = uring_reap(ra, 1)))
+            /* NOTHING */;
+        if (r < 0) {
+            // give up on the pending reads, readahead_read() reads directly
+            mp_msg(MSGT_STREAM, MSGL_ERR, "[readahead] io_uring failed: %s\n",
+                   strerror(errno));
+            for (i = 0; i < ra->nr_slots; i++)
+                if (ra->slot[i].state == SLOT_PENDING)
+                    complete_slot(ra, &ra->slot[i], -EIO);
+        }
+        return;
+    }
+#endif
+    pthread_cond_wait(&ra->done, &ra->lock);
+}
+
+static ra_slot_t *find_block(struct readahead *ra, int64_t block)
+{
+    int i;
+    for (i = 0; i < ra->nr_slots; i++)
+        if (ra->slot[i].state != SLOT_FREE && ra->slot[i].block == block)
+            return &ra->slot[i];
+    return NULL;
+}
+
+/// Find a slot that holds nothing the reader may still need.
+static int get_slot(struct readahead *ra, int64_t block)
+{
+    int i;
+    while (1) {
+        for (i = 0; i < ra->nr_slots; i++)
+            if (ra->slot[i].state == SLOT_FREE)
+                return i;
+        for (i = 0; i < ra->nr_slots; i++)
+            if (ra->slot[i].state == SLOT_DONE &&
+                (ra->slot[i].block < block || ra->slot[i].block >= block + ra->depth))
+                return i;
+        wait_any(ra);
+    }
+}
+
+/// Choose how many reads to keep in flight: enough to cover the read
+/// latency at the rate the reader uses blocks, plus the block in use.
+static void adapt_depth(struct readahead *ra, int64_t block)
+{
+    unsigned now = GetTimer();
+
+    if (block == ra->last_block)
+        return;
+    if (block == ra->last_block + 1) {
+        unsigned t = now - ra->last_block_time;
+        ra->interval = ra->interval ? (7 * ra->interval + t) / 8 : t;
+    }
+    ra->last_block = block;
+    ra->last_block_time = now;
+    ra->depth = av_clip(ra->latency / FFMAX(ra->interval, 1) + 2, 2, ra->max_depth);
+}
+
+int readahead_read(struct readahead *ra, int64_t pos, void *buf, int len)
+{
+    int64_t block = pos / ra->block_size;
+    int offset = pos % ra->block_size;
+    ra_slot_t *s;
+    int64_t b;
+
+    pthread_mutex_lock(&ra->lock);
+#if HAVE_IO_URING
+    if (ra->uring)
+        uring_reap(ra, 0);
+#endif
+    adapt_depth(ra, block);
+    for (b = block; b < block + ra->depth; b++) {
+        // only the block being read is requested past the known end
+        if (b > block && b * ra->block_size >= ra->size)
+            break;
+        if (!find_block(ra, b))
+            submit(ra, get_slot(ra, block), b);
+    }
+#if HAVE_IO_URING
+    if (ra->uring)
+        uring_reap(ra, 0);
+#endif
+    s = find_block(ra, block);
+    if (s->state != SLOT_DONE) {
+        ra->stats.stalls++;
+        while (s->state != SLOT_DONE)
+            wait_any(ra);
+    }
+    if (s->len > offset) {
+        len = FFMIN(len, s->len - offset);
+        memcpy(buf, s->buf + offset, len);
+        pthread_mutex_unlock(&ra->lock);
+        return len;
+    }
+    // Error, or a short read that ended before pos. Read pos directly,
+    // the file may have grown since.
+    s->state = SLOT_FREE;
+    len = read_block(ra->fd, buf, len, pos);
+    if (len > 0)
+        ra->size = FFMAX(ra->size, pos + len);
+    pthread_mutex_unlock(&ra->lock);
+    return len < 0 ? -1 : len;
+}
+
+void readahead_get_latency(struct readahead *ra, struct stream_read_latency *lat)
+{
+    pthread_mutex_lock(&ra->lock);
+    *lat = ra->stats;
+    lat->depth = ra->depth;
+    lat->max_depth = ra->max_depth;
+    pthread_mutex_unlock(&ra->lock);
+}
+
+struct readahead *readahead_init(int fd, int max_depth, int block_size)
+{
+    struct readahead *ra = calloc(1, sizeof(*ra));
+    struct stat st;
+    int i;
+
+    if (!ra)
+        return NULL;
+    ra->fd = fd;
+    ra->block_size = block_size;
+    ra->max_depth = av_clip(max_depth, 2, RA_MAX_DEPTH);
+    ra->depth = 2;
+    ra->nr_slots = RA_SLOTS(ra->max_depth);
+    ra->last_block = -1;
+    ra->size = fstat(fd, &st) ? INT64_MAX : st.st_size;
+    for (i = 0; i < ra->nr_slots; i++) {
+        ra->slot[i].buf = av_malloc(block_size);
+        if (!ra->slot[i].buf)
+            goto err;
+    }
+    mp_mem_account(MP_MEM_STREAM, sizeof(*ra) + (int64_t)ra->nr_slots * block_size);
+    pthread_mutex_init(&ra->lock, NULL);
+    pthread_cond_init(&ra->done, NULL);
+    pthread_cond_init(&ra->work, NULL);
+
+#if HAVE_IO_URING
+    ra->uring = uring_init(ra->nr_slots);
+    if (ra->uring) {
+        // IORING_OP_READ needs Linux 5.6, try it on the first block
+        submit(ra, 0, 0);
+        wait_any(ra);
+        if (ra->slot[0].state != SLOT_DONE || ra->slot[0].len == -EINVAL) {
+            mp_msg(MSGT_STREAM, MSGL_V, "[readahead] io_uring cannot read files\n");
+            uring_uninit(ra->uring);
+            ra->uring = NULL;
+            ra->slot[0].state = SLOT_FREE;
+            memset(&ra->stats, 0, sizeof(ra->stats));
+        }
+    }
+    if (ra->uring) {
+        mp_msg(MSGT_STREAM, MSGL_V, "[readahead] Up to %d reads of %d bytes in flight, using io_uring\n",
+               ra->max_depth, block_size);
+        return ra;
+    }
+#endif
+    ra->nr_threads = FFMIN(ra->max_depth, RA_MAX_THREADS);
+    for (i = 0; i < ra->nr_threads; i++)
+        if (pthread_create(&ra->thread[i], NULL, pool_thread, ra)) {
+            ra->nr_threads = i;
+            break;
+        }
+    if (!ra->nr_threads) {
+        readahead_uninit(ra);
+        return NULL;
+    }
+    mp_msg(MSGT_STREAM, MSGL_V, "[readahead] Up to %d reads of %d bytes in flight, using %d threads\n",
+           ra->max_depth, block_size, ra->nr_threads);
+    return ra;
+
+err:
+    for (i = 0; i < ra->nr_slots; i++)
+        av_free(ra->slot[i].buf);
+    free(ra);
+    return NULL;
+}
+
+void readahead_uninit(struct readahead *ra)
+{
+    int i;
+
+    if (!ra)
+        return;
+    pthread_mutex_lock(&ra->lock);
+    ra->quit = 1;
+    pthread_cond_broadcast(&ra->work);
+    pthread_mutex_unlock(&ra->lock);
+    for (i = 0; i < ra->nr_threads; i++)
+        pthread_join(ra->thread[i], NULL);
+#if HAVE_IO_URING
+    if (ra->uring) {
+        // the kernel must be done with the buffers before they are freed
+        for (i = 0; i < ra->nr_slots; i++)
+            while (ra->slot[i].state == SLOT_PENDING)
+                wait_any(ra);
+        uring_uninit(ra->uring);
+    }
+#endif
+    if (mp_msg_test(MSGT_STREAM, MSGL_V)) {
+        mp_msg(MSGT_STREAM, MSGL_V, "[readahead] %u stalls, read latency:", ra->stats.stalls);
+        for (i = 0; i < STREAM_LATENCY_BUCKETS; i++)
+            if (ra->stats.count[i])
+                mp_msg(MSGT_STREAM, MSGL_V, " %s%uus:%u",
+                       i == STREAM_LATENCY_BUCKETS - 1 ? ">=" : "<",
+                       64U << FFMIN(i, STREAM_LATENCY_BUCKETS - 2), ra->stats.count[i]);
+        mp_msg(MSGT_STREAM, MSGL_V, "\n");
+    }
+    pthread_cond_destroy(&ra->work);
+    pthread_cond_destroy(&ra->done);
+    pthread_mutex_destroy(&ra->lock);
+    for (i = 0; i < ra->nr_slots; i++)
+        av_free(ra->slot[i].buf);
+    mp_mem_account(MP_MEM_STREAM, -(sizeof(*ra) + (int64_t)ra->nr_slots * ra->block_size));
+    free(ra);
+}
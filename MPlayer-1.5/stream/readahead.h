@@ -0,0 +1,36 @@
+/*
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPLAYER_READAHEAD_H
+#define MPLAYER_READAHEAD_H
+
+#include <stdint.h>
+
+#include "stream.h"
+
+struct readahead;
+
+/// Start reading fd ahead, with up to max_depth reads of block_size
+/// bytes in flight.
+struct readahead *readahead_init(int fd, int max_depth, int block_size);
+/// Read up to len bytes at pos, return 0 at EOF and -1 on error.
+int readahead_read(struct readahead *ra, int64_t pos, void *buf, int len);
+void readahead_get_latency(struct readahead *ra, struct stream_read_latency *lat);
+void readahead_uninit(struct readahead *ra);
+
+#endif /* MPLAYER_READAHEAD_H */
@@ -37,6 +37,7 @@
 #endif
 
 #include "libavutil/avstring.h"
+#include "mp_mem.h"
 #include "mp_msg.h"
 #include "help_mp.h"
 #include "osdep/shmem.h"
@@ -375,6 +376,27 @@ int stream_fill_buffer(stream_t *s){
   return s->buf_len;
 }
 
+int stream_read_direct(stream_t *s, char *mem, int total){
+  int done = FFMIN(s->buf_len - s->buf_pos, total);
+  int len;
+  if (done > 0) {
+    memcpy(mem, &s->buffer[s->buf_pos], done);
+    s->buf_pos += done;
+  }
+  len = total - done;
+  // small reads and anything the stream buffer is needed for go through it
+  if (len < STREAM_BUFFER_SIZE || s->capture_stream ||
+      (!s->cache_pid && s->type != STREAMTYPE_FILE))
+    return done + stream_read(s, mem + done, len);
+#ifdef CONFIG_STREAM_CACHE
+  if (s->cache_pid)
+    len = cache_stream_read(s, mem + done, len);
+  else
+#endif
+  len = stream_read_internal(s, mem + done, len);
+  return done + FFMAX(len, 0);
+}
+
 int stream_write_buffer(stream_t *s, unsigned char *buf, int len) {
   int rd;
   if(!s->write_buffer)
@@ -507,6 +529,7 @@ stream_t* new_memory_stream(unsigned char* data,int len){
   if(len < 0)
     return NULL;
   s=calloc(1, sizeof(stream_t)+len);
+  mp_mem_account(MP_MEM_STREAM, sizeof(stream_t) + len);
   s->fd=-1;
   s->type=STREAMTYPE_MEMORY;
   s->buf_pos=0; s->buf_len=len;
@@ -520,6 +543,7 @@ stream_t* new_memory_stream(unsigned char* data,int len){
 stream_t* new_stream(int fd,int type){
   stream_t *s=calloc(1, sizeof(stream_t));
   if(s==NULL) return NULL;
+  mp_mem_account(MP_MEM_STREAM, sizeof(stream_t));
 
 #if HAVE_WINSOCK2_H
   {
@@ -568,6 +592,8 @@ int free_stream(stream_t *s){
   // streams should destroy their priv on close
   //free(s->priv);
   free(s->url);
+  mp_mem_account(MP_MEM_STREAM, -(int64_t)sizeof(stream_t) -
+                 (s->type == STREAMTYPE_MEMORY ? s->end_pos : 0));
   free(s);
   return res;
 }
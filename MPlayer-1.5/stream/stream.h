@@ -100,6 +100,10 @@
 #define STREAM_CTRL_GET_LANG 13
 #define STREAM_CTRL_GET_CURRENT_TITLE 14
 #define STREAM_CTRL_GET_CURRENT_CHANNEL 15
+#define STREAM_CTRL_GET_META_EVENT 16
+#define STREAM_CTRL_GET_READ_LATENCY 17
+/// renew the kernel readahead of a mapped file, arg is the int64_t position
+#define STREAM_CTRL_MAP_READAHEAD 18
 
 enum stream_ctrl_type {
 	stream_ctrl_audio,
@@ -112,6 +116,27 @@ struct stream_lang_req {
 	char buf[40];
 };
 
+#define STREAM_META_TEXT_LEN 256
+
+/// in-band metadata change, returned by STREAM_CTRL_GET_META_EVENT
+struct stream_meta_event {
+	uint64_t pos;                     ///< stream position the change applies from
+	char info[STREAM_META_TEXT_LEN];  ///< raw metadata, as sent by the server
+	char title[STREAM_META_TEXT_LEN]; ///< StreamTitle, empty if not present
+};
+
+#define STREAM_LATENCY_BUCKETS 16
+
+/// read statistics of a file stream, returned by STREAM_CTRL_GET_READ_LATENCY
+struct stream_read_latency {
+	/// reads that took less than 64 << i microseconds, the last
+	/// bucket counts all longer reads
+	unsigned count[STREAM_LATENCY_BUCKETS];
+	unsigned stalls;  ///< times the reader had to wait for a read
+	int depth;        ///< reads currently kept in flight
+	int max_depth;
+};
+
 typedef enum {
 	streaming_stopped_e,
 	streaming_playing_e
@@ -173,6 +198,9 @@ typedef struct stream {
   int mode; //STREAM_READ or STREAM_WRITE
   unsigned int cache_pid;
   void* cache_data;
+  const unsigned char *map; // file contents if the stream maps the file (-mmap)
+  int64_t map_len; // number of bytes of the file in map
+  int64_t map_ra_next; // reads from map past this renew the readahead
   void* priv; // used for DVD, TV, RTSP etc
   char* url;  // strdup() of filename/url
 #ifdef CONFIG_NETWORKING
@@ -188,11 +216,21 @@ typedef struct stream {
 
 int stream_fill_buffer(stream_t *s);
 int stream_seek_long(stream_t *s, int64_t pos);
+int stream_control(stream_t *s, int cmd, void *arg);
+
+/// Tell a mapped stream that reads from the mapping reached pos, so the
+/// kernel readahead keeps ahead of reads that bypass fill_buffer.
+static inline void stream_map_advance(stream_t *s, int64_t pos)
+{
+  if (pos > s->map_ra_next)
+    stream_control(s, STREAM_CTRL_MAP_READAHEAD, &pos);
+}
 void stream_capture_do(stream_t *s);
 
 #ifdef CONFIG_STREAM_CACHE
 int stream_enable_cache(stream_t *stream,int64_t size,int64_t min,int64_t prefill);
 int cache_stream_fill_buffer(stream_t *s);
+int cache_stream_read(stream_t *s, void *buf, int len);
 int cache_stream_seek_long(stream_t *s,int64_t pos);
 #else
 // no cache, define wrappers:
@@ -287,6 +325,15 @@ static inline int stream_read(stream_t *s, char *mem, int total)
   while(len>0){
     int x;
     x=s->buf_len-s->buf_pos;
+    if(x==0 && s->map && s->pos < s->map_len && !s->cache_pid && !s->capture_stream){
+      // copy straight from the mapped file
+      x = s->map_len - s->pos < len ? s->map_len - s->pos : len;
+      stream_map_advance(s, s->pos + x);
+      memcpy(mem, s->map + s->pos, x);
+      s->buf_pos=s->buf_len=0;
+      s->pos+=x; mem+=x; len-=x;
+      continue;
+    }
     if(x==0){
       if(!cache_stream_fill_buffer(s)) return total-len; // EOF
       x=s->buf_len-s->buf_pos;
@@ -316,6 +363,17 @@ static inline int64_t stream_tell(stream_t *s)
   return s->pos+s->buf_pos-s->buf_len;
 }
 
+/// Pointer to the next len bytes of a memory mapped stream, NULL if the
+/// stream is not mapped or the bytes are not all mapped yet. Use
+/// stream_skip() to consume them.
+static inline const unsigned char *stream_map_ptr(stream_t *s, int len)
+{
+  int64_t pos = stream_tell(s);
+  if (!s->map || s->cache_pid || len < 0 || pos + len > s->map_len)
+    return NULL;
+  return s->map + pos;
+}
+
 static inline int stream_seek(stream_t *s, int64_t pos)
 {
 
@@ -342,6 +400,14 @@ static inline int stream_seek(stream_t *s, int64_t pos)
 
 static inline int stream_skip(stream_t *s, int64_t len)
 {
+  if (s->map && len > s->buf_len - s->buf_pos && !s->cache_pid &&
+      !s->capture_stream && stream_tell(s) + len <= s->map_len && len >= 0) {
+    // mapped file: just move past the data
+    s->pos = stream_tell(s) + len;
+    stream_map_advance(s, s->pos);
+    s->buf_pos = s->buf_len = 0;
+    return 1;
+  }
   if( len<0 || (len>2*STREAM_BUFFER_SIZE && (s->flags & MP_STREAM_SEEK_FW)) ) {
     // negative or big skip!
     return stream_seek(s,stream_tell(s)+len);
@@ -360,7 +426,6 @@ static inline int stream_skip(stream_t *s, int64_t len)
 }
 
 void stream_reset(stream_t *s);
-int stream_control(stream_t *s, int cmd, void *arg);
 stream_t* new_stream(int fd,int type);
 int free_stream(stream_t *s);
 stream_t* new_memory_stream(unsigned char* data,int len);
@@ -377,10 +442,16 @@ int stream_check_interrupt(int time);
 int stream_read_internal(stream_t *s, void *buf, int len);
 /// Internal seek function bypassing the stream buffer
 int stream_seek_internal(stream_t *s, int64_t newpos);
+/// stream_read that reads large requests directly into mem, may return
+/// less than requested before EOF
+int stream_read_direct(stream_t *s, char *mem, int total);
 
 extern int bluray_angle;
 extern int bluray_chapter;
 extern int dvd_speed;
+extern int stream_file_mmap;
+extern int stream_readahead;
+extern int stream_readahead_size;
 extern int dvd_chapter;
 extern int dvd_last_chapter;
 extern int dvd_angle;
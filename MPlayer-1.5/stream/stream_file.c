@@ -18,7 +18,10 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -30,7 +33,14 @@
 #include <windows.h>
 #include <share.h>
 #endif
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
 
+#include "mp_mem.h"
 #include "mp_msg.h"
 #include "stream.h"
 #include "help_mp.h"
@@ -38,6 +48,14 @@
 #include "m_struct.h"
 #include "osdep/osdep.h"
 #include "libmpdemux/demuxer.h"
+#include "libavutil/common.h"
+#if HAVE_PTHREADS
+#include "readahead.h"
+#endif
+
+int stream_file_mmap = 0;
+int stream_readahead = -1;       // reads in flight, -1 for network filesystems only
+int stream_readahead_size = 256; // kB per read
 
 static const struct stream_priv_s {
   char* filename;
@@ -120,6 +138,207 @@ static int control(stream_t *s, int cmd, void *arg) {
   return STREAM_UNSUPPORTED;
 }
 
+#if HAVE_MMAP
+// how much to ask the kernel to read ahead of the position
+#define MAP_READAHEAD (8*1024*1024)
+
+struct file_map {
+  int64_t ra_start, ra_end; // range readahead was last requested for
+  long page_size;
+};
+
+static void map_readahead(stream_t *s, int64_t pos) {
+#ifdef POSIX_MADV_WILLNEED
+  struct file_map *m = s->priv;
+  int64_t start, end;
+
+  if (pos >= m->ra_start &&
+      (pos + MAP_READAHEAD / 2 <= m->ra_end || m->ra_end == s->map_len))
+    return;
+  start = pos & ~(int64_t)(m->page_size - 1);
+  end = FFMIN(pos + MAP_READAHEAD, s->map_len);
+  if (end > start)
+    posix_madvise((void *)(s->map + start), end - start, POSIX_MADV_WILLNEED);
+  m->ra_start = start;
+  m->ra_end = end;
+  s->map_ra_next = end == s->map_len ? end : end - MAP_READAHEAD / 2;
+#else
+  s->map_ra_next = s->map_len;
+#endif
+}
+
+static void map_unmap(stream_t *s) {
+  if (s->map)
+    munmap((void *)s->map, s->map_len);
+  s->map = NULL;
+  s->map_len = 0;
+  s->map_ra_next = 0;
+}
+
+static int map_file(stream_t *s, int64_t len) {
+  void *map;
+  struct stat st;
+
+  if (fstat(s->fd, &st) || !S_ISREG(st.st_mode) || len <= 0 || len > SIZE_MAX)
+    return 0;
+  map = mmap(NULL, len, PROT_READ, MAP_SHARED, s->fd, 0);
+  if (map == MAP_FAILED) {
+    mp_msg(MSGT_STREAM, MSGL_V, "[file] Cannot map %"PRId64" bytes: %s\n",
+           len, strerror(errno));
+    return 0;
+  }
+#ifdef POSIX_MADV_SEQUENTIAL
+  posix_madvise(map, len, POSIX_MADV_SEQUENTIAL);
+#endif
+  s->map = map;
+  s->map_len = len;
+  return 1;
+}
+
+/// The file grew since it was mapped, e.g. it is still being downloaded.
+static int map_grow(stream_t *s) {
+  struct file_map *m = s->priv;
+  off_t size = lseek(s->fd, 0, SEEK_END);
+
+  if (size == (off_t)-1 || size <= s->map_len)
+    return 0;
+  mp_msg(MSGT_STREAM, MSGL_V, "[file] File grew to %"PRId64" bytes, remapping\n",
+         (int64_t)size);
+  map_unmap(s);
+  s->end_pos = size;
+  m->ra_start = m->ra_end = 0;
+  if (!map_file(s, size)) {
+    // continue with plain reads
+    s->fill_buffer = fill_buffer;
+    s->seek = seek;
+    return 0;
+  }
+  return 1;
+}
+
+static int map_fill_buffer(stream_t *s, char* buffer, int max_len) {
+  int len;
+
+  if (s->pos >= s->map_len && !map_grow(s)) {
+    if (lseek(s->fd, s->pos, SEEK_SET) < 0)
+      return -1;
+    return fill_buffer(s, buffer, max_len);
+  }
+  map_readahead(s, s->pos);
+  len = FFMIN(max_len, s->map_len - s->pos);
+  memcpy(buffer, s->map + s->pos, len);
+  return len;
+}
+
+static int map_seek(stream_t *s, int64_t newpos) {
+  s->pos = newpos;
+  if (newpos < s->map_len)
+    map_readahead(s, newpos);
+  return 1;
+}
+
+static int map_control(stream_t *s, int cmd, void *arg) {
+  if (cmd == STREAM_CTRL_MAP_READAHEAD) {
+    if (s->map)
+      map_readahead(s, *(int64_t *)arg);
+    return STREAM_OK;
+  }
+  return control(s, cmd, arg);
+}
+
+static void map_close(stream_t *s) {
+  map_unmap(s);
+  free(s->priv);
+  s->priv = NULL;
+}
+
+static void map_open(stream_t *s, int64_t len) {
+  struct file_map *m = calloc(1, sizeof(*m));
+
+  if (!m)
+    return;
+  if (!map_file(s, len)) {
+    free(m);
+    return;
+  }
+  m->page_size = sysconf(_SC_PAGESIZE);
+  s->priv = m;
+  s->fill_buffer = map_fill_buffer;
+  s->seek = map_seek;
+  s->control = map_control;
+  s->close = map_close;
+  map_readahead(s, 0);
+  mp_msg(MSGT_OPEN, MSGL_V, "[file] Reading from a memory mapping\n");
+}
+#endif
+
+#if HAVE_PTHREADS
+/// Filesystems where a read is a round trip to another machine.
+static int is_network_fs(int fd) {
+#ifdef __linux__
+  struct statfs st;
+
+  if (fstatfs(fd, &st))
+    return 0;
+  switch ((uint32_t)st.f_type) {
+  case 0x6969:     // NFS
+  case 0x517B:     // SMB
+  case 0xFF534D42: // CIFS
+  case 0xFE534D42: // SMB2
+  case 0x65735546: // FUSE, e.g. sshfs
+    return 1;
+  }
+#endif
+  return 0;
+}
+
+static int ra_fill_buffer(stream_t *s, char* buffer, int max_len) {
+  int len = readahead_read(s->priv, s->pos, buffer, max_len);
+  if (max_len && len == 0) s->eof = 1;
+  return (len <= 0) ? -1 : len;
+}
+
+static int ra_seek(stream_t *s, int64_t newpos) {
+  s->pos = newpos;
+  return 1;
+}
+
+static int ra_control(stream_t *s, int cmd, void *arg) {
+  if (cmd == STREAM_CTRL_GET_READ_LATENCY) {
+    readahead_get_latency(s->priv, arg);
+    return STREAM_OK;
+  }
+  return control(s, cmd, arg);
+}
+
+static void ra_close(stream_t *s) {
+  readahead_uninit(s->priv);
+  s->priv = NULL;
+}
+
+static void ra_open(stream_t *s) {
+  int depth = stream_readahead;
+  int size = stream_readahead_size;
+
+  if (depth < 0) {
+    if (!is_network_fs(s->fd))
+      return;
+    depth = 8;
+  }
+  if (mp_mem_lowmem) {
+    depth = FFMIN(depth, MP_LOWMEM_READAHEAD);
+    size  = FFMIN(size, MP_LOWMEM_READAHEAD_SZ);
+  }
+  size = (size * 1024 + 4095) & ~4095;
+  if (!depth || !(s->priv = readahead_init(s->fd, depth, size)))
+    return;
+  s->fill_buffer = ra_fill_buffer;
+  s->seek = ra_seek;
+  s->control = ra_control;
+  s->close = ra_close;
+}
+#endif
+
 #ifdef __MINGW32__
 static int win32_open(const char *fname, int m, int omode)
 {
@@ -238,6 +457,15 @@ static int open_f(stream_t *stream,int mode, void* opts, int* file_format) {
   stream->control = control;
   stream->read_chunk = 64*1024;
 
+#if HAVE_MMAP
+  if (mode == STREAM_READ && stream_file_mmap && stream->type == STREAMTYPE_FILE)
+    map_open(stream, len);
+#endif
+#if HAVE_PTHREADS
+  if (mode == STREAM_READ && !stream->map && stream->type == STREAMTYPE_FILE)
+    ra_open(stream);
+#endif
+
   m_struct_free(&stream_opts,opts);
   return STREAM_OK;
 }
@@ -0,0 +1,71 @@
+#!/bin/sh
+# generates the local audio test corpus
+# usage: audiogen.sh <outdir> <sample>...
+# Sample names are <codec>-<samplerate>-<channels>.<ext>, e.g.
+# flac-48000-2.flac. Only the lossless samples are generated: the signal
+# is 30 seconds of a beeping tone per channel from the lavfi sine source,
+# whose table is computed with integer arithmetic, so the decoded PCM is
+# bit identical with every FFmpeg version.
+# The output of lossy encoders changes between FFmpeg versions and builds,
+# so the lossy samples are copied from tests/audio-fixtures, the MP3 ones
+# are synthetic Layer III frames (count1 coded lines for a tone per channel
+# and a stepped sweep, Xing header in the stereo one).
+# Samples whose encoder is not available in $AUDIOTEST_FFMPEG are skipped.
+
+FFMPEG=${AUDIOTEST_FFMPEG:-ffmpeg}
+encoders=""
+fixtures="$(dirname "$0")/audio-fixtures"
+outdir="$1"
+shift
+
+mkdir -p "$outdir"
+
+for sample in "$@" ; do
+  out="$outdir/$sample"
+  [ -s "$out" ] && continue
+  name="${sample%.*}"
+  codec="${name%%-*}"
+  rate="${name#*-}"
+  rate="${rate%-*}"
+  channels="${name##*-}"
+  if [ -e "$fixtures/$sample" ] ; then
+    echo "copying $sample"
+    cp "$fixtures/$sample" "$out"
+    continue
+  fi
+  case $codec in
+    wav)  encoder=pcm_s16le ;;
+    flac) encoder=flac ;;
+    *) echo "$sample is not in $fixtures" ; exit 1 ;;
+  esac
+  if [ -z "$encoders" ] ; then
+    if ! "$FFMPEG" -hide_banner -version > /dev/null 2>&1 ; then
+      echo "$FFMPEG not found, set AUDIOTEST_FFMPEG to generate the audio test corpus"
+      exit 1
+    fi
+    encoders=$("$FFMPEG" -hide_banner -encoders 2> /dev/null)
+  fi
+  if ! echo "$encoders" | grep -q " $encoder " ; then
+    echo "skipping $sample, $FFMPEG has no $encoder encoder"
+    continue
+  fi
+  graph=""
+  inputs=""
+  c=0
+  while [ $c -lt $channels ] ; do
+    c=$((c + 1))
+    graph="${graph}sine=frequency=$((110 * c)):beep_factor=$((c + 1)):sample_rate=$rate:duration=30[c$c];"
+    inputs="$inputs[c$c]"
+  done
+  if [ $channels -gt 1 ] ; then
+    graph="$graph${inputs}amerge=inputs=$channels"
+  else
+    graph="${graph%\[c1\];}"
+  fi
+  echo "generating $sample"
+  "$FFMPEG" -hide_banner -loglevel error -y -filter_complex "$graph" \
+    -fflags +bitexact -flags:a +bitexact -map_metadata -1 \
+    -c:a $encoder "$out.tmp.${sample##*.}" &&
+  mv "$out.tmp.${sample##*.}" "$out" ||
+  { rm -f "$out.tmp.${sample##*.}" ; echo "skipping $sample, $encoder failed" ; }
+done
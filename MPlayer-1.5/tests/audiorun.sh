@@ -0,0 +1,114 @@
+#!/bin/sh
+# decodes one sample of the audio corpus through -ao pcm, compares the md5
+# of the PCM output with tests/ref/audio and checks the speed, time to the
+# first sample and peak RSS against a per machine baseline, and the memory
+# accounted to the player subsystems with -lowmem against a fixed budget
+# usage: audiorun.sh <sampledir> <sample>
+#
+# AUDIOTEST_BASELINE   directory of the baseline, written by the first run
+# AUDIOTEST_TOLERANCE  allowed regression in percent (20)
+# AUDIOTEST_RUNS       number of timed runs, the best one counts (3)
+# AUDIOTEST_LOWMEM     accounted memory budget with -lowmem in kB (4096)
+# AUDIOTEST_LOWMEM_RSS peak RSS budget with -lowmem in kB (32768, 0 disables)
+#
+# The lossy samples are checked in under tests/audio-fixtures and the
+# lossless ones decode bit exactly, so the references hold with any FFmpeg,
+# use refupdate.sh to update them like the FATE references.
+
+sampledir="$1"
+sample="$2"
+file="$sampledir/$sample"
+md5out="tests/res/audio/$sample.md5"
+perfout="tests/res/audio/$sample.perf"
+ref_file="tests/ref/audio/$sample.md5"
+baseline_dir=${AUDIOTEST_BASELINE:-tests/res/audio-baseline}
+baseline="$baseline_dir/$sample.perf"
+tolerance=${AUDIOTEST_TOLERANCE:-20}
+runs=${AUDIOTEST_RUNS:-3}
+# ask for all channels of the sample instead of the default stereo downmix
+name="${sample%.*}"
+channels="${name##*-}"
+options="-channels $channels -noconfig all -noconsolecontrols -vo null -vc null -lavdopts bitexact -format s16le -benchmark -identify -msglevel all=1:cplayer=4:identify=4"
+
+if ! [ -s "$file" ] ; then
+  echo "skipping $sample, not in the corpus"
+  exit 0
+fi
+echo "testing $sample"
+mkdir -p tests/res/audio "$baseline_dir"
+pcm="tests/res/audio/$sample.pcm"
+rm -f "$md5out" "$md5out.bad" "$perfout"
+
+log=$(./mplayer $options -ao pcm:fast:nowaveheader:file="$pcm" "$file")
+if ! echo "$log" | grep -q '^ID_AUDIO_CODEC=' ; then
+  rm -f "$pcm"
+  if [ -e "$ref_file" ] ; then
+    echo "$sample: no audio decoder"
+    exit 1
+  fi
+  echo "skipping $sample, no audio decoder in this build"
+  exit 0
+fi
+# only the hash goes into the result, the file name differs between runs
+md5sum < "$pcm" | cut -d ' ' -f 1 > "$md5out"
+bytes=$(wc -c < "$pcm")
+rm -f "$pcm"
+
+# check result
+if ! [ -e "$ref_file" ] ; then
+  touch tests/ref/empty.md5
+  ref_file=tests/ref/empty.md5
+fi
+if ! diff -uw "$ref_file" "$md5out" ; then
+  mv "$md5out" "$md5out.bad"
+  exit 1
+fi
+
+# memory: -lowmem has to stay within the budget
+./mplayer $options -lowmem -ao pcm:fast:nowaveheader:file=/dev/null "$file" |
+  awk -v budget="${AUDIOTEST_LOWMEM:-4096}" -v rss_budget="${AUDIOTEST_LOWMEM_RSS:-32768}" -v sample="$sample" '
+  /^BENCHMARKm: peak RSS:/       { rss = $(NF - 1) + 0 }
+  /^BENCHMARKm: peak accounted:/ { mem = $(NF - 1) + 0 }
+  END {
+    bad = 0
+    if (mem == "" || mem > budget) {
+      printf "%s: -lowmem accounted %d kB, budget %d kB\n", sample, mem, budget; bad = 1 }
+    if (rss_budget + 0 > 0 && rss > rss_budget + 0) {
+      printf "%s: -lowmem peak RSS %d kB, budget %d kB\n", sample, rss, rss_budget; bad = 1 }
+    exit bad
+  }' || exit 1
+
+# performance: best of $runs runs, output discarded
+# bytes per second of the output, from "AO: [pcm] 44100Hz 2ch s16le (2 bytes per sample)"
+bps=$(echo "$log" | sed -n 's/^AO: \[pcm\] \([0-9]*\)Hz \([0-9]*\)ch .*(\([0-9]*\) bytes per sample)/\1 \2 \3/p' |
+      tail -n 1 | awk '{ print $1 * $2 * $3 }')
+i=0
+while [ $i -lt $runs ] ; do
+  i=$((i + 1))
+  ./mplayer $options -ao pcm:fast:nowaveheader:file=/dev/null "$file"
+done | awk -v bytes="$bytes" -v bps="$bps" '
+  /^BENCHMARKs:/ { t = $NF; sub(/s$/, "", t); t = t < 0.001 ? 0.001 : t + 0
+                   if (time == "" || t < time) time = t }
+  /^BENCHMARKa:/ { v = $NF; sub(/s$/, "", v); if (ttfs == "" || v + 0 < ttfs) ttfs = v + 0 }
+  /^BENCHMARKm:/ { v = $(NF - 1) + 0; if (rss == "" || v < rss) rss = v }
+  END { printf "speed=%.1f time=%.3f ttfs=%.4f rss=%d\n", bytes / bps / time, time, ttfs, rss }' > "$perfout"
+cat "$perfout"
+
+if ! [ -e "$baseline" ] ; then
+  cp "$perfout" "$baseline"
+  exit 0
+fi
+awk -v tol="$tolerance" -v sample="$sample" '
+  { for (i = 1; i <= NF; i++) { split($i, kv, "="); v[NR, kv[1]] = kv[2] } }
+  END {
+    f = tol / 100; bad = 0
+    # the speed is only meaningful if decoding takes measurable time
+    if (v[1, "time"] >= 0.05 && v[2, "speed"] < v[1, "speed"] * (1 - f)) {
+      printf "%s: speed %.1fx realtime, baseline %.1fx\n", sample, v[2, "speed"], v[1, "speed"]; bad = 1 }
+    # small absolute slack, the time to the first sample is only milliseconds
+    if (v[2, "ttfs"] > v[1, "ttfs"] * (1 + f) + 0.005) {
+      printf "%s: first sample after %.4fs, baseline %.4fs\n", sample, v[2, "ttfs"], v[1, "ttfs"]; bad = 1 }
+    if (v[2, "rss"] > v[1, "rss"] * (1 + f)) {
+      printf "%s: peak RSS %d kB, baseline %d kB\n", sample, v[2, "rss"], v[1, "rss"]; bad = 1 }
+    exit bad
+  }' "$baseline" "$perfout"